@@ -0,0 +1,347 @@
+// Per-stage microbenchmarks over deterministic synthetic images
+// Usage: gfx2agb_bench [stage name filter, or size: gba, 1080p, 4k]
+// Prints JSON: nanoseconds per pixel, bytes per second and heap allocations per iteration of each stage
+// gfx2agb_bench --check instead compares each fast path with its reference, exiting non-zero on a mismatch
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "check.hpp"
+#include "color_format.hpp"
+#include "compress.hpp"
+#include "image_io.hpp"
+#include "palette.hpp"
+#include "parallel.hpp"
+#include "util.hpp"
+
+namespace {
+
+    std::atomic<std::size_t> allocation_count{};
+    std::atomic<std::size_t> allocation_bytes{};
+
+    [[nodiscard]]
+    void* counted_alloc(std::size_t size, std::size_t alignment = alignof(std::max_align_t)) {
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+
+        void* ptr = nullptr;
+        if (alignment <= alignof(std::max_align_t)) {
+            ptr = std::malloc(std::max(size, std::size_t{1}));
+        } else {
+#if defined(_MSC_VER)
+            ptr = _aligned_malloc(std::max(size, std::size_t{1}), alignment);
+#else
+            ptr = std::aligned_alloc(alignment, ((std::max(size, std::size_t{1}) + alignment - 1) / alignment) * alignment);
+#endif
+        }
+
+        if (!ptr) {
+            throw std::bad_alloc{};
+        }
+        return ptr;
+    }
+
+    void counted_free(void* ptr, std::size_t alignment = alignof(std::max_align_t)) noexcept {
+#if defined(_MSC_VER)
+        if (alignment > alignof(std::max_align_t)) {
+            _aligned_free(ptr);
+            return;
+        }
+#endif
+        (void) alignment;
+        std::free(ptr);
+    }
+
+}
+
+void* operator new(std::size_t size) { return counted_alloc(size); }
+void* operator new[](std::size_t size) { return counted_alloc(size); }
+void* operator new(std::size_t size, std::align_val_t al) { return counted_alloc(size, std::size_t(al)); }
+void* operator new[](std::size_t size, std::align_val_t al) { return counted_alloc(size, std::size_t(al)); }
+void operator delete(void* ptr) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, std::align_val_t al) noexcept { counted_free(ptr, std::size_t(al)); }
+void operator delete[](void* ptr, std::align_val_t al) noexcept { counted_free(ptr, std::size_t(al)); }
+void operator delete(void* ptr, std::size_t, std::align_val_t al) noexcept { counted_free(ptr, std::size_t(al)); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t al) noexcept { counted_free(ptr, std::size_t(al)); }
+
+namespace {
+
+    using clock_type = std::chrono::steady_clock;
+
+    constexpr auto min_iterations = std::size_t{3};
+    constexpr auto min_duration = std::chrono::milliseconds{250};
+
+    struct size_type {
+        std::string_view name;
+        int width;
+        int height;
+    };
+
+    constexpr auto sizes = std::array{
+        size_type{"gba", 240, 160},
+        size_type{"1080p", 1920, 1080},
+        size_type{"4k", 3840, 2160}
+    };
+
+    constexpr auto palette_sizes = std::array{16, 64, 256};
+
+    struct result_type {
+        std::string name;
+        std::string size;
+        std::size_t pixels;
+        std::size_t iterations;
+        double nsPerPixel;
+        double bytesPerSecond;
+        double allocations;
+        double allocatedBytes;
+    };
+
+    // Smooth gradients with a little noise: many unique colors, like a photo, but the same on every run
+    [[nodiscard]]
+    std::vector<stbi_uc> synthetic_image(int width, int height) {
+        auto state = std::uint32_t{0x2545f491};
+        const auto next = [&state]() {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            return state;
+        };
+
+        auto pixels = std::vector<stbi_uc>(std::size_t(width) * std::size_t(height) * 4);
+        auto* dst = pixels.data();
+        for (int yy = 0; yy < height; ++yy) {
+            for (int xx = 0; xx < width; ++xx) {
+                const auto u = double(xx) / width;
+                const auto v = double(yy) / height;
+                const auto noise = int(next() % 9) - 4;
+                *dst++ = stbi_uc(std::clamp(int(255.0 * u) + noise, 0, 255));
+                *dst++ = stbi_uc(std::clamp(int(255.0 * v) + noise, 0, 255));
+                *dst++ = stbi_uc(std::clamp(int(255.0 * (1.0 - (u * v))) + noise, 0, 255));
+                *dst++ = stbi_uc(255 - ((xx ^ yy) & 0x10)); // Some alpha variation
+            }
+        }
+        return pixels;
+    }
+
+    class runner {
+    public:
+        explicit runner(std::string_view filter) noexcept : m_filter{filter} {}
+
+        // Times func until both min_iterations and min_duration are reached, bytes being processed per call
+        void run(std::string name, const size_type& size, std::size_t pixels, std::size_t bytes, const std::function<void()>& func) {
+            if (!m_filter.empty() && name.find(m_filter) == std::string::npos && size.name != m_filter) {
+                return;
+            }
+
+            func(); // Warm up caches and grow reused buffers
+
+            const auto countBefore = allocation_count.load();
+            const auto bytesBefore = allocation_bytes.load();
+
+            auto iterations = std::size_t{};
+            const auto start = clock_type::now();
+            auto elapsed = clock_type::duration{};
+            while (iterations < min_iterations || elapsed < min_duration) {
+                func();
+                ++iterations;
+                elapsed = clock_type::now() - start;
+            }
+
+            const auto seconds = std::chrono::duration<double>(elapsed).count();
+            m_results.push_back({
+                std::move(name), std::string{size.name}, pixels, iterations,
+                (seconds * 1e9) / (double(iterations) * double(pixels)),
+                (double(bytes) * double(iterations)) / seconds,
+                double(allocation_count.load() - countBefore) / double(iterations),
+                double(allocation_bytes.load() - bytesBefore) / double(iterations)
+            });
+
+            fmt::print(stderr, "{:40} {:6} {:10.3f} ns/px\n", m_results.back().name, size.name, m_results.back().nsPerPixel);
+        }
+
+        void print_json() const {
+            fmt::print("{{\n  \"version\": \"{}.{}.{}\",\n  \"threads\": {},\n  \"benchmarks\": [",
+                GFX2AGB_VERSION_MAJOR, GFX2AGB_VERSION_MINOR, GFX2AGB_VERSION_PATCH, parallel::concurrency());
+
+            auto first = true;
+            for (const auto& r : m_results) {
+                fmt::print("{}\n    {{\"name\": \"{}\", \"size\": \"{}\", \"pixels\": {}, \"iterations\": {}, \"ns_per_pixel\": {:.4f}, \"bytes_per_second\": {:.0f}, \"allocations\": {:.1f}, \"allocated_bytes\": {:.0f}}}",
+                    first ? "" : ",", r.name, r.size, r.pixels, r.iterations, r.nsPerPixel, r.bytesPerSecond, r.allocations, r.allocatedBytes);
+                first = false;
+            }
+            fmt::print("\n  ]\n}}\n");
+        }
+
+    private:
+        std::string_view m_filter;
+        std::vector<result_type> m_results;
+    };
+
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string_view{argv[1]} == "--check") {
+        const auto packer = check::packer();
+        const auto packRgba8 = check::pack_rgba8();
+        const auto repack = check::repack();
+        const auto compress = check::compress();
+        const auto delta = check::delta();
+        const auto orientate = check::orientate();
+        const auto paletteLookup = check::palette_lookup();
+        const auto banks = check::banks();
+        return packer && packRgba8 && repack && compress && delta && orientate && paletteLookup && banks ? 0 : 1;
+    }
+
+    auto bench = runner{argc > 1 ? argv[1] : ""};
+
+    const auto g1BGR5 = color_format::parse("g1BGR5");
+    const auto ABGR8 = color_format::parse("ABGR8");
+    const auto R5G6B5 = color_format::parse("R5G6B5"); // No specialized packer
+
+    for (const auto& size : sizes) {
+        const auto pixels = std::size_t(size.width) * std::size_t(size.height);
+        const auto source = synthetic_image(size.width, size.height);
+
+        auto linear = image::buffer<float>{};
+        auto out = image::buffer<float>{};
+        auto indices = image::buffer<std::uint8_t>{};
+        auto orientedIndices = image::buffer<std::uint8_t>{};
+        auto packed = std::vector<stbi_uc>{};
+
+        // Inputs of the later stages, whether or not their own benchmarks run
+        image::to_float(source, size.width, size.height, 2.2f, linear);
+        auto histogram = palette::extract(g1BGR5, linear);
+        image::palettize(linear, palette::quantize(histogram.colors, 256, palette::quantizer::wu, false, histogram.counts), indices);
+
+        bench.run("image::to_float", size, pixels, source.size(), [&]() {
+            image::to_float(source, size.width, size.height, 2.2f, linear);
+        });
+
+        const auto linearBytes = linear.pixel_count() * 4 * sizeof(float);
+
+        // Down to the Mode 3 screen, or up 2x from it
+        const auto resizeWidth = size.width == 240 ? 480 : 240;
+        const auto resizeHeight = size.height == 160 ? 320 : 160;
+
+        bench.run("image::resize", size, pixels, linearBytes, [&]() {
+            image::resize(linear, resizeWidth, resizeHeight, resample::filter::automatic, out);
+        });
+
+        // A whole ratio, which box filtering averages without reading weights
+        bench.run("image::resize/box", size, pixels, linearBytes, [&]() {
+            image::resize(linear, size.width / 4, size.height / 4, resample::filter::box, out);
+        });
+
+        bench.run("image::resize_and_resolve", size, pixels, linearBytes, [&]() {
+            image::resize_and_resolve(linear, resizeWidth, resizeHeight, resample::filter::automatic, out);
+        });
+
+        bench.run("palette::extract", size, pixels, linearBytes, [&]() {
+            histogram = palette::extract(g1BGR5, linear);
+        });
+
+        for (const auto colors : palette_sizes) {
+            for (const auto method : {palette::quantizer::median_cut, palette::quantizer::octree, palette::quantizer::wu, palette::quantizer::kmeans}) {
+                if (method == palette::quantizer::kmeans && size.width != 240) {
+                    continue; // Far too slow on large histograms to run repeatedly
+                }
+
+                static constexpr auto names = std::array{"kmeans", "median-cut", "octree", "wu"};
+                bench.run(fmt::format("palette::quantize/{}/{}", names[std::size_t(method)], colors), size, pixels, histogram.colors.size() * sizeof(histogram.colors[0]), [&]() {
+                    static_cast<void>(palette::quantize(histogram.colors, colors, method, false, histogram.counts));
+                });
+            }
+        }
+
+        for (const auto colors : palette_sizes) {
+            const auto palette = palette::quantize(histogram.colors, colors, palette::quantizer::wu, false, histogram.counts);
+            auto paletteIndices = image::buffer<std::uint8_t>{};
+            bench.run(fmt::format("image::palettize/{}", colors), size, pixels, linearBytes, [&]() {
+                image::palettize(linear, palette, paletteIndices);
+            });
+
+            // A fresh lookup each run, so the first search of every packed color is timed too
+            bench.run(fmt::format("image::palette_lookup/g1BGR5/{}", colors), size, pixels, linearBytes, [&]() {
+                image::palette_lookup{palette, g1BGR5, 1.0f / 2.2f}.palettize(linear, paletteIndices);
+            });
+
+            bench.run(fmt::format("image::palette_lookup/ABGR8/{}", colors), size, pixels, linearBytes, [&]() {
+                image::palette_lookup{palette, ABGR8, 1.0f / 2.2f}.palettize(linear, paletteIndices);
+            });
+        }
+
+        bench.run("image::to_data/g1BGR5", size, pixels, linearBytes, [&]() {
+            image::to_data(linear, 1.0f / 2.2f, g1BGR5, packed);
+        });
+
+        bench.run("image::to_data/ABGR8", size, pixels, linearBytes, [&]() {
+            image::to_data(linear, 1.0f / 2.2f, ABGR8, packed);
+        });
+
+        bench.run("image::to_data/R5G6B5", size, pixels, linearBytes, [&]() {
+            image::to_data(linear, 1.0f / 2.2f, R5G6B5, packed);
+        });
+
+        bench.run("image::pack_rgba8/g1BGR5", size, pixels, source.size(), [&]() {
+            image::pack_rgba8(source, size.width, size.height, 2.2f, 1.0f / 2.2f, g1BGR5, packed);
+        });
+
+        bench.run("image::orientate/float", size, pixels, linearBytes, [&]() {
+            image::orientate(linear, image::direction::plus_y, image::direction::plus_x, out);
+        });
+
+        bench.run("image::orientate/index", size, pixels, indices.data.size() * sizeof(std::uint8_t), [&]() {
+            image::orientate(indices, image::direction::plus_y, image::direction::plus_x, orientedIndices);
+        });
+
+        bench.run("image::orientate_in_place/float", size, pixels, linearBytes, [&]() {
+            image::orientate_in_place(linear, image::direction::minus_x, image::direction::minus_y, out);
+        });
+
+        for (const auto bpp : {std::size_t{1}, std::size_t{2}, std::size_t{4}, std::size_t{8}}) {
+            bench.run(fmt::format("util::repack_data/{}", bpp), size, pixels, indices.data.size() * sizeof(std::uint8_t), [&]() {
+                static_cast<void>(util::repack_data(indices.data, bpp));
+            });
+        }
+
+        // Mode 4 data as --compress sees it
+        const auto indexData = util::repack_data(indices.data, 8);
+        const auto indexBytes = std::as_bytes(std::span{indexData});
+        static constexpr auto compressions = std::array{
+            std::pair{"lz77", compress::method::lz77}, std::pair{"lz77-vram", compress::method::lz77_vram},
+            std::pair{"rle", compress::method::rle}, std::pair{"huff4", compress::method::huff4}, std::pair{"huff8", compress::method::huff8}
+        };
+        for (const auto& [name, method] : compressions) {
+            for (const auto optimal : {false, true}) {
+                if (optimal && (method != compress::method::lz77 || size.width != 240)) {
+                    continue; // Only LZ77 has an optimal parse, which searches the whole window at every byte
+                }
+
+                bench.run(fmt::format("compress::encoder/{}{}", name, optimal ? "/optimal" : ""), size, pixels, indexBytes.size(), [&]() {
+                    auto stream = compress::encoder{method, optimal};
+                    stream.append(indexBytes);
+                    static_cast<void>(stream.finish());
+                });
+            }
+        }
+    }
+
+    bench.print_json();
+    return 0;
+}
@@ -0,0 +1,995 @@
+#include "check.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "banks.hpp"
+#include "color_format.hpp"
+#include "compress.hpp"
+#include "delta.hpp"
+#include "image_io.hpp"
+#include "packer.hpp"
+#include "tileset.hpp"
+#include "util.hpp"
+
+namespace {
+
+    // Below image_io's specialize_min_pixels, so to_data takes the generic path
+    constexpr auto generic_pixels = std::size_t{1024};
+
+    // Formats with a specialized packer
+    constexpr auto packed_formats = std::array<std::string_view, 6>{"g1BGR5", "BGR5", "BGRA8", "ABGR8", "A8R8G8B8", "R8"};
+
+    // Gammas to_data packs with: 1 / --gamma for the usual output gammas, and linear
+    constexpr auto packed_pows = std::array{1.0f / 2.2f, 1.0f / 1.8f, 1.0f, 2.2f};
+
+    // Values each packer is fed: a sweep of [0, 1], the inputs either side of the first input of every code of each color channel, and values outside [0, 1]
+    [[nodiscard]]
+    std::vector<float> packer_inputs(const std::array<color_format::color_channel_type, 4>& channels, float pow, int sweep = 1 << 16) {
+        static constexpr auto ulps = std::uint32_t{4};
+
+        auto result = std::vector<float>{};
+        for (auto ii = 0; ii <= sweep; ++ii) {
+            result.push_back(float(ii) / float(sweep));
+        }
+
+        // First input of each code, bisected over the float bit patterns of (0, 1] on the exact conversion
+        for (const auto& channel : std::span{channels}.first(3)) {
+            for (auto code = 1; code <= channel.mask(); ++code) {
+                auto lo = std::bit_cast<std::uint32_t>(0.0f);
+                auto hi = std::bit_cast<std::uint32_t>(1.0f);
+                while (lo < hi) {
+                    const auto mid = lo + ((hi - lo) / 2);
+                    if (channel.pow(std::bit_cast<float>(mid), pow) >= code) {
+                        hi = mid;
+                    } else {
+                        lo = mid + 1;
+                    }
+                }
+
+                for (auto bits = lo - std::min(lo, ulps); bits <= lo + ulps; ++bits) {
+                    result.push_back(std::bit_cast<float>(bits));
+                }
+            }
+        }
+
+        constexpr auto limits = std::numeric_limits<float>{};
+        for (const auto x : {0.0f, -0.0f, 1.0f, limits.denorm_min(), limits.min(), limits.epsilon(), std::nextafter(1.0f, 0.0f), std::nextafter(1.0f, 2.0f),
+            -limits.denorm_min(), -0.5f, -1.0f, 1.5f, 2.0f, 1e30f, -1e30f, limits.infinity(), -limits.infinity(), limits.quiet_NaN(), -limits.quiet_NaN()}) {
+            result.push_back(x);
+        }
+        return result;
+    }
+
+    // Little-endian 32-bit word at data
+    [[nodiscard]]
+    std::uint32_t read32(std::span<const std::byte> data) noexcept {
+        return std::uint32_t(data[0]) | (std::uint32_t(data[1]) << 8) | (std::uint32_t(data[2]) << 16) | (std::uint32_t(data[3]) << 24);
+    }
+
+    // LZ77UnCompWram/Vram, nullopt on a malformed stream or, for VRAM, a copy from the byte just written
+    [[nodiscard]]
+    std::optional<std::vector<std::byte>> decode_lz77(std::span<const std::byte> stream, std::size_t size, bool vram) {
+        auto result = std::vector<std::byte>{};
+        auto pos = std::size_t{4};
+        while (result.size() < size) {
+            if (pos >= stream.size()) {
+                return std::nullopt;
+            }
+            const auto flags = std::uint8_t(stream[pos++]);
+            for (auto bit = 0; bit < 8 && result.size() < size; ++bit) {
+                if (!(flags & (0x80 >> bit))) {
+                    if (pos >= stream.size()) {
+                        return std::nullopt;
+                    }
+                    result.push_back(stream[pos++]);
+                    continue;
+                }
+
+                if (pos + 2 > stream.size()) {
+                    return std::nullopt;
+                }
+                const auto high = std::size_t(stream[pos++]);
+                const auto low = std::size_t(stream[pos++]);
+                const auto length = (high >> 4) + 3;
+                const auto distance = (((high & 0xf) << 8) | low) + 1;
+                if (distance > result.size() || (vram && distance < 2) || result.size() + length > size) {
+                    return std::nullopt;
+                }
+                for (auto ii = std::size_t{}; ii < length; ++ii) {
+                    result.push_back(result[result.size() - distance]);
+                }
+            }
+        }
+        return result;
+    }
+
+    // RLUnCompWram/Vram
+    [[nodiscard]]
+    std::optional<std::vector<std::byte>> decode_rle(std::span<const std::byte> stream, std::size_t size) {
+        auto result = std::vector<std::byte>{};
+        auto pos = std::size_t{4};
+        while (result.size() < size) {
+            if (pos >= stream.size()) {
+                return std::nullopt;
+            }
+            const auto flag = std::size_t(stream[pos++]);
+            if (flag & 0x80) {
+                const auto run = (flag & 0x7f) + 3;
+                if (pos >= stream.size() || result.size() + run > size) {
+                    return std::nullopt;
+                }
+                result.insert(result.cend(), run, stream[pos++]);
+            } else {
+                const auto count = flag + 1;
+                if (pos + count > stream.size() || result.size() + count > size) {
+                    return std::nullopt;
+                }
+                result.insert(result.cend(), stream.begin() + std::ptrdiff_t(pos), stream.begin() + std::ptrdiff_t(pos + count));
+                pos += count;
+            }
+        }
+        return result;
+    }
+
+    // HuffUnComp: the tree follows the header, then the codes in 32-bit words read from bit 31 down
+    [[nodiscard]]
+    std::optional<std::vector<std::byte>> decode_huffman(std::span<const std::byte> stream, std::size_t size, int bits) {
+        if (stream.size() < 6) {
+            return std::nullopt;
+        }
+        const auto tree = stream.subspan(4);
+        const auto treeBytes = (std::size_t(tree[0]) + 1) * 2;
+        if (treeBytes > tree.size()) {
+            return std::nullopt;
+        }
+
+        auto result = std::vector<std::byte>{};
+        auto pos = 4 + treeBytes;
+        auto node = std::size_t{1};
+        auto unit = 0U;
+        auto units = 0;
+        while (result.size() < size) {
+            if (pos + 4 > stream.size()) {
+                return std::nullopt;
+            }
+            const auto word = read32(stream.subspan(pos));
+            pos += 4;
+
+            for (auto bit = 31; bit >= 0 && result.size() < size; --bit) {
+                const auto side = std::size_t((word >> bit) & 1);
+                const auto flags = std::size_t(tree[node]);
+                const auto child = (node & ~std::size_t{1}) + ((flags & 0x3f) * 2) + 2 + side;
+                if (child >= treeBytes) {
+                    return std::nullopt;
+                }
+                if (!(flags & (0x80 >> side))) {
+                    node = child;
+                    continue;
+                }
+
+                // Units fill each byte from the low bits up
+                unit |= unsigned(tree[child]) << (units * bits);
+                node = 1;
+                if (++units * bits == 8) {
+                    result.push_back(std::byte(unit));
+                    unit = 0;
+                    units = 0;
+                }
+            }
+        }
+        return result;
+    }
+
+    [[nodiscard]]
+    std::optional<std::vector<std::byte>> decode(compress::method m, std::span<const std::byte> stream) {
+        if (stream.size() < 4 || stream.size() % 4) {
+            return std::nullopt;
+        }
+
+        const auto size = std::size_t(read32(stream) >> 8);
+        const auto type = std::uint8_t(stream[0]);
+        switch (m) {
+            case compress::method::lz77:
+            case compress::method::lz77_vram:
+                return type == 0x10 ? decode_lz77(stream, size, m == compress::method::lz77_vram) : std::nullopt;
+            case compress::method::rle:
+                return type == 0x30 ? decode_rle(stream, size) : std::nullopt;
+            case compress::method::huff4:
+                return type == 0x24 ? decode_huffman(stream, size, 4) : std::nullopt;
+            case compress::method::huff8:
+                return type == 0x28 ? decode_huffman(stream, size, 8) : std::nullopt;
+        }
+        return std::nullopt;
+    }
+
+    // Named inputs: uniform noise, a few common values, runs, repeats at every distance, and unit counts that make the deepest Huffman trees
+    [[nodiscard]]
+    std::vector<std::pair<std::string, std::vector<std::byte>>> compress_inputs() {
+        auto state = std::uint32_t{0x9e3779b9};
+        const auto next = [&state]() {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            return state;
+        };
+
+        auto result = std::vector<std::pair<std::string, std::vector<std::byte>>>{};
+        for (const auto size : {std::size_t{0}, std::size_t{1}, std::size_t{2}, std::size_t{3}, std::size_t{17}, std::size_t{1000}, std::size_t{70000}}) {
+            auto random = std::vector<std::byte>(size);
+            auto skewed = std::vector<std::byte>(size);
+            auto runs = std::vector<std::byte>(size);
+            auto repeats = std::vector<std::byte>(size);
+            for (auto ii = std::size_t{}; ii < size; ++ii) {
+                random[ii] = std::byte(next());
+                skewed[ii] = std::byte(std::countr_zero(next() | 0x80000000u)); // Value k with probability 2^-(k+1)
+                runs[ii] = ii && next() % 8 ? runs[ii - 1] : std::byte(next() % 4);
+                const auto distance = 1 + (ii / 997 % 24);
+                repeats[ii] = ii >= distance && next() % 16 ? repeats[ii - distance] : std::byte(next());
+            }
+            result.emplace_back(fmt::format("random {}", size), std::move(random));
+            result.emplace_back(fmt::format("skewed {}", size), std::move(skewed));
+            result.emplace_back(fmt::format("runs {}", size), std::move(runs));
+            result.emplace_back(fmt::format("repeats {}", size), std::move(repeats));
+            result.emplace_back(fmt::format("constant {}", size), std::vector<std::byte>(size, std::byte{0x5a}));
+        }
+
+        // Unit k occurs fib(k) times, so each code is one bit longer than the last
+        auto fibonacci = std::vector<std::byte>{};
+        auto counts = std::pair{std::size_t{1}, std::size_t{1}};
+        for (auto unit = 0; unit < 24; ++unit) {
+            fibonacci.insert(fibonacci.cend(), counts.first, std::byte(unit));
+            counts = {counts.second, counts.first + counts.second};
+        }
+        for (auto ii = fibonacci.size(); ii > 1; --ii) {
+            std::swap(fibonacci[ii - 1], fibonacci[next() % ii]);
+        }
+        result.emplace_back("fibonacci", std::move(fibonacci));
+        return result;
+    }
+
+    // Copies each entry of a delta record into vram, as a player would, adding the bytes copied to copied
+    // False on a malformed record, an entry outside vram, or bytes left after the last entry
+    [[nodiscard]]
+    bool apply_delta(std::span<const std::byte> record, delta::granularity g, std::size_t rowWords, std::vector<std::byte>& vram, std::size_t& copied) {
+        auto pos = std::size_t{};
+        const auto u16 = [&]() -> std::optional<std::size_t> {
+            if (pos + 2 > record.size()) {
+                return std::nullopt;
+            }
+            pos += 2;
+            return std::size_t(record[pos - 2]) | (std::size_t(record[pos - 1]) << 8);
+        };
+        const auto copy = [&](std::size_t offset, std::size_t words) {
+            if (pos + (words * 4) > record.size() || (offset + words) * 4 > vram.size()) {
+                return false;
+            }
+            std::memcpy(vram.data() + (offset * 4), record.data() + pos, words * 4);
+            pos += words * 4;
+            copied += words * 4;
+            return true;
+        };
+
+        const auto count = u16();
+        if (!count || u16() != std::size_t{0}) {
+            return false;
+        }
+        for (auto entry = std::size_t{}; entry < *count; ++entry) {
+            if (g == delta::granularity::word) {
+                const auto offset = u16();
+                const auto length = u16();
+                if (!offset || !length || !*length || !copy(*offset, *length)) {
+                    return false;
+                }
+                continue;
+            }
+
+            const auto x = u16();
+            const auto y = u16();
+            const auto width = u16();
+            const auto height = u16();
+            if (!x || !y || !width || !height || !*width || !*height || *x + *width > rowWords) {
+                return false;
+            }
+            for (auto row = *y; row < *y + *height; ++row) {
+                if (!copy((row * rowWords) + *x, *width)) {
+                    return false;
+                }
+            }
+        }
+        return pos == record.size();
+    }
+
+    // Low bpp bits of each index from bit 0 of the first byte, as the GBA reads them
+    template <typename T>
+    [[nodiscard]]
+    std::vector<char> repack_reference(const std::vector<T>& data, std::size_t bpp) {
+        auto result = std::vector<char>(((bpp * data.size()) + 7) / 8);
+        for (auto ii = std::size_t{}; ii < data.size(); ++ii) {
+            for (auto bit = std::size_t{}; bit < bpp && bit < sizeof(T) * 8; ++bit) {
+                if ((std::uint64_t(data[ii]) >> bit) & 1) {
+                    const auto position = (ii * bpp) + bit;
+                    result[position / 8] = char(result[position / 8] | (1 << (position % 8)));
+                }
+            }
+        }
+        return result;
+    }
+
+    template <typename T>
+    [[nodiscard]]
+    bool repack_type(std::string_view name) {
+        auto state = std::uint32_t{0x2545f491};
+        auto ok = true;
+        for (const auto bpp : {std::size_t{1}, std::size_t{2}, std::size_t{4}, std::size_t{8}, std::size_t{16}, std::size_t{3}, std::size_t{24}}) {
+            for (const auto size : {std::size_t{0}, std::size_t{1}, std::size_t{2}, std::size_t{3}, std::size_t{5}, std::size_t{7}, std::size_t{8}, std::size_t{9}, std::size_t{4099}}) {
+                // Indices past bpp bits too, whose extra bits must be dropped
+                auto data = std::vector<T>(size);
+                for (auto& index : data) {
+                    state ^= state << 13;
+                    state ^= state >> 17;
+                    state ^= state << 5;
+                    index = T(state);
+                }
+
+                if (util::repack_data(data, bpp) != repack_reference(data, bpp)) {
+                    fmt::print(stderr, "repack {} bpp {}: {} indices pack differently\n", name, bpp, size);
+                    ok = false;
+                }
+            }
+        }
+        return ok;
+    }
+
+    // Calls func with each value of [low, high), in reverse when dir is negative
+    void directional_for(int low, int high, int dir, auto func) {
+        if (dir < 0) {
+            for (auto ii = high - 1; ii >= low; --ii) {
+                func(ii);
+            }
+        } else {
+            for (auto ii = low; ii < high; ++ii) {
+                func(ii);
+            }
+        }
+    }
+
+    // image::orientate as it was, walking the output a pixel at a time
+    template <typename T>
+    [[nodiscard]]
+    image::buffer<T> orientate_reference(const image::buffer<T>& image, image::direction major, image::direction minor) {
+        const auto transpose = !image::is_x_axis(major);
+        auto result = image::buffer<T>{};
+        result.reshape(transpose ? image.height : image.width, transpose ? image.width : image.height, image.layout);
+
+        const auto majorStride = major == image::direction::plus_x || major == image::direction::plus_y ? 1 : -1;
+        const auto minorStride = minor == image::direction::plus_x || minor == image::direction::plus_y ? 1 : -1;
+        auto dst = result.data.begin();
+        const auto copy_pixel = [&](int xx, int yy) {
+            dst = std::ranges::copy(image.row(yy).subspan(std::size_t(xx) * image.channels(), image.channels()), dst).out;
+        };
+
+        if (!transpose) {
+            directional_for(0, image.height, minorStride, [&](int yy) {
+                directional_for(0, image.width, majorStride, [&](int xx) {
+                    copy_pixel(xx, yy);
+                });
+            });
+        } else {
+            directional_for(0, image.width, majorStride, [&](int xx) {
+                directional_for(0, image.height, minorStride, [&](int yy) {
+                    copy_pixel(xx, yy);
+                });
+            });
+        }
+        return result;
+    }
+
+    // orientate, orientate_rows in bands, and orientate_in_place against the reference in every direction, at sizes that leave partial tiles
+    template <typename T>
+    [[nodiscard]]
+    bool orientate_type(std::string_view name, image::layout layout) {
+        static constexpr auto directions = std::array{"+x+y", "+x-y", "-x+y", "-x-y", "+y+x", "+y-x", "-y+x", "-y-x"};
+
+        auto state = std::uint32_t{0x3c6ef372};
+        auto ok = true;
+        for (const auto& [width, height] : {std::pair{1, 1}, std::pair{1, 45}, std::pair{33, 47}, std::pair{70, 31}, std::pair{100, 3}, std::pair{257, 130}}) {
+            auto image = image::buffer<T>{};
+            image.reshape(width, height, layout);
+            for (auto& value : image.data) {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                value = T(state);
+            }
+
+            for (const auto direction : directions) {
+                const auto [major, minor] = image::direction_pair(direction);
+                const auto expected = orientate_reference(image, major, minor);
+                const auto same = [&](const image::buffer<T>& result, int rowBegin) {
+                    if (result.width != expected.width || rowBegin + result.height > expected.height) {
+                        return false;
+                    }
+                    for (auto yy = 0; yy < result.height; ++yy) {
+                        if (!std::ranges::equal(result.row(yy), expected.row(rowBegin + yy))) {
+                            return false;
+                        }
+                    }
+                    return true;
+                };
+                const auto label = fmt::format("orientate {} {}x{} {}", name, width, height, direction);
+
+                auto whole = image::buffer<T>{};
+                image::orientate(image, major, minor, whole);
+                if (whole.height != expected.height || !same(whole, 0)) {
+                    fmt::print(stderr, "{}: differs\n", label);
+                    ok = false;
+                }
+
+                // Bands of a few rows, as convert_bitmap packs them
+                auto band = image::buffer<T>{};
+                for (auto rowBegin = 0; rowBegin < expected.height; rowBegin += 7) {
+                    const auto rowEnd = std::min(rowBegin + 7, expected.height);
+                    image::orientate_rows(image, major, minor, rowBegin, rowEnd, band);
+                    if (band.height != rowEnd - rowBegin || !same(band, rowBegin)) {
+                        fmt::print(stderr, "{}: rows [{}, {}) differ\n", label, rowBegin, rowEnd);
+                        ok = false;
+                        break;
+                    }
+                }
+
+                auto inPlace = image;
+                auto scratch = image::buffer<T>{};
+                image::orientate_in_place(inPlace, major, minor, scratch);
+                if (inPlace.height != expected.height || !same(inPlace, 0)) {
+                    fmt::print(stderr, "{}: differs in place\n", label);
+                    ok = false;
+                }
+            }
+        }
+        return ok;
+    }
+
+    // Index of the color of palette nearest pixel, the first of equally near ones, by the metric palettize has always used
+    [[nodiscard]]
+    std::size_t nearest_reference(const std::vector<std::array<float, 4>>& palette, const std::array<float, 4>& pixel) {
+        const auto distance = [&](const std::array<float, 4>& color) {
+            return std::sqrt(std::pow(color[0] - pixel[0], 2) + std::pow(color[1] - pixel[1], 2) + std::pow(color[2] - pixel[2], 2));
+        };
+        return std::size_t(std::ranges::min_element(palette, {}, distance) - palette.cbegin());
+    }
+
+    // Random colors, some of them repeated so ties must go to the first
+    [[nodiscard]]
+    std::vector<std::array<float, 4>> random_palette(std::size_t count, std::uint32_t seed) {
+        auto result = std::vector<std::array<float, 4>>{};
+        for (auto ii = std::size_t{}; ii < count; ++ii) {
+            seed = (seed * 1664525u) + 1013904223u;
+            if (ii && seed % 8 == 0) {
+                result.push_back(result[seed % ii]);
+                continue;
+            }
+            auto color = std::array<float, 4>{};
+            for (auto& channel : color) {
+                seed = (seed * 1664525u) + 1013904223u;
+                channel = float(seed >> 8) / float(1u << 24);
+            }
+            result.push_back(color);
+        }
+        return result;
+    }
+
+    // palette_lookup against the nearest color to each pixel's packed color, or to the pixel itself when the format lacks a color channel
+    template <typename Index>
+    bool palette_lookup_format(std::string_view name, float pow, const std::vector<std::array<float, 4>>& palette) {
+        const auto format = color_format::parse(name);
+        const auto channels = color_format::to_rgba_channels(format);
+        const auto exact = !channels[0].size() || !channels[1].size() || !channels[2].size();
+        const auto lookup = image::palette_lookup{palette, format, pow};
+
+        // Each channel's code boundaries, in every channel of some pixel, then as many random pixels again
+        auto inputs = packer_inputs(channels, pow, 1 << 8);
+        std::erase_if(inputs, [](float x) {
+            return !std::isfinite(x);
+        });
+        auto image = image::buffer<float>{};
+        image.reshape(256, int((inputs.size() * 2 + 255) / 256), image::layout::rgba);
+        auto seed = std::uint32_t{0x9e3779b9};
+        for (auto ii = std::size_t{}; ii < image.pixel_count(); ++ii) {
+            for (auto cc = std::size_t{}; cc < 4; ++cc) {
+                seed = (seed * 1664525u) + 1013904223u;
+                image.data[(ii * 4) + cc] = ii < inputs.size() ? inputs[(ii + (cc * 7919)) % inputs.size()] : float(seed >> 8) / float(1u << 24);
+            }
+        }
+
+        // Twice, as tables are kept between calls
+        auto ok = true;
+        for (const auto pass : {1, 2}) {
+            auto indices = image::buffer<Index>{};
+            lookup.palettize(image, indices);
+
+            for (auto ii = std::size_t{}; ii < image.pixel_count(); ++ii) {
+                const auto* pixel = image.data.data() + (ii * 4);
+                auto color = std::array{pixel[0], pixel[1], pixel[2], pixel[3]};
+                if (!exact) {
+                    // Keyed values outside [0, 1] take the nearest level
+                    for (auto cc = std::size_t{}; cc < 3; ++cc) {
+                        const auto mask = float(channels[cc].mask());
+                        color[cc] = std::pow(float(channels[cc].pow(std::clamp(color[cc], 0.0f, 1.0f), pow)) / mask, 1.0f / pow);
+                    }
+                }
+
+                const auto expected = nearest_reference(palette, color);
+                if (indices.data[ii] != expected) {
+                    fmt::print(stderr, "palette_lookup {} pow {} {} colors pass {}: pixel ({}, {}, {}) takes index {}, nearest is {}\n",
+                        name, pow, palette.size(), pass, pixel[0], pixel[1], pixel[2], indices.data[ii], expected);
+                    ok = false;
+                    break;
+                }
+            }
+        }
+        return ok;
+    }
+
+    // Tiles of 8x8 pixels, each drawn from one of groups of colors at random
+    [[nodiscard]]
+    image::buffer<float> group_tiles(int columns, int rows, const std::vector<std::vector<std::array<float, 4>>>& groups, std::uint32_t seed) {
+        const auto next = [&seed]() {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            return seed;
+        };
+
+        auto result = image::buffer<float>{};
+        result.reshape(columns * tileset::tile_size, rows * tileset::tile_size, image::layout::rgba);
+        for (auto ty = 0; ty < rows; ++ty) {
+            for (auto tx = 0; tx < columns; ++tx) {
+                const auto& group = groups[next() % groups.size()];
+                for (auto yy = 0; yy < tileset::tile_size; ++yy) {
+                    auto row = result.row((ty * tileset::tile_size) + yy).subspan(std::size_t(tx) * tileset::tile_size * 4, tileset::tile_size * 4);
+                    for (auto xx = std::size_t{}; xx < row.size(); xx += 4) {
+                        std::ranges::copy(group[next() % group.size()], row.begin() + std::ptrdiff_t(xx));
+                    }
+                }
+            }
+        }
+        return result;
+    }
+
+    // Colors with every channel one of a few levels far enough apart that packing never confuses them
+    [[nodiscard]]
+    std::vector<std::array<float, 4>> level_colors(std::size_t count, std::uint32_t seed) {
+        static constexpr auto levels = std::array{0.0f, 0.25f, 0.5f, 0.75f, 1.0f};
+
+        auto result = std::vector<std::array<float, 4>>{};
+        while (result.size() < count) {
+            seed = (seed * 1664525u) + 1013904223u;
+            const auto color = std::array{levels[(seed >> 8) % 5], levels[(seed >> 16) % 5], levels[(seed >> 24) % 5], 1.0f};
+            if (std::ranges::find(result, color) == result.cend()) {
+                result.push_back(color);
+            }
+        }
+        return result;
+    }
+
+    // Every tile has a bank and every index is within its tile's bank, and with dropsUnused, every bank has a tile
+    bool banks_valid(std::string_view label, const image::buffer<float>& image, const banks::banks_type& result, std::size_t maxBanks, bool dropsUnused) {
+        const auto columns = std::size_t(image.width / tileset::tile_size);
+        const auto tiles = columns * std::size_t(image.height / tileset::tile_size);
+
+        if (result.palettes.empty() || result.palettes.size() > maxBanks || result.tileBanks.size() != tiles ||
+            result.indices.width != image.width || result.indices.height != image.height) {
+            fmt::print(stderr, "banks {}: {} banks for {} tiles, indices {}x{}\n", label, result.palettes.size(), result.tileBanks.size(), result.indices.width, result.indices.height);
+            return false;
+        }
+
+        auto used = std::vector<bool>(result.palettes.size());
+        for (auto tile = std::size_t{}; tile < tiles; ++tile) {
+            const auto bank = result.tileBanks[tile];
+            if (bank >= result.palettes.size()) {
+                fmt::print(stderr, "banks {}: tile {} in bank {} of {}\n", label, tile, bank, result.palettes.size());
+                return false;
+            }
+            used[bank] = true;
+        }
+
+        for (auto bank = std::size_t{}; bank < result.palettes.size(); ++bank) {
+            if (result.palettes[bank].size() > banks::bank_colors) {
+                fmt::print(stderr, "banks {}: bank {} has {} colors\n", label, bank, result.palettes[bank].size());
+                return false;
+            }
+            if (dropsUnused && !used[bank]) {
+                fmt::print(stderr, "banks {}: bank {} has no tiles\n", label, bank);
+                return false;
+            }
+        }
+
+        for (auto yy = 0; yy < image.height; ++yy) {
+            const auto row = result.indices.row(yy);
+            for (auto xx = std::size_t{}; xx < row.size(); ++xx) {
+                const auto bank = result.tileBanks[(std::size_t(yy / tileset::tile_size) * columns) + (xx / tileset::tile_size)];
+                if (row[xx] >= result.palettes[bank].size()) {
+                    fmt::print(stderr, "banks {}: pixel ({}, {}) has index {} into bank {} of {} colors\n", label, xx, yy, row[xx], bank, result.palettes[bank].size());
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Every pixel's index picks its own color
+    bool banks_exact(std::string_view label, const image::buffer<float>& image, const banks::banks_type& result) {
+        const auto columns = std::size_t(image.width / tileset::tile_size);
+        for (auto yy = 0; yy < image.height; ++yy) {
+            const auto row = result.indices.row(yy);
+            const auto pixels = image.row(yy);
+            for (auto xx = std::size_t{}; xx < row.size(); ++xx) {
+                const auto& color = result.palettes[result.tileBanks[(std::size_t(yy / tileset::tile_size) * columns) + (xx / tileset::tile_size)]][row[xx]];
+                if (!std::equal(color.cbegin(), color.cend(), pixels.begin() + std::ptrdiff_t(xx * 4))) {
+                    fmt::print(stderr, "banks {}: pixel ({}, {}) does not reproduce its color\n", label, xx, yy);
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+}
+
+bool check::packer() {
+    auto ok = true;
+
+    for (const auto name : packed_formats) {
+        const auto format = color_format::parse(name);
+        const auto channels = color_format::to_rgba_channels(format);
+        const auto bytesPerPixel = std::size_t((std::accumulate(channels.cbegin(), channels.cend(), 0, [](auto acc, const auto& c) { return acc + int(c.size()); }) + 7) / 8);
+
+        const auto packRows = packer::find(format);
+        if (!packRows) {
+            fmt::print(stderr, "packer {}: no specialized packer\n", name);
+            ok = false;
+            continue;
+        }
+
+        for (const auto pow : packed_pows) {
+            const auto tables = packer::channel_tables{
+                packer::channel_table{channels[0], pow},
+                packer::channel_table{channels[1], pow},
+                packer::channel_table{channels[2], pow}
+            };
+
+            // Each input in every channel, along with its neighbours so channels also differ within a pixel
+            const auto inputs = packer_inputs(channels, pow);
+            auto image = image::buffer<float>{};
+            image.reshape(int(generic_pixels), int((inputs.size() + generic_pixels - 1) / generic_pixels), image::layout::rgba);
+            for (auto ii = std::size_t{}; ii < image.pixel_count(); ++ii) {
+                for (auto cc = std::size_t{}; cc < 4; ++cc) {
+                    image.data[(ii * 4) + cc] = inputs[(ii + (cc * 7919)) % inputs.size()];
+                }
+            }
+
+            auto specialized = std::vector<stbi_uc>(image.pixel_count() * bytesPerPixel);
+            packRows(image, 0, std::size_t(image.height), tables, specialized.data());
+
+            // A row at a time, each too small for to_data to specialize
+            auto generic = std::vector<stbi_uc>{};
+            auto row = image::buffer<float>{};
+            auto rowData = std::vector<stbi_uc>{};
+            for (auto yy = 0; yy < image.height; ++yy) {
+                row.reshape(image.width, 1, image::layout::rgba);
+                std::ranges::copy(image.row(yy), row.data.begin());
+                image::to_data(row, pow, format, rowData);
+                generic.insert(generic.cend(), rowData.cbegin(), rowData.cend());
+            }
+
+            for (auto ii = std::size_t{}; ii < image.pixel_count(); ++ii) {
+                if (!std::equal(specialized.cbegin() + std::ptrdiff_t(ii * bytesPerPixel), specialized.cbegin() + std::ptrdiff_t((ii + 1) * bytesPerPixel), generic.cbegin() + std::ptrdiff_t(ii * bytesPerPixel))) {
+                    const auto* pixel = image.data.data() + (ii * 4);
+                    fmt::print(stderr, "packer {} pow {}: pixel ({}, {}, {}, {}) packs differently\n", name, pow, pixel[0], pixel[1], pixel[2], pixel[3]);
+                    ok = false;
+                    break;
+                }
+            }
+        }
+    }
+
+    fmt::print(stderr, "packer: {}\n", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+bool check::pack_rgba8() {
+    auto ok = true;
+
+    // Every 8-bit value in each channel of every row, rotated between channels and rows, over enough rows for to_data to specialize
+    constexpr auto width = 256;
+    constexpr auto height = 17;
+    auto pixels = std::vector<stbi_uc>(std::size_t(width) * height * 4);
+    for (auto ii = std::size_t{}; ii < pixels.size(); ++ii) {
+        const auto row = ii / (width * 4);
+        pixels[ii] = stbi_uc(((ii / 4) + ((ii % 4) * 67) + (row * 29)) % 256);
+    }
+
+    // Example formats of --help-formats, the preview format, and layouts with split, wide and odd-sized channels
+    for (const auto name : {"g1BGR5", "BGRA8", "BGR8", "BGR5", "A8R8G8B8", "R8", "ABGR8", "R5G6B5", "A1BGR5", "BGR10", "R16", "BGRA16"}) {
+        const auto format = color_format::parse(name);
+        if (format.empty()) {
+            fmt::print(stderr, "pack_rgba8 {}: not a format\n", name);
+            ok = false;
+            continue;
+        }
+        const auto bytesPerPixel = image::data_pixel_size(format);
+
+        // Input and output sides of --gamma
+        for (const auto inGamma : {1.0f, 1.8f, 2.2f, 4.0f}) {
+            for (const auto outGamma : {1.0f, 1.8f, 2.2f, 4.0f}) {
+                auto packed = std::vector<stbi_uc>(pixels.size() / 4 * bytesPerPixel);
+                image::pack_rgba8(pixels, width, height, inGamma, 1.0f / outGamma, format, packed);
+
+                auto linear = image::buffer<float>{};
+                image::to_float(pixels, width, height, inGamma, linear);
+                auto reference = std::vector<stbi_uc>(packed.size());
+                image::to_data(linear, 1.0f / outGamma, format, std::span{reference});
+
+                const auto mismatch = std::ranges::mismatch(packed, reference);
+                if (mismatch.in1 != packed.cend()) {
+                    const auto pixel = std::size_t(mismatch.in1 - packed.cbegin()) / bytesPerPixel;
+                    fmt::print(stderr, "pack_rgba8 {} gamma {}:{}: pixel ({}, {}, {}, {}) packs differently\n", name, inGamma, outGamma,
+                        pixels[pixel * 4], pixels[(pixel * 4) + 1], pixels[(pixel * 4) + 2], pixels[(pixel * 4) + 3]);
+                    ok = false;
+                }
+            }
+        }
+    }
+
+    fmt::print(stderr, "pack_rgba8: {}\n", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+bool check::repack() {
+    const auto ok = repack_type<std::uint8_t>("uint8") & repack_type<std::uint16_t>("uint16") & repack_type<std::uint32_t>("uint32");
+    fmt::print(stderr, "repack: {}\n", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+bool check::compress() {
+    static constexpr auto methods = std::array{
+        std::pair{"lz77", compress::method::lz77}, std::pair{"lz77-vram", compress::method::lz77_vram},
+        std::pair{"rle", compress::method::rle}, std::pair{"huff4", compress::method::huff4}, std::pair{"huff8", compress::method::huff8}
+    };
+
+    auto ok = true;
+    for (const auto& [inputName, input] : compress_inputs()) {
+        for (const auto& [name, method] : methods) {
+            for (const auto optimal : {false, true}) {
+                if (optimal && method != compress::method::lz77 && method != compress::method::lz77_vram) {
+                    continue;
+                }
+
+                // Appended in uneven pieces, as bands are
+                auto stream = compress::encoder{method, optimal};
+                for (auto begin = std::size_t{}, piece = std::size_t{1}; begin < input.size(); begin += piece, piece = (piece * 3) + 1) {
+                    stream.append(std::span{input}.subspan(begin, std::min(piece, input.size() - begin)));
+                }
+                const auto encoded = stream.finish();
+
+                const auto label = fmt::format("compress {}{} {}", name, optimal ? " optimal" : "", inputName);
+                if (!encoded) {
+                    fmt::print(stderr, "{}: not encoded\n", label);
+                    ok = false;
+                } else if (encoded->size() > compress::max_size(method, input.size())) {
+                    fmt::print(stderr, "{}: {} bytes, over max_size {}\n", label, encoded->size(), compress::max_size(method, input.size()));
+                    ok = false;
+                } else if (decode(method, *encoded) != input) {
+                    fmt::print(stderr, "{}: does not decode to its input\n", label);
+                    ok = false;
+                }
+            }
+        }
+    }
+
+    fmt::print(stderr, "compress: {}\n", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+bool check::delta() {
+    auto state = std::uint32_t{0x6c8e9cf5};
+    const auto next = [&state]() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    };
+    const auto random_frame = [&](std::size_t size) {
+        auto frame = std::vector<std::byte>(size);
+        for (auto& byte : frame) {
+            byte = std::byte(next());
+        }
+        return frame;
+    };
+
+    // Each frame encoded against the one before it and copied over it, from VRAM holding none of the first
+    auto ok = true;
+    const auto round_trip = [&](std::string_view name, const std::vector<std::vector<std::byte>>& frames, delta::granularity g, std::size_t rowBytes) {
+        const auto size = ((frames.front().size() + 3) / 4) * 4;
+        auto vram = std::vector<std::byte>(size, std::byte{0xcd});
+        for (auto ii = std::size_t{}; ii < frames.size(); ++ii) {
+            const auto previous = ii ? std::span<const std::byte>{frames[ii - 1]} : std::span<const std::byte>{};
+            const auto frame = delta::encode(previous, frames[ii], g, rowBytes);
+
+            auto expected = frames[ii];
+            expected.resize(size);
+            auto copied = std::size_t{};
+            if (!apply_delta(frame.record, g, rowBytes / 4, vram, copied)) {
+                fmt::print(stderr, "delta {} frame {}: malformed record\n", name, ii);
+                ok = false;
+                return;
+            }
+            if (vram != expected) {
+                fmt::print(stderr, "delta {} frame {}: does not copy to the frame\n", name, ii);
+                ok = false;
+                return;
+            }
+            if (copied != frame.copied) {
+                fmt::print(stderr, "delta {} frame {}: copies {} bytes, reports {}\n", name, ii, copied, frame.copied);
+                ok = false;
+                return;
+            }
+            if (ii && frames[ii] == frames[ii - 1] && frame.record.size() != 4) {
+                fmt::print(stderr, "delta {} frame {}: {} bytes for no changes\n", name, ii, frame.record.size());
+                ok = false;
+                return;
+            }
+        }
+    };
+
+    // A first frame, then frames with a few scattered bytes changed, a run of changes, changed words either side of the gap spans merge across, and no changes
+    const auto sequence = [&](std::size_t size) {
+        auto frames = std::vector<std::vector<std::byte>>{random_frame(size)};
+        const auto change = [&](std::vector<std::byte> frame, std::size_t offset) {
+            frame[offset % size] = ~frame[offset % size];
+            return frame;
+        };
+        for (const auto changes : {1, 3, 20}) {
+            auto frame = frames.back();
+            for (auto ii = 0; ii < changes; ++ii) {
+                frame = change(std::move(frame), next());
+            }
+            frames.push_back(std::move(frame));
+        }
+        auto run = frames.back();
+        for (auto ii = size / 3; ii < (size / 3) + std::min(size, std::size_t{300}); ++ii) {
+            run = change(std::move(run), ii);
+        }
+        frames.push_back(std::move(run));
+        for (const auto gap : {std::size_t{3}, std::size_t{4}}) {
+            frames.push_back(change(change(change(frames.back(), 0), gap * 4), size - 1));
+        }
+        frames.push_back(frames.back());
+        frames.push_back(random_frame(size));
+        return frames;
+    };
+
+    // Frames of a small bitmap, a Mode 3 screen, and ones ending in part of a word
+    for (const auto size : {std::size_t{4}, std::size_t{6}, std::size_t{64}, std::size_t{250}, std::size_t{240 * 160 * 2}}) {
+        round_trip(fmt::format("word {} bytes", size), sequence(size), delta::granularity::word, 0);
+    }
+    for (const auto& [rowBytes, rows] : {std::pair{std::size_t{4}, std::size_t{1}}, std::pair{std::size_t{12}, std::size_t{7}}, std::pair{std::size_t{480}, std::size_t{160}}}) {
+        round_trip(fmt::format("scanline {}x{} bytes", rowBytes, rows), sequence(rowBytes * rows), delta::granularity::scanline, rowBytes);
+    }
+
+    // The largest frames a record addresses, as one span or rectangle when every word changes
+    const auto largest = std::vector<std::vector<std::byte>>{random_frame(delta::max_frame_words * 4), random_frame(delta::max_frame_words * 4)};
+    round_trip("word largest", largest, delta::granularity::word, 0);
+    round_trip("scanline largest", largest, delta::granularity::scanline, 4);
+    for (const auto g : {delta::granularity::word, delta::granularity::scanline}) {
+        const auto keyframe = delta::encode({}, largest.front(), g, 4);
+        if (keyframe.record.size() != (g == delta::granularity::word ? 8 : 12) + largest.front().size() || keyframe.record[0] != std::byte{1}) {
+            fmt::print(stderr, "delta {} largest: keyframe of {} bytes is not a single entry\n", g == delta::granularity::word ? "word" : "scanline", keyframe.record.size());
+            ok = false;
+        }
+    }
+
+    // A word past them, so a span must end at the limit of its 16-bit length and a second one start
+    const auto over = std::vector<std::vector<std::byte>>{random_frame((delta::max_frame_words + 1) * 4)};
+    round_trip("word over largest", over, delta::granularity::word, 0);
+    if (const auto keyframe = delta::encode({}, over.front(), delta::granularity::word, 0); keyframe.record[0] != std::byte{2}) {
+        fmt::print(stderr, "delta word over largest: keyframe of {} spans, not 2\n", std::size_t(keyframe.record[0]));
+        ok = false;
+    }
+
+    fmt::print(stderr, "delta: {}\n", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+bool check::orientate() {
+    auto ok = orientate_type<float>("float rgba", image::layout::rgba);
+    ok = orientate_type<float>("float index", image::layout::index) && ok;
+    ok = orientate_type<std::uint8_t>("uint8", image::layout::index) && ok;
+    ok = orientate_type<std::uint16_t>("uint16", image::layout::index) && ok;
+    ok = orientate_type<std::uint32_t>("uint32", image::layout::index) && ok;
+
+    fmt::print(stderr, "orientate: {}\n", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+bool check::palette_lookup() {
+    auto ok = true;
+    for (const auto pow : packed_pows) {
+        for (const auto colors : {std::size_t{1}, std::size_t{16}, std::size_t{256}}) {
+            const auto palette = random_palette(colors, std::uint32_t(colors));
+            // Tables of every packed color, memos of recent colors, and formats searched per pixel
+            for (const auto name : {"g1BGR5", "BGR5", "R5G6B5", "BGRA8", "A8R8G8B8", "BGR10", "R8"}) {
+                ok = palette_lookup_format<std::uint8_t>(name, pow, palette) && ok;
+            }
+        }
+
+        const auto wide = random_palette(1000, 1000);
+        for (const auto name : {"g1BGR5", "BGRA8"}) {
+            ok = palette_lookup_format<std::uint16_t>(name, pow, wide) && ok;
+        }
+    }
+
+    fmt::print(stderr, "palette_lookup: {}\n", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+bool check::banks() {
+    const auto format = color_format::parse("g1BGR5");
+    const auto pow = 1.0f / 2.2f;
+    auto ok = true;
+
+    // More groups and colors than fit, so banks are quantized and tiles compromise
+    {
+        auto groups = std::vector<std::vector<std::array<float, 4>>>{};
+        for (auto group = 0u; group < 6; ++group) {
+            groups.push_back(level_colors(24, group + 1));
+        }
+        const auto image = group_tiles(12, 9, groups, 0x2545f491);
+        for (const auto count : {1, 4, 16}) {
+            const auto result = banks::optimize(image, format, pow, count, banks::bank_colors, palette::quantizer::wu, false);
+            ok = banks_valid(fmt::format("optimize {} of 6 groups", count), image, result, std::size_t(count), true) && ok;
+        }
+    }
+
+    // Two groups that each fit a bank exactly: the whole-image seed and a bank per group at most, so the fourth bank is left unused and dropped
+    {
+        const auto all = level_colors(20, 7);
+        const auto groups = std::vector<std::vector<std::array<float, 4>>>{{all.cbegin(), all.cbegin() + 10}, {all.cbegin() + 10, all.cend()}};
+        const auto image = group_tiles(8, 8, groups, 0x6b43a9b5);
+
+        const auto optimized = banks::optimize(image, format, pow, 4, banks::bank_colors, palette::quantizer::wu, false);
+        if (banks_valid("optimize 4 of 2 groups", image, optimized, 4, true) && banks_exact("optimize 4 of 2 groups", image, optimized)) {
+            if (optimized.palettes.size() > 3) {
+                fmt::print(stderr, "banks optimize 4 of 2 groups: {} banks used\n", optimized.palettes.size());
+                ok = false;
+            }
+        } else {
+            ok = false;
+        }
+
+        // Given palettes are kept, even one no tile uses
+        auto palettes = groups;
+        palettes.push_back(level_colors(16, 9));
+        const auto assigned = banks::assign(image, format, pow, palettes);
+        ok = banks_valid("assign", image, assigned, palettes.size(), false) && banks_exact("assign", image, assigned) && ok;
+    }
+
+    fmt::print(stderr, "banks: {}\n", ok ? "ok" : "FAILED");
+    return ok;
+}
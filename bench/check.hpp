@@ -0,0 +1,31 @@
+#pragma once
+
+// Checks that each fast path gives the same bytes as the reference path it replaces, run by gfx2agb_bench --check
+// Each prints its mismatches to stderr and returns false if there were any
+namespace check {
+
+// Specialized packers against the generic to_data, for every shipped format
+bool packer();
+
+// image::pack_rgba8 against to_float then to_data, for every 8-bit value in each channel, over formats and --gamma pairs
+bool pack_rgba8();
+
+// util::repack_data's packing kernels against packing a bit at a time, for each index type and every size of final partial byte
+bool repack();
+
+// Every compression method through a decoder written from the BIOS's stream formats, on random and skewed inputs
+bool compress();
+
+// delta::encode records copied over the frame before, for both granularities, with frames of no changes and the largest a record addresses
+bool delta();
+
+// image::orientate, orientate_rows and orientate_in_place against walking each output pixel, in every direction at sizes that aren't whole tiles
+bool orientate();
+
+// image::palette_lookup against the exact nearest color to each pixel's packed color, through the table, the memo and the per-pixel search
+bool palette_lookup();
+
+// banks::optimize and banks::assign keep every tile and index within the banks they return, and optimize drops unused banks
+bool banks();
+
+} // namespace check
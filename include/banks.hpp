@@ -0,0 +1,31 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "color_format.hpp"
+#include "image_buffer.hpp"
+#include "palette.hpp"
+
+namespace banks {
+
+constexpr auto bank_colors = 16; // Colors of a 4bpp palette bank
+constexpr auto max_banks = 16;
+
+struct banks_type {
+    std::vector<std::vector<std::array<float, 4>>> palettes; // Linear RGBA of each bank used
+    std::vector<std::size_t> tileBanks; // Bank of each tile, row-major
+    image::buffer<std::uint8_t> indices; // Pixels as indices into the palette of their tile's bank
+};
+
+// Splits the tiles of image (dimensions multiples of tileset::tile_size) between up to count banks of up to colors each
+// Tiles move to the bank that reproduces them with the least error and banks are quantized from their tiles, until no tile moves
+// Banks no tile uses are dropped. Pixels are palettized as image::palette_lookup does with format and pow
+banks_type optimize(const image::buffer<float>& image, const std::vector<color_format::component_type>& format, float pow, int count, int colors, palette::quantizer method, bool refine) noexcept;
+
+// Gives each tile the one of palettes that reproduces it with the least error, palettizing as optimize does
+banks_type assign(const image::buffer<float>& image, const std::vector<color_format::component_type>& format, float pow, std::vector<std::vector<std::array<float, 4>>> palettes) noexcept;
+
+} // namespace banks
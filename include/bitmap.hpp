@@ -1,10 +1,26 @@
 #pragma once
 
+#include <array>
+#include <span>
+#include <string>
 #include <string_view>
+#include <vector>
 
 #include <ctopt.hpp>
 
-int bitmap(ctopt::args::const_iterator begin, ctopt::args::const_iterator end);
+#include "decode_cache.hpp"
+#include "gfx2agb.hpp"
+
+// A non-empty sharedPalette is applied in place of --in-palette or a generated palette
+// A non-null decodeCache keeps the decoded image for later conversions of the same file
+int bitmap(ctopt::args::const_iterator begin, ctopt::args::const_iterator end, std::span<const std::array<float, 4>> sharedPalette = {}, image::decode_cache* decodeCache = nullptr);
+
+// Runs bitmap on the arguments that would follow `gfx2agb bitmap`
+int bitmap(const std::vector<std::string>& arguments, std::span<const std::array<float, 4>> sharedPalette = {}, image::decode_cache* decodeCache = nullptr);
+
+// Counts the colors bitmap would reduce into histogram, and sets settings to those of the arguments
+int bitmap_histogram(ctopt::args::const_iterator begin, ctopt::args::const_iterator end, gfx2agb::color_histogram& histogram, gfx2agb::bitmap_options& settings);
+int bitmap_histogram(const std::vector<std::string>& arguments, gfx2agb::color_histogram& histogram, gfx2agb::bitmap_options& settings);
 
 namespace {
 
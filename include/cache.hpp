@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace cache {
+
+// 128-bit digest of everything that decides a conversion's outputs
+// Two FNV-1a lanes with a final mix: fast over large images, not meant to resist deliberate collisions
+class hasher {
+public:
+    void update(std::span<const std::byte> bytes) noexcept;
+    void update(std::string_view str) noexcept;
+
+    // Hashes the file's size and bytes, false if it can't be read
+    bool update_file(const char* path) noexcept;
+
+    [[nodiscard]]
+    std::string digest() const noexcept;
+
+private:
+    std::uint64_t m_lanes[2] = {0xcbf29ce484222325, 0x84222325cbf29ce4};
+};
+
+struct output_type {
+    std::string_view name; // File name inside a cache entry
+    const char* path; // Where the conversion writes it
+};
+
+// Copies the outputs of a cached conversion to their paths, false on a miss
+// The outputs are replaced together only once every one is copied, as a conversion's are
+bool restore(const std::filesystem::path& dir, std::string_view key, std::span<const output_type> outputs) noexcept;
+
+// Copies freshly written outputs into a new entry, then evicts least recently used entries until the cache is within maxBytes
+void store(const std::filesystem::path& dir, std::string_view key, std::span<const output_type> outputs, std::uintmax_t maxBytes) noexcept;
+
+} // namespace cache
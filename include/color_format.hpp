@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <string>
 #include <string_view>
 #include <vector>
 
@@ -25,6 +26,9 @@ struct component_type {
 
 std::vector<component_type> parse(std::string_view sv) noexcept;
 
+// Same as above, describing a format that can't be parsed (empty result) in error
+std::vector<component_type> parse(std::string_view sv, std::string& error) noexcept;
+
 struct color_channel_type {
     [[nodiscard]]
     constexpr auto size() const noexcept {
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace compress {
+
+enum class method {
+    lz77, // LZ77UnCompWram
+    lz77_vram, // LZ77UnCompVram, never copies from the byte just written
+    rle, // RLUnCompWram/Vram
+    huff4, // HuffUnComp of 4-bit units
+    huff8 // HuffUnComp of 8-bit units
+};
+
+std::optional<method> parse_method(std::string_view name) noexcept;
+
+// Largest input the 24-bit size of a BIOS header can describe
+constexpr auto max_input_size = std::size_t{0xffffff};
+
+// Largest stream that size bytes of input compress to
+std::size_t max_size(method m, std::size_t size) noexcept;
+
+// Stream for the GBA BIOS decompression routines: header, body, zero padded to a multiple of 4 bytes
+// Input is appended as it is packed, and compressed as far as later input can't change the result
+class encoder {
+public:
+    // Optimal parse finds the smallest LZ77 stream, at the cost of finding every match before encoding any
+    encoder(method m, bool optimal) noexcept;
+
+    void append(std::span<const std::byte> data) noexcept;
+
+    // Compresses the rest of the input, nullopt if it is larger than max_input_size or its Huffman tree can't be laid out for the BIOS
+    [[nodiscard]]
+    std::optional<std::vector<std::byte>> finish() noexcept;
+
+private:
+    void lz77_encode(std::size_t end) noexcept;
+    void lz77_optimal() noexcept;
+    void lz77_token(std::size_t length, std::size_t distance) noexcept;
+    [[nodiscard]]
+    std::pair<std::size_t, std::size_t> lz77_match(std::size_t pos, std::size_t maxChain) noexcept;
+
+    void rle_encode(std::size_t end) noexcept;
+    void rle_flush() noexcept;
+
+    // False if the tree can't be laid out with every node's children in reach of its offset
+    [[nodiscard]]
+    bool huffman_encode() noexcept;
+
+    method m_method;
+    bool m_optimal;
+    std::vector<std::byte> m_input;
+    std::vector<std::byte> m_output;
+    std::size_t m_encoded{}; // Input bytes compressed so far
+
+    // LZ77 hash chains, of the positions of earlier 3-byte sequences
+    std::vector<std::uint32_t> m_head;
+    std::vector<std::uint32_t> m_previous;
+    std::size_t m_hashed{};
+    std::size_t m_flags{}; // Offset of the current block's flag byte
+    int m_tokens{}; // Tokens in the current block
+
+    // RLE literals not yet written
+    std::size_t m_literalBegin{};
+
+    // Huffman unit counts
+    std::array<std::size_t, 256> m_counts{};
+};
+
+// Whole-buffer shorthands for encoder
+std::optional<std::vector<std::byte>> lz77(std::span<const std::byte> data, bool vram, bool optimal) noexcept;
+std::optional<std::vector<std::byte>> rle(std::span<const std::byte> data) noexcept;
+std::optional<std::vector<std::byte>> huffman(std::span<const std::byte> data, int bits) noexcept;
+
+} // namespace compress
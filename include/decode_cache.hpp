@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <stb_image.h>
+
+namespace image {
+
+using shared_pixels = std::shared_ptr<const stbi_uc[]>;
+
+// Decoded images kept between conversions of a long-running process, keyed by path and modification time
+class decode_cache {
+public:
+    explicit decode_cache(std::size_t maxBytes) noexcept : m_maxBytes{maxBytes} {}
+
+    [[nodiscard]]
+    shared_pixels load(const char* filename, int& width, int& height, int& channels) noexcept;
+
+private:
+    struct entry_type {
+        std::string path;
+        std::filesystem::file_time_type modified;
+        std::uintmax_t fileSize;
+        int width;
+        int height;
+        int channels;
+        shared_pixels pixels;
+    };
+
+    std::mutex m_mutex;
+    std::list<entry_type> m_entries; // Most recently used first
+    std::size_t m_maxBytes;
+    std::size_t m_bytes{};
+    std::size_t m_hits{};
+    std::size_t m_misses{};
+};
+
+// Same as load, through cache when one is given
+shared_pixels load_shared(decode_cache* cache, const char* filename, int& width, int& height, int& channels) noexcept;
+
+} // namespace image
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace delta {
+
+enum class granularity {
+    word, // Spans of changed 32-bit words, one DMA transfer each
+    scanline // Rectangles of changed rows, one DMA transfer per row
+};
+
+std::optional<granularity> parse_granularity(std::string_view name) noexcept;
+
+// Largest frame a record can address, in 16-bit word offsets and row numbers
+constexpr auto max_frame_words = std::size_t{0xffff};
+
+// Frame record that turns previous into next when copied into VRAM, every word of next when previous is empty
+// Records hold 16-bit little-endian fields and whole words, so every copy is word aligned:
+//   word:     u16 spans, u16 0, then per span u16 offset, u16 length (in words) and the words
+//   scanline: u16 rects, u16 0, then per rect u16 x, u16 y, u16 width (x and width in words), u16 height and the rows
+struct frame_type {
+    std::vector<std::byte> record;
+    std::size_t copied{}; // Bytes written to VRAM
+    std::size_t transfers{}; // DMA transfers to write them
+};
+
+// Frames are padded with zeros to whole words, scanline granularity needs rowBytes to be a multiple of 4
+[[nodiscard]]
+frame_type encode(std::span<const std::byte> previous, std::span<const std::byte> next, granularity g, std::size_t rowBytes) noexcept;
+
+} // namespace delta
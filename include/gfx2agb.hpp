@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Conversion pipeline of the gfx2agb command line, for linking into other tools
+// Every call works on buffers owned by the caller and keeps no state between calls, so any number may run concurrently
+namespace gfx2agb {
+
+struct bitmap_options {
+    int mode = 3; // GBA bitmap background mode (3, 4, 5)
+    std::string width; // Expression of the input size iw and ih, empty for the mode's screen width
+    std::string height;
+    std::string format = "g1BGR5"; // Output color format
+    float inGamma = 2.2f;
+    float outGamma = 2.2f;
+    std::size_t bpp = 8; // Mode 4 palette index bits per pixel
+    int colors = 0; // Maximum colors, 0 for 2^bpp in mode 4 or no color reduction in modes 3 and 5
+    std::string quantizer = "kmeans"; // kmeans, median-cut, octree, wu
+    bool refine = false;
+    std::string direction = "+x+y";
+    bool antiAlias = false;
+    std::string filter = "auto"; // Resampling filter (auto, box, triangle, cubic, catmull-rom, mitchell)
+    std::size_t maxMemory = 0; // Bytes of working set, counting the 8-bit image and preview, to process large images in bands of rows within, 0 for whole images
+    std::string compress; // GBA BIOS compression of data and palette data (lz77, lz77-vram, rle, huff4, huff8), empty for none
+    bool optimalParse = false; // Slower LZ77 parse that finds the smallest stream
+    std::span<const std::byte> palette; // Contents of an input palette file (image, binary, .gpl), empty to generate one
+    std::span<const std::array<float, 4>> sharedPalette; // Linear RGBA palette from reduce_histogram, applied as is in place of palette
+    std::function<void(std::string_view)> log; // Receives verbose messages, if set
+};
+
+// Decoded 8-bit RGBA pixels, row after row
+struct rgba_image {
+    std::span<const std::byte> pixels;
+    int width;
+    int height;
+};
+
+// Buffers a conversion writes into, left empty to skip that output
+struct bitmap_outputs {
+    std::span<std::byte> data; // Packed pixels, or mode 4 palette indices
+    std::span<std::byte> preview; // Converted image as 8-bit RGBA, as written to --out-png
+    std::span<std::byte> paletteData; // Mode 4 palette packed in the output format
+    std::span<std::array<float, 4>> palette; // Mode 4 palette as linear RGBA
+};
+
+struct bitmap_result {
+    [[nodiscard]]
+    explicit operator bool() const noexcept {
+        return error.empty();
+    }
+
+    std::string error; // Why the conversion failed, empty on success
+    int width{}; // Output size, after direction
+    int height{};
+    std::size_t dataSize{}; // Bytes of each output, an upper bound from measure_bitmap when compressed
+    std::size_t previewSize{};
+    std::size_t paletteColors{}; // Mode 4 palette entries, an upper bound from measure_bitmap
+    std::size_t paletteDataSize{};
+};
+
+// Checks options without an image, the result holds no sizes
+[[nodiscard]]
+bitmap_result check_bitmap(const bitmap_options& options) noexcept;
+
+// Sizes of the outputs of converting an image of inWidth x inHeight
+[[nodiscard]]
+bitmap_result measure_bitmap(const bitmap_options& options, int inWidth, int inHeight) noexcept;
+
+// Converts an image, failing without writing anything if a non-empty output is smaller than measure_bitmap gives
+[[nodiscard]]
+bitmap_result convert_bitmap(const rgba_image& image, const bitmap_options& options, const bitmap_outputs& outputs) noexcept;
+
+// Same as above, decoding an image file already in memory
+[[nodiscard]]
+bitmap_result convert_bitmap(std::span<const std::byte> encoded, const bitmap_options& options, const bitmap_outputs& outputs) noexcept;
+
+// Unique colors of one or more images, for a palette they share
+// Its size follows the number of unique colors, however many pixels were counted
+struct color_histogram {
+    std::string format; // Color format the colors were counted in, set by the first add_histogram
+    std::vector<std::array<float, 4>> colors; // Linear RGBA, ordered by packed value
+    std::vector<std::size_t> counts; // Pixels of each color
+};
+
+// Counts the colors of an image as convert_bitmap would reduce them into histogram
+[[nodiscard]]
+bitmap_result add_histogram(const rgba_image& image, const bitmap_options& options, color_histogram& histogram) noexcept;
+
+// Adds the counts of other, of the same format, to histogram
+[[nodiscard]]
+bitmap_result merge_histograms(color_histogram& histogram, color_histogram other) noexcept;
+
+// Palette reduced from histogram to the colors of options (2^bpp in mode 4), to pass as bitmap_options::sharedPalette
+[[nodiscard]]
+bitmap_result reduce_histogram(const color_histogram& histogram, const bitmap_options& options, std::vector<std::array<float, 4>>& palette) noexcept;
+
+} // namespace gfx2agb
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+namespace image {
+
+enum class layout {
+    rgba, // 4 interleaved channels per pixel
+    index // 1 palette index per pixel
+};
+
+[[nodiscard]]
+constexpr std::size_t channel_count(layout l) noexcept {
+    return l == layout::rgba ? 4 : 1;
+}
+
+template <typename T>
+struct buffer {
+    using value_type = T;
+
+    // Shrinking keeps the allocation, so a buffer reused between stages only grows to the largest shape it has held
+    void reshape(int w, int h, image::layout l) {
+        width = w;
+        height = h;
+        layout = l;
+        stride = std::size_t(w) * channel_count(l);
+        data.resize(stride * std::size_t(h));
+    }
+
+    [[nodiscard]]
+    std::size_t channels() const noexcept {
+        return channel_count(layout);
+    }
+
+    [[nodiscard]]
+    std::size_t pixel_count() const noexcept {
+        return std::size_t(width) * std::size_t(height);
+    }
+
+    [[nodiscard]]
+    std::span<T> row(int y) noexcept {
+        return {data.data() + (std::size_t(y) * stride), std::size_t(width) * channels()};
+    }
+
+    [[nodiscard]]
+    std::span<const T> row(int y) const noexcept {
+        return {data.data() + (std::size_t(y) * stride), std::size_t(width) * channels()};
+    }
+
+    [[nodiscard]]
+    std::size_t size_bytes() const noexcept {
+        return data.capacity() * sizeof(T);
+    }
+
+    int width{};
+    int height{};
+    std::size_t stride{}; // Elements between rows
+    image::layout layout{};
+    std::vector<T> data;
+};
+
+} // namespace image
@@ -1,23 +1,94 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <span>
+#include <string>
 #include <vector>
 
 #include <stb_image.h>
 
 #include "color_format.hpp"
+#include "image_buffer.hpp"
+#include "resample.hpp"
 
 namespace image {
 
+// Stages write into caller-owned buffers, which are reshaped (and only reallocated when they must grow)
 std::unique_ptr<stbi_uc[], void(*)(void*)> load(const char* filename, int& width, int& height, int& channels) noexcept;
-std::vector<float> to_float(const std::unique_ptr<stbi_uc[], void(*)(void*)>& image, int width, int height, float pow) noexcept;
-std::vector<float> resize(const std::vector<float>& image, int inWidth, int inHeight, int outWidth, int outHeight) noexcept;
-std::vector<float> resize_and_resolve(const std::vector<float>& image, int inWidth, int inHeight, int outWidth, int outHeight) noexcept;
-std::vector<stbi_uc> to_data(const std::vector<float>& image, int width, int height, float pow, const std::vector<color_format::component_type>& format) noexcept;
-std::vector<float> flatten(const std::vector<std::array<float, 4>>& image) noexcept;
-std::vector<std::size_t> palettize(const std::vector<float>& image, const std::vector<std::array<float, 4>>& palette) noexcept;
-std::vector<float> expand(const std::vector<std::size_t>& indices, const std::vector<std::array<float, 4>>& palette) noexcept;
-std::vector<std::array<float, 4>> gamma_pow(const std::vector<std::array<float, 4>>& image, float gamma) noexcept;
+// Decodes an image file already in memory
+std::unique_ptr<stbi_uc[], void(*)(void*)> load(std::span<const std::byte> encoded, int& width, int& height, int& channels) noexcept;
+// Decodes every frame of a GIF already in memory, one after another
+std::unique_ptr<stbi_uc[], void(*)(void*)> load_gif(std::span<const std::byte> encoded, int& width, int& height, int& frames) noexcept;
+void to_float(std::span<const stbi_uc> image, int width, int height, float pow, buffer<float>& out) noexcept;
+// Resamples with f, both ways separably
+void resize(const buffer<float>& image, int outWidth, int outHeight, resample::filter f, buffer<float>& out) noexcept;
+// Source rows [first, second) that resizing needs to produce output rows [outRowBegin, outRowEnd)
+std::pair<int, int> resize_source_rows(int inHeight, int outHeight, resample::filter f, int outRowBegin, int outRowEnd) noexcept;
+// Resizes band (source rows from inRowBegin of an image inHeight tall) into output rows [outRowBegin, outRowEnd) of an image outHeight tall, the same as those rows of resize
+void resize_rows(const buffer<float>& band, int inHeight, int inRowBegin, int outWidth, int outHeight, resample::filter f, int outRowBegin, int outRowEnd, buffer<float>& out) noexcept;
+// Resizes to outWidth pixels of 3 sub-pixels each across, see resample::subpixel_kernel
+void resize_and_resolve(const buffer<float>& image, int outWidth, int outHeight, resample::filter f, buffer<float>& out) noexcept;
+// Bytes of each pixel written by to_data in format
+std::size_t data_pixel_size(const std::vector<color_format::component_type>& format) noexcept;
+void to_data(const buffer<float>& image, float pow, const std::vector<color_format::component_type>& format, std::vector<stbi_uc>& out) noexcept;
+// Same as above, into out holding exactly data_pixel_size(format) bytes per pixel
+void to_data(const buffer<float>& image, float pow, const std::vector<color_format::component_type>& format, std::span<stbi_uc> out) noexcept;
+// 8-bit RGBA straight to format, bit-identical to to_float with inPow then to_data with outPow, into out of data_pixel_size(format) bytes per pixel
+void pack_rgba8(std::span<const stbi_uc> image, int width, int height, float inPow, float outPow, const std::vector<color_format::component_type>& format, std::span<stbi_uc> out) noexcept;
+void flatten(const std::vector<std::array<float, 4>>& palette, int width, int height, buffer<float>& out) noexcept;
+
+// Calls func with a value of the narrowest unsigned type that holds every index into a palette of colors
+void with_index_type(std::size_t colors, auto func) {
+    if (colors <= 0x100) {
+        func(std::uint8_t{});
+    } else if (colors <= 0x10000) {
+        func(std::uint16_t{});
+    } else {
+        func(std::uint32_t{});
+    }
+}
+
+// Index buffers are std::uint8_t, std::uint16_t or std::uint32_t, chosen with with_index_type
+template <typename Index>
+void palettize(const buffer<float>& image, const std::vector<std::array<float, 4>>& palette, buffer<Index>& out) noexcept;
+
+// Palettizes pixels by the color they pack to in a format, searching the palette once per packed color rather than once per pixel
+// pow is the gamma to_data packs with, every pixel of one packed color takes the index nearest that color
+// Formats of up to 16 color bits (such as g1BGR5 and BGR5) keep a table of every color across calls, wider ones a memo of recent colors
+class palette_lookup {
+public:
+    palette_lookup(std::vector<std::array<float, 4>> palette, const std::vector<color_format::component_type>& format, float pow) noexcept;
+
+    // Safe to call from several threads at once
+    template <typename Index>
+    void palettize(const buffer<float>& image, buffer<Index>& out) const noexcept;
+
+private:
+    static constexpr auto max_table_bits = std::size_t{16};
+    static constexpr auto unknown_index = std::uint32_t(-1);
+    static constexpr auto unknown_key = std::uint64_t(-1); // Keys have at most 48 bits
+    static constexpr auto memo_bits = 12;
+    static constexpr auto memo_size = std::size_t{1} << memo_bits;
+
+    struct channel_type {
+        std::vector<float> thresholds; // Linear value where each level above 0 begins
+        std::vector<float> levels; // Linear value of each level
+        std::size_t shift{};
+        std::size_t bits{};
+    };
+
+    std::vector<std::array<float, 4>> m_palette;
+    std::array<channel_type, 3> m_channels; // Red, green, blue, as palettize doesn't compare alpha
+    std::size_t m_keyBits{};
+    bool m_exact{}; // A format without every color channel can't key the colors palettize compares, so each pixel is searched
+    std::unique_ptr<std::atomic<std::uint32_t>[]> m_table; // Index of each packed color, unknown_index until first seen
+};
+template <typename Index>
+void expand(const buffer<Index>& indices, const std::vector<std::array<float, 4>>& palette, buffer<float>& out) noexcept;
+void gamma_pow(std::vector<std::array<float, 4>>& palette, float gamma) noexcept;
 
 enum class direction {
     plus_x,
@@ -43,7 +114,17 @@ constexpr bool is_normal(direction major, direction minor) noexcept {
     return major == direction::plus_x && minor == direction::plus_y;
 }
 
-std::vector<float> orientate(const std::vector<float>& image, int width, int height, direction major, direction minor) noexcept;
-std::vector<std::size_t> orientate(const std::vector<std::size_t>& image, int width, int height, direction major, direction minor) noexcept;
+// Pixels in the order major then minor walks them, out is transposed when major is a y direction
+// Works on float and index buffers, either layout
+template <typename T>
+void orientate(const buffer<T>& image, direction major, direction minor, buffer<T>& out) noexcept;
+
+// Rows [rowBegin, rowEnd) of what orientate makes, so a band can be packed without orientating the whole image
+template <typename T>
+void orientate_rows(const buffer<T>& image, direction major, direction minor, int rowBegin, int rowEnd, buffer<T>& out) noexcept;
+
+// Same as orientate, flipping image in place when major is an x direction, otherwise through scratch
+template <typename T>
+void orientate_in_place(buffer<T>& image, direction major, direction minor, buffer<T>& scratch) noexcept;
 
 } // namespace image
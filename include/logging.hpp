@@ -1,16 +1,54 @@
 #pragma once
 
+#include <cstdio>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <string_view>
 #include <utility>
 
 #include <fmt/format.h>
 
 namespace vlog {
 
-    inline bool verbose = false;
+    using sink_type = std::function<void(std::string_view)>;
+
+    // Receives the verbose messages of work running on this thread, none when null
+    // The batch, sequence and serve workers that run jobs for another thread copy its sink
+    // The bands of parallel::for_each_band don't, so stages print from the thread that calls them
+    inline thread_local const sink_type* sink = nullptr;
 
     void print(std::string_view fmt, auto argsSupplier) noexcept {
-        if (verbose) {
-            fmt::vprint("- " + std::string(fmt) + "\n", argsSupplier());
+        if (sink && *sink) {
+            (*sink)(fmt::vformat(fmt, argsSupplier()));
+        }
+    }
+
+    // Receives the error messages of work running on this thread in place of stderr, when not null
+    inline thread_local std::string* errors = nullptr;
+
+    template <typename... Args>
+    void error(fmt::format_string<Args...> fmt, Args&&... args) {
+        if (errors) {
+            fmt::format_to(std::back_inserter(*errors), fmt, std::forward<Args>(args)...);
+        } else {
+            fmt::print(stderr, fmt, std::forward<Args>(args)...);
         }
     }
+
+    // Sends messages on this thread to a sink for the lifetime of the scope
+    class scope {
+    public:
+        explicit scope(const sink_type* s) noexcept : m_previous{std::exchange(sink, s)} {}
+
+        ~scope() noexcept {
+            sink = m_previous;
+        }
+
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+
+    private:
+        const sink_type* m_previous;
+    };
 }
@@ -28,19 +28,91 @@ namespace options {
         ctopt::option('g', "gamma").meta("string").help_text("Gamma ratio input:output. eg: 2.2:4.0").default_value("2.2:2.2").min(1).max(2).separator(':'),
         ctopt::option('b', "bpp").meta("integer").help_text("Palette index bits per pixel").default_value("8"),
         ctopt::option('c', "colors").meta("integer").help_text("Maximum colors in the palette"),
+        ctopt::option('q', "quantizer").meta("string").help_text("Color reduction algorithm (kmeans, median-cut, octree, wu)").default_value("kmeans"),
+        ctopt::option("refine").help_text("Refine median-cut, octree, or wu palettes with k-means").flag_counter(),
         ctopt::option('d', "direction").meta("string").help_text("Output stride direction. +x+y describes upper-left row-major. +y-x describes upper-right column-major.").default_value("+x+y"),
         ctopt::option("in-palette").meta("filepath").help_text("Input: palette (image, binary, .gpl)"),
         ctopt::option("out-png").meta("filepath").help_text("Output: PNG image"),
         ctopt::option("out-palette-png").meta("filepath").help_text("Output: Palette as PNG image"),
         ctopt::option("out-palette-gpl").meta("filepath").help_text("Output: Palette as GPL file"),
-        ctopt::option("anti-alias").help_text("Apply sub-pixel anti-aliasing").flag_counter()
+        ctopt::option("anti-alias").help_text("Apply sub-pixel anti-aliasing").flag_counter(),
+        ctopt::option("filter").meta("string").help_text("Resampling filter (auto, box, triangle, cubic, catmull-rom, mitchell). auto is catmull-rom upsampling and mitchell downsampling.").default_value("auto"),
+        ctopt::option("max-memory").meta("integer").help_text("Process large images in bands of rows to stay within this many MiB"),
+        ctopt::option("compress").meta("string").help_text("Compress binary data and palette data for the GBA BIOS (lz77, lz77-vram, rle, huff4, huff8)"),
+        ctopt::option("optimal-parse").help_text("Find the smallest LZ77 stream rather than the first good match").flag_counter(),
+        ctopt::option("cache-dir").meta("directory").help_text("Reuse outputs of identical earlier conversions stored in this directory"),
+        ctopt::option("cache-size").meta("integer").help_text("Evict least recently used cache entries beyond this many MiB").default_value("256"),
+        ctopt::option("trace").meta("filepath").help_text("Output: Chrome trace of each conversion stage (JSON)"),
+        ctopt::option("stats").help_text("Print the time and counters of each conversion stage").flag_counter()
+    );
+
+    static constexpr auto get_opts_tiles = make_options(
+        ctopt::option('i', "in-image").meta("filepath").help_text("Input: image (width and height multiples of 8)").required(),
+        ctopt::option('o', "out-tiles").meta("filepath").help_text("Output: Binary tile data"),
+        ctopt::option('s', "out-map").meta("filepath").help_text("Output: Binary map"),
+        ctopt::option('p', "out-palette-data").meta("filepath").help_text("Output: Binary palette data"),
+        ctopt::option('b', "bpp").meta("integer").help_text("Tile bits per pixel (4, 8)").default_value("4"),
+        ctopt::option('f', "format").meta("string").help_text("Output color format. Use --help-formats to view color format info.").default_value("g1BGR5"),
+        ctopt::option('g', "gamma").meta("string").help_text("Gamma ratio input:output. eg: 2.2:4.0").default_value("2.2:2.2").min(1).max(2).separator(':'),
+        ctopt::option('c', "colors").meta("integer").help_text("Maximum colors in the palette [default: 2^bpp]"),
+        ctopt::option('q', "quantizer").meta("string").help_text("Color reduction algorithm (kmeans, median-cut, octree, wu)").default_value("kmeans"),
+        ctopt::option("refine").help_text("Refine median-cut, octree, or wu palettes with k-means").flag_counter(),
+        ctopt::option("in-palette").meta("filepath").help_text("Input: palette (image, binary, .gpl)"),
+        ctopt::option("palette-bank").meta("integer").help_text("Palette bank of 4bpp map entries (0-15), the first bank with --palette-banks").default_value("0"),
+        ctopt::option("palette-banks").meta("integer").help_text("Split 4bpp tiles between up to this many 16 color palette banks, chosen per tile").default_value("1"),
+        ctopt::option("out-banks").meta("filepath").help_text("Output: Palette bank of each map entry (one byte each, row-major)"),
+        ctopt::option("map-layout").meta("string").help_text("Map entry order (screenblock, linear). screenblock pads to 32x32 blocks stored in sequence. [default: screenblock, linear with --affine]"),
+        ctopt::option("affine").help_text("Affine background: 8bpp tiles, 8-bit map entries, no flips").flag_counter(),
+        ctopt::option("no-flip").help_text("Don't reuse flipped tiles").flag_counter()
+    );
+
+    static constexpr auto get_opts_sequence = make_options(
+        ctopt::option('i', "in-images").meta("filepath").help_text("Input: numbered images (printf pattern, eg: frame%03d.png) or an animated GIF").required(),
+        ctopt::option('o', "out-data").meta("filepath").help_text("Output: Binary frame deltas"),
+        ctopt::option('p', "out-palette-data").meta("filepath").help_text("Output: Binary palette data"),
+        ctopt::option("first").meta("integer").help_text("Number of the first numbered image [default: 0 or 1]"),
+        ctopt::option("granularity").meta("string").help_text("Changes copied each frame (word, scanline)").default_value("word"),
+        ctopt::option("decode-cache").meta("integer").help_text("Keep numbered images decoded to count colors for converting, within this many MiB").default_value("256"),
+        ctopt::option('m', "mode").meta("integer").help_text("GBA bitmap background mode (3, 4, 5)").default_value("3"),
+        ctopt::option('w', "width").meta("integer").help_text("Bitmap width"),
+        ctopt::option('h', "height").meta("integer").help_text("Bitmap height"),
+        ctopt::option('f', "format").meta("string").help_text("Output color format. Use --help-formats to view color format info.").default_value("g1BGR5"),
+        ctopt::option('g', "gamma").meta("string").help_text("Gamma ratio input:output. eg: 2.2:4.0").default_value("2.2:2.2").min(1).max(2).separator(':'),
+        ctopt::option('b', "bpp").meta("integer").help_text("Palette index bits per pixel").default_value("8"),
+        ctopt::option('c', "colors").meta("integer").help_text("Maximum colors in the palette shared by every frame"),
+        ctopt::option('q', "quantizer").meta("string").help_text("Color reduction algorithm (kmeans, median-cut, octree, wu)").default_value("kmeans"),
+        ctopt::option("refine").help_text("Refine median-cut, octree, or wu palettes with k-means").flag_counter(),
+        ctopt::option('d', "direction").meta("string").help_text("Output stride direction. +x+y describes upper-left row-major. +y-x describes upper-right column-major.").default_value("+x+y"),
+        ctopt::option("in-palette").meta("filepath").help_text("Input: palette (image, binary, .gpl)"),
+        ctopt::option("anti-alias").help_text("Apply sub-pixel anti-aliasing").flag_counter(),
+        ctopt::option("filter").meta("string").help_text("Resampling filter (auto, box, triangle, cubic, catmull-rom, mitchell). auto is catmull-rom upsampling and mitchell downsampling.").default_value("auto")
+    );
+
+    static constexpr auto get_opts_batch = make_options(
+        ctopt::option('i', "in-manifest").meta("filepath").help_text("Input: job manifest (one set of bitmap options per line, or a JSON array)").required(),
+        ctopt::option('j', "jobs").meta("integer").help_text("Number of jobs to run concurrently [default: hardware threads]"),
+        ctopt::option("shared-palette").help_text("Reduce the colors of every job to one palette, quantized with the color options of the first job").flag_counter()
+    );
+
+    static constexpr auto get_opts_serve = make_options(
+        ctopt::option('s', "socket").meta("filepath").help_text("Unix domain socket to listen on").required(),
+        ctopt::option('j', "jobs").meta("integer").help_text("Number of requests to run concurrently [default: hardware threads]"),
+        ctopt::option("decode-cache").meta("integer").help_text("Keep recently decoded input images within this many MiB").default_value("256")
     );
 
     static inline const auto help_str = fmt::format(R"({}
 Commands:
-  bitmap  Convert an image file to a bitmap
+  bitmap    Convert an image file to a bitmap
+  tiles     Convert an image file to tiles and a map
+  sequence  Convert animation frames to a bitmap and per-frame deltas
+  batch     Convert many images with bitmap options read from a manifest
+  serve     Run bitmap requests received over a Unix domain socket
 
-bitmap {})",
-        get_opts.help_str(), get_opts_bitmap.help_str()
+bitmap {}
+tiles {}
+sequence {}
+batch {}
+serve {})",
+        get_opts.help_str(), get_opts_bitmap.help_str(), get_opts_tiles.help_str(), get_opts_sequence.help_str(), get_opts_batch.help_str(), get_opts_serve.help_str()
     );
 }
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace output {
+
+// File written through a memory mapping of a temporary file beside its path
+// commit renames it over the path, so readers see either the previous file or the whole new one
+class mapped_file {
+public:
+    mapped_file() noexcept = default;
+    ~mapped_file() noexcept;
+
+    mapped_file(mapped_file&& other) noexcept;
+    mapped_file& operator=(mapped_file&& other) noexcept;
+
+    // Creates the temporary file, false if it can't be
+    [[nodiscard]]
+    bool create(const std::filesystem::path& path) noexcept;
+
+    // Sizes the temporary file and maps it for writing
+    [[nodiscard]]
+    bool map(std::size_t size) noexcept;
+
+    // Writes bytes after those already appended, for files whose size isn't known up front (never mapped)
+    [[nodiscard]]
+    bool append(std::span<const std::byte> bytes) noexcept;
+
+    [[nodiscard]]
+    std::span<std::byte> data() const noexcept {
+        return {m_data, m_size};
+    }
+
+    // Writes the mapped bytes and the temporary file through to the disk, so a crash after commit can't leave an empty file at the path
+    [[nodiscard]]
+    bool sync() noexcept;
+
+    // Syncs, unmaps and renames the temporary file over the path
+    [[nodiscard]]
+    bool commit() noexcept;
+
+    // Unmaps and removes the temporary file, if not committed
+    void discard() noexcept;
+
+private:
+    void close() noexcept;
+    void unmap() noexcept;
+
+    std::filesystem::path m_path;
+    std::filesystem::path m_temporary;
+#if defined(_WIN32)
+    void* m_file{};
+    void* m_mapping{};
+#else
+    int m_file = -1;
+#endif
+    std::byte* m_data{};
+    std::size_t m_size{};
+};
+
+// Every output of a conversion, created before any work is done so an unwritable path fails early
+// Nothing appears at the output paths until commit, and a failed conversion leaves no partial files
+class plan {
+public:
+    // Creates the named output's temporary file
+    [[nodiscard]]
+    bool add(std::string_view name, const char* path) noexcept;
+
+    [[nodiscard]]
+    bool contains(std::string_view name) const noexcept;
+
+    // Maps the named output at its final size for writing in place
+    [[nodiscard]]
+    std::optional<std::span<std::byte>> map(std::string_view name, std::size_t size) noexcept;
+
+    // Maps the named output and copies bytes into it
+    [[nodiscard]]
+    bool write(std::string_view name, std::span<const std::byte> bytes) noexcept;
+
+    // Appends bytes to the named output, which grows as it is written rather than being mapped
+    [[nodiscard]]
+    bool append(std::string_view name, std::span<const std::byte> bytes) noexcept;
+
+    // Syncs every output, then renames each into place
+    // Nothing is renamed unless every output synced, and a failed rename removes the outputs not yet renamed and reports those already replaced
+    [[nodiscard]]
+    bool commit() noexcept;
+
+private:
+    struct entry_type {
+        std::string_view name;
+        const char* path;
+        mapped_file file;
+    };
+
+    [[nodiscard]]
+    entry_type* find(std::string_view name) noexcept;
+
+    std::vector<entry_type> m_entries;
+};
+
+} // namespace output
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+#include <stb_image.h>
+
+#include "color_format.hpp"
+#include "image_buffer.hpp"
+
+namespace packer {
+
+// Float to channel bits, equal to color_channel_type::pow() without calling std::pow per pixel
+// Holds the input value at which each output code begins, found by bisecting the float range once
+class channel_table {
+public:
+    channel_table(const color_format::color_channel_type& channel, float pow) noexcept;
+
+    [[nodiscard]]
+    int operator()(float x) const noexcept {
+        if (!(x > 0.0f && x <= 1.0f)) {
+            return m_channel.pow(x, m_pow); // Out of range and NaN take the exact path
+        }
+
+        auto code = m_buckets[std::size_t(x * float(bucket_count))];
+        while (code < m_thresholds.size() && m_thresholds[code] <= x) {
+            ++code;
+        }
+        return int(code);
+    }
+
+private:
+    static constexpr auto bucket_count = std::size_t{4096}; // Power of two, so x * bucket_count is exact
+
+    color_format::color_channel_type m_channel;
+    float m_pow;
+    std::vector<float> m_thresholds; // m_thresholds[k] is the smallest input that converts to k + 1
+    std::array<std::size_t, bucket_count + 1> m_buckets; // Thresholds below each bucket
+};
+
+using channel_tables = std::array<channel_table, 3>;
+
+// Smallest input in (0, 1] that color_channel_type::pow converts to each code above 0, found by bisecting the float range
+[[nodiscard]]
+std::vector<float> code_thresholds(const color_format::color_channel_type& channel, float pow) noexcept;
+
+// Packs rows [rowBegin, rowEnd) of RGBA image into out (bytes per pixel of the format), with RGB through tables
+using pack_rows_func = void(*)(const image::buffer<float>& image, std::size_t rowBegin, std::size_t rowEnd, const channel_tables& tables, stbi_uc* out);
+
+// Packer specialized at compile-time for a commonly used format, or nullptr for the generic path
+[[nodiscard]]
+pack_rows_func find(const std::vector<color_format::component_type>& format) noexcept;
+
+} // namespace packer
@@ -3,17 +3,53 @@
 #include <algorithm>
 #include <array>
 #include <cmath>
+#include <cstddef>
+#include <istream>
+#include <optional>
 #include <set>
+#include <span>
+#include <string>
+#include <string_view>
 #include <vector>
 
 #include "color_format.hpp"
+#include "image_buffer.hpp"
 
 namespace palette {
 
-std::vector<std::array<float, 4>> extract(const std::vector<color_format::component_type>& format, const std::vector<float>& image, int width, int height) noexcept;
+struct histogram_type {
+    std::vector<std::array<float, 4>> colors; // Unique colors in the target format, ordered by packed value
+    std::vector<std::size_t> counts; // Pixels of each color
+};
+
+histogram_type extract(const std::vector<color_format::component_type>& format, const image::buffer<float>& image) noexcept;
+// Adds the counts of other, a histogram of later pixels in the same format, to histogram
+void merge(const std::vector<color_format::component_type>& format, histogram_type& histogram, const histogram_type& other) noexcept;
+// Packed value of a color in the channels of a format, the order histograms are kept in
+std::size_t to_bits(const std::array<color_format::color_channel_type, 4>& channels, std::array<float, 4> x) noexcept;
 std::vector<std::array<float, 4>> quantize(const std::vector<std::array<float, 4>>& palette, int colors) noexcept;
-std::vector<std::array<float, 4>> gpl_load(const char* path, std::string& name, int& columns) noexcept;
-std::vector<std::array<float, 4>> binary_load(const char* path, const std::vector<color_format::component_type>& format) noexcept;
+
+enum class quantizer {
+    kmeans,
+    median_cut,
+    octree,
+    wu
+};
+
+std::optional<quantizer> parse_quantizer(std::string_view name) noexcept;
+
+// Weights give the number of pixels of each color (empty weights count each color once, k-means always does)
+std::vector<std::array<float, 4>> quantize(const std::vector<std::array<float, 4>>& palette, int colors, quantizer method, bool refine, std::span<const std::size_t> weights = {}) noexcept;
+std::vector<std::array<float, 4>> kmeans(const std::vector<std::array<float, 4>>& palette, std::vector<std::array<float, 4>> centers) noexcept;
+std::vector<std::array<float, 4>> median_cut(const std::vector<std::array<float, 4>>& palette, std::span<const std::size_t> weights, int colors) noexcept;
+std::vector<std::array<float, 4>> octree(const std::vector<std::array<float, 4>>& palette, std::span<const std::size_t> weights, int colors) noexcept;
+std::vector<std::array<float, 4>> wu(const std::vector<std::array<float, 4>>& palette, std::span<const std::size_t> weights, int colors) noexcept;
+// Palette from the bytes of an image, .gpl or binary file, linearized with gamma
+std::vector<std::array<float, 4>> load(std::span<const std::byte> bytes, const std::vector<color_format::component_type>& format, float gamma) noexcept;
+// Same as above, reading the file at path
+std::vector<std::array<float, 4>> load(const char* path, const std::vector<color_format::component_type>& format, float gamma) noexcept;
+std::vector<std::array<float, 4>> gpl_load(std::istream& file, std::string& name, int& columns) noexcept;
+std::vector<std::array<float, 4>> binary_load(std::span<const std::byte> bytes, const std::vector<color_format::component_type>& format) noexcept;
 std::string to_gpl(const std::vector<std::array<float, 4>>& palette, float pow) noexcept;
 
 } // palette
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace parallel {
+
+    // Thread limit for work split within a single conversion (0 uses every hardware thread)
+    // batch lowers this on its workers so concurrent jobs don't oversubscribe the CPU
+    inline thread_local std::size_t max_threads = 0;
+
+    [[nodiscard]]
+    inline std::size_t concurrency() noexcept {
+        if (max_threads) {
+            return max_threads;
+        }
+        return std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    // Splits [0, count) into contiguous bands of at least minBand items and calls func(begin, end) for each band
+    void for_each_band(std::size_t count, std::size_t minBand, auto func) {
+        const auto bands = std::min(concurrency(), (count + minBand - 1) / std::max(minBand, std::size_t{1}));
+        if (bands <= 1) {
+            func(std::size_t{}, count);
+            return;
+        }
+
+        const auto band_begin = [=](std::size_t band) {
+            return (count * band) / bands;
+        };
+
+        auto threads = std::vector<std::thread>{};
+        threads.reserve(bands - 1);
+        for (auto band = std::size_t{1}; band < bands; ++band) {
+            threads.emplace_back([&, band]() {
+                max_threads = 1; // Don't fan out again from inside a band
+                func(band_begin(band), band_begin(band + 1));
+            });
+        }
+        func(band_begin(0), band_begin(1));
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+} // namespace parallel
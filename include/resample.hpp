@@ -0,0 +1,51 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "image_buffer.hpp"
+
+namespace resample {
+
+enum class filter {
+    automatic, // Catmull-Rom when upsampling, Mitchell when downsampling, as stb_image_resize did by default
+    box, // Average of the inputs each output covers
+    triangle,
+    cubic, // Cubic B-spline
+    catmull_rom,
+    mitchell
+};
+
+std::optional<filter> parse_filter(std::string_view name) noexcept;
+
+// Weights of a 1D filter from inSize samples to outSize, with samples past the edges clamped to the edge
+// Each output reads taps consecutive inputs from first, with a weight for each RGBA channel so channels may filter differently
+struct kernel_type {
+    std::vector<int> first;
+    int taps{};
+    std::vector<float> weights; // Output, then tap, then channel
+    int box{}; // When every output is the plain average of the box inputs from output * box, which skips the weights, otherwise 0
+};
+
+using shared_kernel = std::shared_ptr<const kernel_type>;
+
+// Kernels are built once per sizes and filter, then shared by every later call until evicted
+[[nodiscard]]
+shared_kernel kernel(int inSize, int outSize, filter f) noexcept;
+
+// Filter from inSize samples to outSize pixels of 3 sub-pixels each, resolving red from the right two, green and alpha from all three, and blue from the left two
+[[nodiscard]]
+shared_kernel subpixel_kernel(int inSize, int outSize, filter f) noexcept;
+
+// Input samples [first, second) read by outputs [outBegin, outEnd)
+[[nodiscard]]
+std::pair<int, int> source_range(const kernel_type& k, int outBegin, int outEnd) noexcept;
+
+// Filters output rows [outRowBegin, outRowEnd) into out, from rows holding the input rows from inRowBegin that vertical reads for them
+// Each row is filtered vertically, then across by horizontal, bands of rows in parallel
+void apply(const image::buffer<float>& rows, int inRowBegin, const kernel_type& horizontal, const kernel_type& vertical, int outRowBegin, int outRowEnd, image::buffer<float>& out) noexcept;
+
+} // namespace resample
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <ctopt.hpp>
+
+int sequence(ctopt::args::const_iterator begin, ctopt::args::const_iterator end);
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "image_buffer.hpp"
+
+namespace tileset {
+
+constexpr auto tile_size = 8;
+
+using tile_type = std::array<std::uint8_t, tile_size * tile_size>; // Palette indices, row-major
+
+struct entry_type {
+    std::size_t tile;
+    bool hflip;
+    bool vflip;
+};
+
+struct tileset_type {
+    std::vector<tile_type> tiles; // Unique tiles in order of first use
+    std::vector<entry_type> map; // Row-major, columns x rows
+    int columns;
+    int rows;
+};
+
+// Cuts indices (dimensions multiples of tile_size) into tiles and keeps one of each
+// With flips, a tile matching a mirrored earlier tile references it with flip bits
+tileset_type build(const image::buffer<std::uint8_t>& indices, bool flips) noexcept;
+
+// Pixels of each tile in order, for util::repack_data
+std::vector<std::uint8_t> pixels(const std::vector<tile_type>& tiles) noexcept;
+
+} // namespace tileset
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace trace {
+
+// Timed spans of the stages of one conversion, with counters of the work each did
+// Only the thread that installs a recorder writes to it, so concurrent conversions each keep their own
+class recorder {
+public:
+    recorder() noexcept : m_epoch{clock_type::now()} {}
+    ~recorder() noexcept;
+
+    recorder(const recorder&) = delete;
+    recorder& operator=(const recorder&) = delete;
+
+    // Makes this the calling thread's current recorder until destroyed
+    void install() noexcept;
+
+    void begin(std::string_view name) noexcept;
+    void end() noexcept;
+
+    // Adds to a counter of the innermost open span
+    void count(std::string_view counter, std::uint64_t value) noexcept;
+
+    // Chrome trace event JSON, as read by chrome://tracing and Perfetto
+    [[nodiscard]]
+    bool write_json(const char* path) const noexcept;
+
+    // Time and counters of each stage, totalled over its spans
+    void print_stats(std::FILE* stream) const noexcept;
+
+    // Recorder that spans and counters on this thread go to, if any
+    static inline thread_local recorder* current = nullptr;
+
+private:
+    using clock_type = std::chrono::steady_clock;
+
+    struct span_type {
+        std::string name;
+        double start; // Microseconds since the recorder was made
+        double duration;
+        std::size_t depth;
+        std::vector<std::pair<std::string, std::uint64_t>> counters;
+    };
+
+    [[nodiscard]]
+    double elapsed() const noexcept;
+
+    clock_type::time_point m_epoch;
+    std::size_t m_thread{};
+    recorder* m_previous{};
+    std::vector<span_type> m_spans;
+    std::vector<std::size_t> m_open;
+};
+
+// Span over the lifetime of the scope on the current recorder
+class scope {
+public:
+    explicit scope(std::string_view name) noexcept : m_recorder{recorder::current} {
+        if (m_recorder) {
+            m_recorder->begin(name);
+        }
+    }
+
+    ~scope() noexcept {
+        if (m_recorder) {
+            m_recorder->end();
+        }
+    }
+
+    scope(const scope&) = delete;
+    scope& operator=(const scope&) = delete;
+
+private:
+    recorder* m_recorder;
+};
+
+// Adds to a counter of the innermost span on the current recorder, does nothing without one
+inline void count(std::string_view counter, std::uint64_t value) noexcept {
+    if (recorder::current) {
+        recorder::current->count(counter, value);
+    }
+}
+
+} // namespace trace
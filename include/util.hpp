@@ -1,16 +1,26 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
 #include <bit>
 #include <cmath>
+#include <cstddef>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
 namespace util {
 
 std::pair<int, int> parse_width_height(int inWidth, int inHeight, const std::string& widthExpr, const std::string& heightExpr) noexcept;
-std::vector<char> repack_data(const std::vector<std::size_t>& data, std::size_t bpp) noexcept;
+// Indices packed at bpp bits each, the first in the lowest bits, for std::uint8_t, std::uint16_t or std::uint32_t indices
+template <typename T>
+std::vector<char> repack_data(const std::vector<T>& data, std::size_t bpp) noexcept;
+std::vector<std::string> split_args(std::string_view line) noexcept;
+std::size_t peak_memory() noexcept;
+// Contents of the file at path, nullopt if it can't be read
+std::optional<std::vector<std::byte>> read_file(const char* path) noexcept;
 
 [[nodiscard]]
 auto pow_clamp(auto x, auto pow) noexcept -> float {
@@ -18,6 +28,16 @@ auto pow_clamp(auto x, auto pow) noexcept -> float {
     return static_cast<float>(std::clamp(std::pow(x, x_type(pow)), x_type{}, x_type{1}));
 }
 
+// Linearized value of every 8-bit input, matching pow_clamp(x / 255.0, pow)
+[[nodiscard]]
+inline std::array<float, 256> gamma_table(float pow) noexcept {
+    auto table = std::array<float, 256>{};
+    for (auto ii = std::size_t{}; ii < table.size(); ++ii) {
+        table[ii] = pow_clamp(double(ii) / 255.0, pow);
+    }
+    return table;
+}
+
 [[nodiscard]]
 constexpr bool is_pow2_or_mul8(std::unsigned_integral auto x) noexcept {
     if ((x % 8) == 0) {
@@ -0,0 +1,335 @@
+#include "banks.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+#include <fmt/format.h>
+
+#include "image_io.hpp"
+#include "logging.hpp"
+#include "parallel.hpp"
+#include "tileset.hpp"
+#include "trace.hpp"
+
+using color_type = std::array<float, 4>;
+using palette_type = std::vector<color_type>;
+
+namespace {
+
+    // Reassignments before the banks are kept as they are, should tiles keep trading places
+    constexpr auto max_rounds = 32;
+
+    // Tiles in each band of parallel work
+    constexpr auto min_band_tiles = std::size_t{64};
+
+    [[nodiscard]]
+    float square_distance(const color_type& a, const color_type& b) noexcept {
+        const auto dr = a[0] - b[0];
+        const auto dg = a[1] - b[1];
+        const auto db = a[2] - b[2];
+        return (dr * dr) + (dg * dg) + (db * db); // Don't compare alpha, as palettize doesn't
+    }
+
+    // Pixel-weighted error of reproducing a tile's colors with the nearest colors of palette
+    [[nodiscard]]
+    double tile_error(const palette::histogram_type& tile, const palette_type& palette) noexcept {
+        if (palette.empty()) {
+            return std::numeric_limits<double>::infinity();
+        }
+
+        auto error = 0.0;
+        for (auto ii = std::size_t{}; ii < tile.colors.size(); ++ii) {
+            auto nearest = std::numeric_limits<float>::infinity();
+            for (const auto& color : palette) {
+                nearest = std::min(nearest, square_distance(tile.colors[ii], color));
+            }
+            error += double(nearest) * double(tile.counts[ii]);
+        }
+        return error;
+    }
+
+    // Unique colors of every tile, row-major, each ordered by packed value like palette::extract
+    [[nodiscard]]
+    std::vector<palette::histogram_type> tile_histograms(const image::buffer<float>& image, const std::vector<color_format::component_type>& format) noexcept {
+        const auto channels = color_format::to_rgba_channels(format);
+        const auto columns = std::size_t(image.width / tileset::tile_size);
+        const auto tiles = columns * std::size_t(image.height / tileset::tile_size);
+
+        auto result = std::vector<palette::histogram_type>(tiles);
+        parallel::for_each_band(tiles, min_band_tiles, [&](std::size_t begin, std::size_t end) {
+            auto pixels = std::vector<std::pair<std::size_t, color_type>>{};
+            pixels.reserve(tileset::tile_size * tileset::tile_size);
+
+            for (auto tile = begin; tile < end; ++tile) {
+                const auto tx = int(tile % columns) * tileset::tile_size;
+                const auto ty = int(tile / columns) * tileset::tile_size;
+
+                pixels.clear();
+                for (int yy = 0; yy < tileset::tile_size; ++yy) {
+                    const auto row = image.row(ty + yy).subspan(std::size_t(tx) * 4, tileset::tile_size * 4);
+                    for (auto xx = std::size_t{}; xx < row.size(); xx += 4) {
+                        const auto color = color_type{row[xx + 0], row[xx + 1], row[xx + 2], row[xx + 3]};
+                        pixels.emplace_back(palette::to_bits(channels, color), color);
+                    }
+                }
+
+                // Stable, so each unique color is represented by its first occurrence
+                std::ranges::stable_sort(pixels, {}, [](const auto& pixel) {
+                    return pixel.first;
+                });
+
+                auto& histogram = result[tile];
+                for (auto ii = std::size_t{}; ii < pixels.size(); ++ii) {
+                    if (ii && pixels[ii].first == pixels[ii - 1].first) {
+                        ++histogram.counts.back();
+                        continue;
+                    }
+                    histogram.colors.emplace_back(pixels[ii].second);
+                    histogram.counts.emplace_back(1);
+                }
+            }
+        });
+        return result;
+    }
+
+    // Tile errors against each bank, only recomputed for banks whose palette changed
+    class error_table {
+    public:
+        error_table(const std::vector<palette::histogram_type>& tiles, std::size_t banks) noexcept :
+            m_tiles{tiles}, m_banks{banks}, m_errors(tiles.size() * banks, std::numeric_limits<double>::infinity()) {}
+
+        void update(const std::vector<palette_type>& palettes, const std::vector<std::size_t>& changed) noexcept {
+            const auto span = trace::scope{"bank errors"};
+            trace::count("tiles", m_tiles.size() * changed.size());
+
+            parallel::for_each_band(m_tiles.size(), min_band_tiles, [&](std::size_t begin, std::size_t end) {
+                for (auto tile = begin; tile < end; ++tile) {
+                    for (const auto bank : changed) {
+                        m_errors[(tile * m_banks) + bank] = tile_error(m_tiles[tile], palettes[bank]);
+                    }
+                }
+            });
+        }
+
+        // Bank with the least error for tile, the lowest on a tie
+        [[nodiscard]]
+        std::size_t best(std::size_t tile) const noexcept {
+            const auto* row = m_errors.data() + (tile * m_banks);
+            return std::size_t(std::min_element(row, row + m_banks) - row);
+        }
+
+        [[nodiscard]]
+        double error(std::size_t tile, std::size_t bank) const noexcept {
+            return m_errors[(tile * m_banks) + bank];
+        }
+
+    private:
+        const std::vector<palette::histogram_type>& m_tiles;
+        std::size_t m_banks;
+        std::vector<double> m_errors;
+    };
+
+    // Colors of the given tiles, reduced to colors
+    [[nodiscard]]
+    palette_type bank_palette(const std::vector<palette::histogram_type>& tiles, const std::vector<std::size_t>& members, const std::vector<color_format::component_type>& format, int colors, palette::quantizer method, bool refine) noexcept {
+        if (members.empty()) {
+            return {};
+        }
+
+        // Merged in pairs, so each color is copied once per level rather than once per tile
+        auto parts = std::vector<palette::histogram_type>{};
+        parts.reserve(members.size());
+        for (const auto tile : members) {
+            parts.emplace_back(tiles[tile]);
+        }
+        for (auto step = std::size_t{1}; step < parts.size(); step *= 2) {
+            for (auto ii = std::size_t{}; ii + step < parts.size(); ii += step * 2) {
+                palette::merge(format, parts[ii], parts[ii + step]);
+                parts[ii + step] = {};
+            }
+        }
+
+        const auto& histogram = parts.front();
+        if (histogram.colors.size() <= std::size_t(colors)) {
+            return histogram.colors;
+        }
+        return palette::quantize(histogram.colors, colors, method, refine, histogram.counts);
+    }
+
+    // Pixels of each tile as indices into the palette of its bank, through an image::palette_lookup per bank as tiles without banks use
+    // The tiles of a bank are stacked into one column, palettized together and copied back
+    void palettize_tiles(const image::buffer<float>& image, const std::vector<std::size_t>& tileBanks, const std::vector<palette_type>& palettes, const std::vector<color_format::component_type>& format, float pow, image::buffer<std::uint8_t>& out) noexcept {
+        const auto columns = std::size_t(image.width / tileset::tile_size);
+        out.reshape(image.width, image.height, image::layout::index);
+
+        auto members = std::vector<std::vector<std::size_t>>(palettes.size());
+        for (auto tile = std::size_t{}; tile < tileBanks.size(); ++tile) {
+            members[tileBanks[tile]].push_back(tile);
+        }
+
+        auto column = image::buffer<float>{};
+        auto indices = image::buffer<std::uint8_t>{};
+        for (auto bank = std::size_t{}; bank < palettes.size(); ++bank) {
+            const auto& tiles = members[bank];
+            if (tiles.empty()) {
+                continue;
+            }
+
+            // Calls func with the first row of each tile in the image and in the column
+            const auto for_each_tile_row = [&](auto func) {
+                parallel::for_each_band(tiles.size(), min_band_tiles, [&](std::size_t begin, std::size_t end) {
+                    for (auto ii = begin; ii < end; ++ii) {
+                        const auto tx = std::size_t(tiles[ii] % columns) * tileset::tile_size;
+                        const auto ty = int(tiles[ii] / columns) * tileset::tile_size;
+                        for (int yy = 0; yy < tileset::tile_size; ++yy) {
+                            func(tx, ty + yy, (int(ii) * tileset::tile_size) + yy);
+                        }
+                    }
+                });
+            };
+
+            column.reshape(tileset::tile_size, int(tiles.size()) * tileset::tile_size, image::layout::rgba);
+            for_each_tile_row([&](std::size_t tx, int imageRow, int columnRow) {
+                std::ranges::copy(image.row(imageRow).subspan(tx * 4, tileset::tile_size * 4), column.row(columnRow).begin());
+            });
+
+            image::palette_lookup{palettes[bank], format, pow}.palettize(column, indices);
+
+            for_each_tile_row([&](std::size_t tx, int imageRow, int columnRow) {
+                std::ranges::copy(indices.row(columnRow), out.row(imageRow).begin() + std::ptrdiff_t(tx));
+            });
+        }
+    }
+
+}
+
+banks::banks_type banks::optimize(const image::buffer<float>& image, const std::vector<color_format::component_type>& format, float pow, int count, int colors, palette::quantizer method, bool refine) noexcept {
+    const auto span = trace::scope{"banks"};
+
+    const auto tiles = tile_histograms(image, format);
+    const auto bankCount = std::size_t(std::max(count, 1));
+
+    auto palettes = std::vector<palette_type>(bankCount);
+    auto errors = error_table{tiles, bankCount};
+
+    // The first bank holds the colors of the whole image, and each further bank starts as the colors of the tile worst served so far
+    {
+        const auto seedSpan = trace::scope{"seed banks"};
+        const auto histogram = palette::extract(format, image);
+        palettes[0] = histogram.colors.size() <= std::size_t(colors) ? histogram.colors : palette::quantize(histogram.colors, colors, method, refine, histogram.counts);
+        errors.update(palettes, {0});
+
+        for (auto bank = std::size_t{1}; bank < bankCount; ++bank) {
+            auto worst = std::size_t{};
+            auto worstError = 0.0;
+            for (auto tile = std::size_t{}; tile < tiles.size(); ++tile) {
+                const auto error = errors.error(tile, errors.best(tile));
+                if (error > worstError) {
+                    worst = tile;
+                    worstError = error;
+                }
+            }
+
+            if (worstError <= 0.0) { // Every tile is already exact
+                break;
+            }
+
+            palettes[bank] = bank_palette(tiles, {worst}, format, colors, method, refine);
+            errors.update(palettes, {bank});
+        }
+    }
+
+    // Each round moves tiles to their best bank, then requantizes only the banks that gained or lost tiles
+    auto tileBanks = std::vector<std::size_t>(tiles.size(), bankCount);
+    for (auto round = 0; round < max_rounds; ++round) {
+        trace::count("rounds", 1);
+
+        auto changed = std::vector<bool>(bankCount);
+        auto moved = std::size_t{};
+        for (auto tile = std::size_t{}; tile < tiles.size(); ++tile) {
+            const auto best = errors.best(tile);
+            if (best == tileBanks[tile]) {
+                continue;
+            }
+
+            if (tileBanks[tile] < bankCount) {
+                changed[tileBanks[tile]] = true;
+            }
+            changed[best] = true;
+            tileBanks[tile] = best;
+            ++moved;
+        }
+
+        vlog::print("Round {}: {} tiles moved between banks", [&](){return fmt::make_format_args(round, moved);});
+        if (!moved) {
+            break;
+        }
+
+        auto members = std::vector<std::vector<std::size_t>>(bankCount);
+        for (auto tile = std::size_t{}; tile < tiles.size(); ++tile) {
+            members[tileBanks[tile]].push_back(tile);
+        }
+
+        auto requantize = std::vector<std::size_t>{};
+        for (auto bank = std::size_t{}; bank < bankCount; ++bank) {
+            if (changed[bank] && !members[bank].empty()) {
+                requantize.push_back(bank);
+            }
+        }
+
+        parallel::for_each_band(requantize.size(), 1, [&](std::size_t begin, std::size_t end) {
+            for (auto ii = begin; ii < end; ++ii) {
+                const auto bank = requantize[ii];
+                palettes[bank] = bank_palette(tiles, members[bank], format, colors, method, refine);
+            }
+        });
+        errors.update(palettes, requantize);
+    }
+
+    // Banks no tile chose are dropped, the rest keep their order
+    auto result = banks_type{};
+    auto used = std::vector<bool>(bankCount);
+    for (const auto bank : tileBanks) {
+        used[bank] = true;
+    }
+
+    auto renumber = std::vector<std::size_t>(bankCount);
+    for (auto bank = std::size_t{}; bank < bankCount; ++bank) {
+        if (used[bank]) {
+            renumber[bank] = result.palettes.size();
+            result.palettes.emplace_back(std::move(palettes[bank]));
+        }
+    }
+
+    result.tileBanks.reserve(tileBanks.size());
+    for (const auto bank : tileBanks) {
+        result.tileBanks.push_back(renumber[bank]);
+    }
+
+    palettize_tiles(image, result.tileBanks, result.palettes, format, pow, result.indices);
+    return result;
+}
+
+banks::banks_type banks::assign(const image::buffer<float>& image, const std::vector<color_format::component_type>& format, float pow, std::vector<std::vector<std::array<float, 4>>> palettes) noexcept {
+    const auto span = trace::scope{"banks"};
+
+    const auto tiles = tile_histograms(image, format);
+    auto all = std::vector<std::size_t>(palettes.size());
+    for (auto bank = std::size_t{}; bank < all.size(); ++bank) {
+        all[bank] = bank;
+    }
+
+    auto errors = error_table{tiles, palettes.size()};
+    errors.update(palettes, all);
+
+    auto result = banks_type{};
+    result.tileBanks.reserve(tiles.size());
+    for (auto tile = std::size_t{}; tile < tiles.size(); ++tile) {
+        result.tileBanks.push_back(errors.best(tile));
+    }
+    result.palettes = std::move(palettes);
+
+    palettize_tiles(image, result.tileBanks, result.palettes, format, pow, result.indices);
+    return result;
+}
@@ -0,0 +1,487 @@
+#include "batch.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <ctopt.hpp>
+#include <fmt/format.h>
+
+#include "bitmap.hpp"
+#include "gfx2agb.hpp"
+#include "logging.hpp"
+#include "options.hpp"
+#include "parallel.hpp"
+#include "util.hpp"
+
+namespace {
+
+    struct job_type {
+        std::size_t line;
+        std::vector<std::string> arguments;
+    };
+
+    using text_iterator = std::string_view::const_iterator;
+
+}
+
+static std::optional<std::vector<job_type>> parse_manifest(std::string_view text) noexcept;
+static int run_job(const job_type& job, std::span<const std::array<float, 4>> sharedPalette) noexcept;
+static std::optional<std::vector<std::array<float, 4>>> shared_palette(const std::vector<job_type>& jobs, std::size_t threadCount, std::size_t threadsPerJob) noexcept;
+
+int batch(ctopt::args::const_iterator begin, ctopt::args::const_iterator end) {
+    using namespace options;
+
+    const auto args = get_opts_batch(std::move(begin), std::move(end));
+    if (!args) {
+        fmt::print(stderr, "{}\n", args.error_str());
+        fmt::print("{}", get_opts_batch.help_str());
+        return 1;
+    }
+
+    const auto* manifestPath = args.get<const char*>("in-manifest");
+    vlog::print("Reading manifest {}", [&](){return fmt::make_format_args(manifestPath);});
+
+    auto ifs = std::ifstream(manifestPath, std::ios::binary);
+    if (!ifs.is_open()) {
+        fmt::print(stderr, "Could not read manifest {}", manifestPath);
+        return 1;
+    }
+
+    const auto text = std::string{std::istreambuf_iterator<char>{ifs}, std::istreambuf_iterator<char>{}};
+    ifs.close();
+
+    const auto jobs = parse_manifest(text);
+    if (!jobs) {
+        fmt::print(stderr, "Could not parse manifest {}", manifestPath);
+        return 1;
+    }
+
+    if (jobs->empty()) {
+        fmt::print(stderr, "No jobs in manifest {}", manifestPath);
+        return 1;
+    }
+
+    const auto threadCount = [&]() {
+        auto count = std::size_t(std::max(args.get<int>("jobs"), 0));
+        if (!count) {
+            count = std::max(std::thread::hardware_concurrency(), 1u);
+        }
+        return std::min(count, jobs->size());
+    }();
+
+    vlog::print("Running {} jobs on {} threads", [&](){return fmt::make_format_args(jobs->size(), threadCount);});
+
+    auto results = std::vector<int>(jobs->size());
+    auto nextJob = std::atomic<std::size_t>{};
+
+    const auto threadsPerJob = std::max(parallel::concurrency() / threadCount, std::size_t{1});
+
+    const auto startTime = std::chrono::steady_clock::now();
+
+    auto palette = std::vector<std::array<float, 4>>{};
+    if (args.get<bool>("shared-palette")) {
+        auto shared = shared_palette(*jobs, threadCount, threadsPerJob);
+        if (!shared) {
+            return 1;
+        }
+        palette = std::move(*shared);
+    }
+
+    const auto* sink = vlog::sink;
+    const auto worker = [&]() {
+        parallel::max_threads = threadsPerJob;
+        vlog::sink = sink;
+        for (auto idx = nextJob++; idx < jobs->size(); idx = nextJob++) {
+            results[idx] = run_job((*jobs)[idx], palette);
+        }
+    };
+
+    auto threads = std::vector<std::thread>{};
+    threads.reserve(threadCount - 1);
+    for (auto ii = std::size_t{1}; ii < threadCount; ++ii) {
+        threads.emplace_back(worker);
+    }
+
+    const auto outerThreads = parallel::max_threads;
+    worker();
+    parallel::max_threads = outerThreads;
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    auto failed = std::size_t{};
+    for (auto ii = std::size_t{}; ii < jobs->size(); ++ii) {
+        if (results[ii] == 0) {
+            continue;
+        }
+
+        ++failed;
+        const auto& job = (*jobs)[ii];
+        fmt::print(stderr, "\nJob {} (line {}) failed with exit code {}: {}\n", ii + 1, job.line, results[ii], fmt::join(job.arguments, " "));
+    }
+
+    fmt::print("{} jobs in {:.3f}s ({:.1f} jobs/s, {} threads): {} succeeded, {} failed\n",
+        jobs->size(), seconds, double(jobs->size()) / std::max(seconds, 1e-9), threadCount,
+        jobs->size() - failed, failed
+    );
+
+    return failed ? 1 : 0;
+}
+
+static int run_job(const job_type& job, std::span<const std::array<float, 4>> sharedPalette) noexcept {
+    try {
+        return bitmap(job.arguments, sharedPalette);
+    } catch (const std::exception& e) {
+        fmt::print(stderr, "Job on line {} threw: {}\n", job.line, e.what());
+    } catch (...) {
+        fmt::print(stderr, "Job on line {} threw an unknown exception\n", job.line);
+    }
+    return 1;
+}
+
+// Counts each job's colors into one histogram per thread, merges those in pairs, and reduces the result once
+// Every job must share a color format, the first job's color options decide the palette
+static std::optional<std::vector<std::array<float, 4>>> shared_palette(const std::vector<job_type>& jobs, std::size_t threadCount, std::size_t threadsPerJob) noexcept {
+    vlog::print("Counting colors of {} jobs for a shared palette", [&](){return fmt::make_format_args(jobs.size());});
+
+    auto histograms = std::vector<gfx2agb::color_histogram>(threadCount);
+    auto settings = std::vector<gfx2agb::bitmap_options>(jobs.size());
+    auto results = std::vector<int>(jobs.size());
+    auto nextJob = std::atomic<std::size_t>{};
+
+    const auto* sink = vlog::sink;
+    const auto worker = [&](gfx2agb::color_histogram& histogram) {
+        parallel::max_threads = threadsPerJob;
+        vlog::sink = sink;
+        for (auto idx = nextJob++; idx < jobs.size(); idx = nextJob++) {
+            try {
+                results[idx] = bitmap_histogram(jobs[idx].arguments, histogram, settings[idx]);
+            } catch (const std::exception& e) {
+                fmt::print(stderr, "Job on line {} threw: {}\n", jobs[idx].line, e.what());
+                results[idx] = 1;
+            } catch (...) {
+                fmt::print(stderr, "Job on line {} threw an unknown exception\n", jobs[idx].line);
+                results[idx] = 1;
+            }
+        }
+    };
+
+    auto threads = std::vector<std::thread>{};
+    threads.reserve(threadCount - 1);
+    for (auto ii = std::size_t{1}; ii < threadCount; ++ii) {
+        threads.emplace_back(worker, std::ref(histograms[ii]));
+    }
+
+    // The merges and the reduction after the jobs use every thread again
+    const auto outerThreads = parallel::max_threads;
+    worker(histograms.front());
+    parallel::max_threads = outerThreads;
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (auto ii = std::size_t{}; ii < jobs.size(); ++ii) {
+        if (results[ii]) {
+            fmt::print(stderr, "\nJob {} (line {}) failed to count colors for a shared palette: {}\n", ii + 1, jobs[ii].line, fmt::join(jobs[ii].arguments, " "));
+            return std::nullopt;
+        }
+    }
+
+    // Halves the histograms each round, merging the upper half into the lower in parallel
+    auto failed = std::atomic<bool>{};
+    for (auto count = histograms.size(); count > 1; count = (count + 1) / 2) {
+        const auto half = count / 2;
+        const auto upper = count - half;
+        parallel::for_each_band(half, 1, [&](std::size_t begin, std::size_t end) {
+            for (auto ii = begin; ii < end; ++ii) {
+                if (const auto merged = gfx2agb::merge_histograms(histograms[ii], std::move(histograms[upper + ii])); !merged) {
+                    fmt::print(stderr, "{}\n", merged.error);
+                    failed = true;
+                }
+            }
+        });
+        histograms.resize(upper);
+    }
+    if (failed) {
+        return std::nullopt;
+    }
+
+    auto palette = std::vector<std::array<float, 4>>{};
+    if (const auto reduced = gfx2agb::reduce_histogram(histograms.front(), settings.front(), palette); !reduced) {
+        fmt::print(stderr, "Could not make a shared palette: {}\n", reduced.error);
+        return std::nullopt;
+    }
+
+    vlog::print("Shared palette of {} colors from {} unique colors", [&](){return fmt::make_format_args(palette.size(), histograms.front().colors.size());});
+    return palette;
+}
+
+static std::optional<std::vector<job_type>> parse_json_manifest(std::string_view text) noexcept;
+
+static std::optional<std::vector<job_type>> parse_manifest(std::string_view text) noexcept {
+    const auto first = text.find_first_not_of(" \t\r\n");
+    if (first != std::string_view::npos && text[first] == '[') {
+        return parse_json_manifest(text);
+    }
+
+    auto result = std::vector<job_type>{};
+
+    auto lineNumber = std::size_t{};
+    auto lines = std::istringstream{std::string{text}};
+    auto line = std::string{};
+    while (std::getline(lines, line)) {
+        ++lineNumber;
+
+        auto arguments = util::split_args(line);
+        if (arguments.empty() || arguments.front().starts_with('#')) {
+            continue; // Blank line or comment
+        }
+
+        if (arguments.front() == "bitmap") {
+            arguments.erase(arguments.cbegin());
+        }
+
+        result.emplace_back(lineNumber, std::move(arguments));
+    }
+
+    return result;
+}
+
+static void skip_space(text_iterator& it, text_iterator end) noexcept;
+static std::optional<std::string> parse_json_string(text_iterator& it, text_iterator end) noexcept;
+static std::optional<std::string> parse_json_scalar(text_iterator& it, text_iterator end) noexcept;
+static bool parse_json_job(text_iterator& it, text_iterator end, std::vector<std::string>& arguments) noexcept;
+
+// JSON manifests are an array of jobs. A job is either an array of bitmap arguments:
+//   ["-m4", "-i", "a.png", "-o", "a.bin"]
+// Or an object of option names to values (true adds a flag, false or null omits it):
+//   {"mode": 4, "in-image": "a.png", "out-data": "a.bin", "anti-alias": true}
+static std::optional<std::vector<job_type>> parse_json_manifest(std::string_view text) noexcept {
+    auto result = std::vector<job_type>{};
+
+    auto it = text.cbegin();
+    skip_space(it, text.cend());
+    if (it == text.cend() || *it++ != '[') {
+        return std::nullopt;
+    }
+
+    skip_space(it, text.cend());
+    if (it != text.cend() && *it == ']') {
+        return result;
+    }
+
+    // Lines are counted on from the previous job, so the text is scanned once
+    auto line = std::size_t{1};
+    auto counted = text.cbegin();
+    while (it != text.cend()) {
+        skip_space(it, text.cend());
+        line += std::size_t(std::count(counted, it, '\n'));
+        counted = it;
+
+        auto arguments = std::vector<std::string>{};
+        if (!parse_json_job(it, text.cend(), arguments)) {
+            fmt::print(stderr, "Invalid job on line {}\n", line);
+            return std::nullopt;
+        }
+        result.emplace_back(line, std::move(arguments));
+
+        skip_space(it, text.cend());
+        if (it == text.cend()) {
+            break;
+        }
+        if (*it == ']') {
+            return result;
+        }
+        if (*it++ != ',') {
+            break;
+        }
+    }
+
+    fmt::print(stderr, "Unterminated JSON array\n");
+    return std::nullopt;
+}
+
+static void skip_space(text_iterator& it, text_iterator end) noexcept {
+    while (it != end && (*it == ' ' || *it == '\t' || *it == '\r' || *it == '\n')) {
+        ++it;
+    }
+}
+
+static bool parse_json_job(text_iterator& it, text_iterator end, std::vector<std::string>& arguments) noexcept {
+    if (it == end || (*it != '[' && *it != '{')) {
+        return false;
+    }
+
+    const auto isObject = *it++ == '{';
+    const auto close = isObject ? '}' : ']';
+
+    skip_space(it, end);
+    if (it != end && *it == close) {
+        ++it;
+        return true;
+    }
+
+    while (it != end) {
+        skip_space(it, end);
+
+        if (isObject) {
+            const auto key = parse_json_string(it, end);
+            skip_space(it, end);
+            if (!key || key->empty() || it == end || *it++ != ':') {
+                return false;
+            }
+            skip_space(it, end);
+
+            const auto isString = it != end && *it == '"';
+            const auto value = parse_json_scalar(it, end);
+            if (!value) {
+                return false;
+            }
+
+            const auto prefix = key->size() == 1 ? "-" : "--";
+            if (isString || (*value != "true" && *value != "false" && *value != "null")) {
+                if (key->size() == 1) {
+                    arguments.emplace_back(prefix + *key);
+                    arguments.emplace_back(*value);
+                } else {
+                    arguments.emplace_back(prefix + *key + "=" + *value);
+                }
+            } else if (*value == "true") {
+                arguments.emplace_back(prefix + *key);
+            }
+        } else {
+            const auto value = parse_json_scalar(it, end);
+            if (!value) {
+                return false;
+            }
+            arguments.emplace_back(*value);
+        }
+
+        skip_space(it, end);
+        if (it == end) {
+            return false;
+        }
+        if (*it == close) {
+            ++it;
+            return true;
+        }
+        if (*it++ != ',') {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+static std::optional<std::string> parse_json_scalar(text_iterator& it, text_iterator end) noexcept {
+    if (it == end) {
+        return std::nullopt;
+    }
+
+    if (*it == '"') {
+        return parse_json_string(it, end);
+    }
+
+    // Numbers and literals are passed through verbatim
+    const auto begin = it;
+    while (it != end && *it != ',' && *it != ']' && *it != '}' && *it != ' ' && *it != '\t' && *it != '\r' && *it != '\n') {
+        if (*it == '[' || *it == '{' || *it == '"') {
+            return std::nullopt;
+        }
+        ++it;
+    }
+
+    if (it == begin) {
+        return std::nullopt;
+    }
+    return std::string{begin, it};
+}
+
+static void append_utf8(std::string& str, unsigned codepoint) noexcept;
+
+static std::optional<std::string> parse_json_string(text_iterator& it, text_iterator end) noexcept {
+    if (it == end || *it++ != '"') {
+        return std::nullopt;
+    }
+
+    auto result = std::string{};
+    while (it != end) {
+        const auto c = *it++;
+        if (c == '"') {
+            return result;
+        }
+
+        if (c != '\\') {
+            result += c;
+            continue;
+        }
+
+        if (it == end) {
+            break;
+        }
+
+        switch (const auto escape = *it++) {
+            case 'b': result += '\b'; break;
+            case 'f': result += '\f'; break;
+            case 'n': result += '\n'; break;
+            case 'r': result += '\r'; break;
+            case 't': result += '\t'; break;
+            case 'u': {
+                if (std::distance(it, end) < 4) {
+                    return std::nullopt;
+                }
+
+                auto codepoint = 0u;
+                for (int ii = 0; ii < 4; ++ii) {
+                    const auto h = *it++;
+                    codepoint <<= 4;
+                    if (h >= '0' && h <= '9') {
+                        codepoint |= unsigned(h - '0');
+                    } else if (h >= 'a' && h <= 'f') {
+                        codepoint |= unsigned(h - 'a' + 10);
+                    } else if (h >= 'A' && h <= 'F') {
+                        codepoint |= unsigned(h - 'A' + 10);
+                    } else {
+                        return std::nullopt;
+                    }
+                }
+                append_utf8(result, codepoint);
+                break;
+            }
+            default:
+                result += escape; // \" \\ \/
+        }
+    }
+
+    return std::nullopt;
+}
+
+static void append_utf8(std::string& str, unsigned codepoint) noexcept {
+    if (codepoint < 0x80) {
+        str += char(codepoint);
+    } else if (codepoint < 0x800) {
+        str += char(0xc0 | (codepoint >> 6));
+        str += char(0x80 | (codepoint & 0x3f));
+    } else {
+        str += char(0xe0 | (codepoint >> 12));
+        str += char(0x80 | ((codepoint >> 6) & 0x3f));
+        str += char(0x80 | (codepoint & 0x3f));
+    }
+}
@@ -1,16 +1,26 @@
 #include "bitmap.hpp"
 
-#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <span>
+#include <string_view>
+#include <tuple>
+#include <vector>
 
 #include <ctopt.hpp>
 #include <fmt/format.h>
 #include <stb_image_write.h>
 
+#include "cache.hpp"
 #include "color_format.hpp"
+#include "decode_cache.hpp"
+#include "gfx2agb.hpp"
 #include "image_io.hpp"
 #include "logging.hpp"
 #include "options.hpp"
+#include "output.hpp"
 #include "palette.hpp"
+#include "trace.hpp"
 #include "util.hpp"
 
 namespace {
@@ -22,295 +32,367 @@ namespace {
 
     const auto png_pixel_format = color_format::parse("ABGR8");
 
+    // Library options of parsed bitmap arguments
+    gfx2agb::bitmap_options to_options(const auto& args) {
+        auto options = gfx2agb::bitmap_options{};
+        options.mode = args.template get<int>("mode");
+        options.width = args.template get<std::optional<std::string>>("width").value_or("");
+        options.height = args.template get<std::optional<std::string>>("height").value_or("");
+        options.format = args.template get<std::string>("format");
+        std::tie(options.inGamma, options.outGamma) = [&]() {
+            const auto gamma = args.template get<std::pair<float, float>>("gamma");
+            if (std::get<1>(gamma) == 0.0f) {
+                return std::make_pair(pc_display_sRGB<float>, std::get<0>(gamma));
+            }
+            return gamma;
+        }();
+        options.bpp = args.template get<std::size_t>("bpp");
+        options.colors = args.template get<int>("colors");
+        options.quantizer = args.template get<std::string>("quantizer");
+        options.refine = args.template get<bool>("refine");
+        options.direction = args.template get<std::string>("direction");
+        options.antiAlias = args.template get<bool>("anti-alias");
+        options.filter = args.template get<std::string>("filter");
+        options.maxMemory = args.template get<std::size_t>("max-memory") * 1024 * 1024;
+        options.compress = args.template get<std::optional<std::string>>("compress").value_or("");
+        options.optimalParse = args.template get<bool>("optimal-parse");
+        if (vlog::sink) {
+            options.log = *vlog::sink;
+        }
+        return options;
+    }
+
+    // Calls func with the parsed arguments that would follow `gfx2agb bitmap`
+    int with_arguments(const std::vector<std::string>& arguments, auto func) {
+        // Round-trip through the top-level parser so this behaves exactly like `gfx2agb bitmap <arguments>`
+        auto storage = std::vector<std::string>{"gfx2agb", "bitmap"};
+        storage.insert(storage.cend(), arguments.cbegin(), arguments.cend());
+
+        auto argv = std::vector<char*>{};
+        argv.reserve(storage.size() + 1);
+        for (auto& arg : storage) {
+            argv.emplace_back(arg.data());
+        }
+        argv.emplace_back(nullptr);
+
+        const auto args = options::get_opts(static_cast<int>(storage.size()), argv.data());
+        if (!args || args.cbegin() == args.cend()) {
+            vlog::error("Could not parse bitmap arguments\n");
+            return 1;
+        }
+
+        return func(++args.cbegin(), args.cend());
+    }
+
 }
 
-int bitmap(ctopt::args::const_iterator begin, ctopt::args::const_iterator end) {
+int bitmap(ctopt::args::const_iterator begin, ctopt::args::const_iterator end, std::span<const std::array<float, 4>> sharedPalette, image::decode_cache* decodeCache) {
     using namespace options;
 
     const auto args = get_opts_bitmap(std::move(begin), std::move(end));
     if (!args) {
-        fmt::print(stderr, "{}\n", args.error_str());
+        vlog::error("{}\n", args.error_str());
         fmt::print("{}", get_opts_bitmap.help_str());
         return 1;
     }
 
     const auto mode = args.get<int>("mode");
-    if (mode < 3 || mode > 5) {
-        fmt::print(stderr, "{} is not a bitmap mode (expected 3, 4, 5)", mode);
-        return 1;
-    }
 
-    const auto colorFormat = color_format::parse(args.get<std::string>("format"));
-    if (colorFormat.empty()) {
-        fmt::print(stderr, "Could not parse color format {}", args.get<std::string>("format"));
-        return 1;
-    }
+    auto settings = to_options(args);
+    settings.sharedPalette = sharedPalette;
 
-    const auto [major, minor] = image::direction_pair(args.get<std::string>("direction"));
-    if (image::same_axis(major, minor)) {
-        fmt::print(stderr, "Invalid direction {}", args.get<const char*>("direction"));
+    if (const auto checked = gfx2agb::check_bitmap(settings); !checked) {
+        vlog::error("{}", checked.error);
         return 1;
     }
 
-    int inWidth, inHeight, components;
-    vlog::print("Reading image {}", [&](){return fmt::make_format_args(args.get<const char*>("in-image"));});
-    const auto image = image::load(args.get<const char*>("in-image"), inWidth, inHeight, components);
-    if (!image) {
-        fmt::print(stderr, "Could not read image {}", args.get<std::string>("in-image"));
+    const auto* outputPng = args.get<const char*>("out-png");
+    const auto* outputData = args.get<const char*>("out-data");
+    const auto* outputPaletteGpl = mode == 4 ? args.get<const char*>("out-palette-gpl") : nullptr;
+    const auto* outputPalettePng = mode == 4 ? args.get<const char*>("out-palette-png") : nullptr;
+    const auto* outputPaletteData = mode == 4 ? args.get<const char*>("out-palette-data") : nullptr;
+    if (!outputPng && !outputData && !outputPaletteGpl && !outputPalettePng && !outputPaletteData) {
+        vlog::error("No outputs");
+        fmt::print("{}", get_opts_bitmap.help_str());
         return 1;
     }
 
-    // Mutable as --direction may change these
-    auto [outWidth, outHeight] = util::parse_width_height(inWidth, inHeight,
-        args.get<std::optional<std::string>>("width").value_or(mode == 5 ? "160" : "240"),
-        args.get<std::optional<std::string>>("height").value_or(mode == 5 ? "120" : "160")
-    );
+    // --trace and --stats record a span for each stage of this conversion
+    const auto* tracePath = args.get<const char*>("trace");
+    const auto stats = args.get<bool>("stats");
+    auto recorder = trace::recorder{};
+    if (tracePath || stats) {
+        recorder.install();
+    }
 
-    const auto [inGamma, outGamma] = [&]() {
-        const auto gamma = args.get<std::pair<float, float>>("gamma");
-        if (std::get<1>(gamma) == 0.0f) {
-            return std::make_pair(pc_display_sRGB<float>, std::get<0>(gamma));
+    // Called on success, after any cache hit or store
+    const auto report = [&]() {
+        if (tracePath && !recorder.write_json(tracePath)) {
+            vlog::error("Could not write file {}", tracePath);
+            return 1;
         }
-        return gamma;
-    }();
 
-    vlog::print("Converting to linear with gamma {}", [&](){return fmt::make_format_args(inGamma);});
-    auto imageLinear = image::to_float(image, inWidth, inHeight, inGamma);
+        if (stats) {
+            recorder.print_stats(stderr);
+            fmt::print(stderr, "Peak memory {:.1f} MiB\n", double(util::peak_memory()) / (1024.0 * 1024.0));
+        }
+        return 0;
+    };
 
-    if (args.get<bool>("anti-alias")) { // Apply sub-pixel anti-aliasing
-        vlog::print("Resizing to {}x{} with sub-pixel anti-aliasing", [&](){return fmt::make_format_args(outWidth, outHeight);});
-        imageLinear = image::resize_and_resolve(imageLinear, inWidth, inHeight, outWidth, outHeight);
-    } else if (inWidth != outWidth || inHeight != outHeight) {
-        vlog::print("Resizing to {}x{}", [&](){return fmt::make_format_args(outWidth, outHeight);});
-        imageLinear = image::resize(imageLinear, inWidth, inHeight, outWidth, outHeight);
-    }
+    // Outputs of this mode, restored from or stored to --cache-dir under a key of the inputs, the options that shape the outputs, and the version
+    const auto* cacheDir = args.get<const char*>("cache-dir");
+    const auto outputPaths = [&]() {
+        auto outputs = std::vector<cache::output_type>{};
+        for (const auto* name : {"out-data", "out-png", "out-palette-data", "out-palette-png", "out-palette-gpl"}) {
+            const auto* path = args.get<const char*>(name);
+            if (path && (mode == 4 || std::string_view{name}.find("palette") == std::string_view::npos)) {
+                outputs.push_back({name, path});
+            }
+        }
+        return outputs;
+    }();
 
-    const auto* outputPng = args.get<const char*>("out-png");
-    const auto* outputData = args.get<const char*>("out-data");
     const auto* inPalette = args.get<const char*>("in-palette");
 
-    const auto load_palette = [&]() {
-        int inPalWidth, inPalHeight, palComponents;
-        const auto pal = image::load(inPalette, inPalWidth, inPalHeight, palComponents);
-
-        if (pal) {
-            vlog::print("Extracting palette from {} with gamma {}", [&](){return fmt::make_format_args(inPalette, inGamma);});
-            return palette::extract(
-                colorFormat,
-                image::to_float(std::move(pal), inPalWidth, inPalHeight, inGamma),
-                inPalWidth,
-                inPalHeight
-            );
+    const auto cacheKey = [&]() {
+        if (!cacheDir) {
+            return std::string{};
         }
 
-        std::string name;
-        int columns;
-        const auto palette = palette::gpl_load(inPalette, name, columns);
-        if (palette.empty()) { // Retry as binary
-            vlog::print("Loading {} as binary palette in format {}", [&](){return fmt::make_format_args(inPalette, args.get<std::string>("format"));});
-            return palette::binary_load(inPalette, colorFormat);
+        const auto span = trace::scope{"hash"};
+        auto hasher = cache::hasher{};
+        hasher.update(fmt::format("{}.{}.{}", GFX2AGB_VERSION_MAJOR, GFX2AGB_VERSION_MINOR, GFX2AGB_VERSION_PATCH));
+        if (!hasher.update_file(args.get<const char*>("in-image"))) {
+            return std::string{};
         }
 
-        vlog::print("Loaded GPL palette from {} (Name: {} Columns: {})", [&](){return fmt::make_format_args(inPalette, name, columns);});
-        return image::gamma_pow(palette, inGamma);
-    };
-
-    if (mode == 4) {
-        const auto* outputPaletteGpl = args.get<const char*>("out-palette-gpl");
-        const auto* outputPalettePng = args.get<const char*>("out-palette-png");
-        const auto* outputPaletteData = args.get<const char*>("out-palette-data");
-
-        if (!outputPng && !outputData && !outputPaletteGpl && !outputPalettePng && !outputPaletteData) {
-            fmt::print(stderr, "No outputs");
-            fmt::print("{}", get_opts_bitmap.help_str());
-            return 1;
+        if (!sharedPalette.empty()) {
+            hasher.update(std::as_bytes(sharedPalette));
+        } else if (inPalette && !hasher.update_file(inPalette)) {
+            return std::string{};
         }
 
-        const auto bpp = args.get<std::size_t>("bpp");
-        if (!util::is_pow2_or_mul8(bpp)) {
-            fmt::print(stderr, "bpp ({}) must be a power of 2 or a multiple of 8", bpp);
-            return 1;
+        const auto [gammaIn, gammaOut] = args.get<std::pair<float, float>>("gamma");
+        hasher.update(fmt::format("mode={} width={} height={} format={} gamma={}:{} bpp={} colors={} quantizer={} refine={} direction={} anti-alias={} filter={} max-memory={} compress={} optimal-parse={}",
+            mode,
+            args.get<std::optional<std::string>>("width").value_or(mode == 5 ? "160" : "240"),
+            args.get<std::optional<std::string>>("height").value_or(mode == 5 ? "120" : "160"),
+            settings.format,
+            gammaIn, gammaOut,
+            settings.bpp,
+            settings.colors,
+            settings.quantizer,
+            settings.refine,
+            settings.direction,
+            settings.antiAlias,
+            settings.filter,
+            args.get<std::size_t>("max-memory"),
+            settings.compress,
+            settings.optimalParse
+        ));
+        for (const auto& output : outputPaths) {
+            hasher.update(output.name);
         }
+        return hasher.digest();
+    }();
 
-        const auto palette = [&]() {
-            if (inPalette) {
-                return load_palette();
-            }
-
-            const auto colors = [&]() {
-                const auto colors = args.get<int>("colors");
-                if (colors) {
-                    return colors;
-                }
-                return 1 << bpp;
-            }();
-
-            vlog::print("Reducing to {} colors ({} bits per pixel)", [&](){return fmt::make_format_args(colors, bpp);});
-            return palette::quantize(
-                palette::extract(colorFormat, imageLinear, outWidth, outHeight),
-                colors
-            );
-        }();
-
-        vlog::print("Applying palette ({} colors)", [&](){return fmt::make_format_args(palette.size());});
-        auto palettedImage = image::palettize(imageLinear, palette);
-
-        if (!image::is_normal(major, minor)) {
-            vlog::print("Applying orientation {}", [&](){return fmt::make_format_args(args.get<std::string>("direction"));});
-            palettedImage = image::orientate(palettedImage, outWidth, outHeight, major, minor);
-            if (image::is_x_axis(minor)) {
-                std::swap(outWidth, outHeight);
-            }
+    if (!cacheKey.empty()) {
+        const auto span = trace::scope{"cache restore"};
+        if (cache::restore(cacheDir, cacheKey, outputPaths)) {
+            return report();
         }
+    }
 
-        if (outputPaletteGpl) {
-            vlog::print("Writing {}", [&](){return fmt::make_format_args(outputPaletteGpl);});
-            const auto data = palette::to_gpl(palette, 1.0f / outGamma);
-
-            auto ofs = std::ofstream(outputPaletteGpl, std::ios::binary);
-            if (!ofs.is_open()) {
-                fmt::print(stderr, "Could not write file {}", outputPaletteGpl);
-                return 1;
-            }
-
-            ofs << data;
-            ofs.close();
+    // Every output is created up front, so an unwritable path fails before any work, and all are renamed into place once written
+    auto outputs = output::plan{};
+    for (const auto& [name, path] : outputPaths) {
+        if (!outputs.add(name, path)) {
+            return 1;
         }
+    }
 
-        if (outputPng) {
-            vlog::print("Writing {}", [&](){return fmt::make_format_args(outputPng);});
-            const auto imagePng = image::to_data(image::expand(palettedImage, palette), outWidth, outHeight, 1.0f / outGamma, png_pixel_format);
-
-            const bool written = stbi_write_png(outputPng, outWidth, outHeight, png_components, imagePng.data(), outWidth * png_components);
-            if (!written) {
-                fmt::print(stderr, "Could not write file {}", outputPng);
+    // Called on success
+    const auto finish = [&]() {
+        {
+            const auto span = trace::scope{"commit"};
+            if (!outputs.commit()) {
                 return 1;
             }
         }
 
-        if (outputPalettePng) {
-            vlog::print("Writing {}", [&](){return fmt::make_format_args(outputPalettePng);});
-            const auto palWidth = static_cast<int>(std::sqrt(palette.size()));
-            const auto palHeight = static_cast<int>((palette.size() + (palWidth - 1)) / palWidth);
+        if (!cacheKey.empty()) {
+            const auto span = trace::scope{"cache store"};
+            cache::store(cacheDir, cacheKey, outputPaths, args.get<std::uintmax_t>("cache-size") * 1024 * 1024);
+        }
 
-            auto flat = image::flatten(palette);
-            flat.resize(palWidth * palHeight * 4);
-            const auto imagePng = image::to_data(flat, palWidth, palHeight, 1.0f / outGamma, png_pixel_format);
+        vlog::print("Peak memory {:.1f} MiB", [&](){return fmt::make_format_args(double(util::peak_memory()) / (1024.0 * 1024.0));});
+        return report();
+    };
 
-            const bool written = stbi_write_png(outputPalettePng, palWidth, palHeight, png_components, imagePng.data(), palWidth * png_components);
-            if (!written) {
-                fmt::print(stderr, "Could not write file {}", outputPalettePng);
-                return 1;
-            }
+    const auto paletteFile = [&]() {
+        if (!inPalette || !sharedPalette.empty()) {
+            return std::optional<std::vector<std::byte>>{std::vector<std::byte>{}};
         }
+        return util::read_file(inPalette);
+    }();
+    if (!paletteFile) {
+        vlog::error("Could not read palette {}", inPalette);
+        return 1;
+    }
+    settings.palette = *paletteFile;
 
-        if (outputData) {
-            vlog::print("Writing {}", [&](){return fmt::make_format_args(outputData);});
-            const auto data = util::repack_data(palettedImage, bpp);
+    int inWidth, inHeight, components;
+    vlog::print("Reading image {}", [&](){return fmt::make_format_args(args.get<const char*>("in-image"));});
+    const auto image = [&]() {
+        const auto span = trace::scope{"decode"};
+        auto pixels = image::load_shared(decodeCache, args.get<const char*>("in-image"), inWidth, inHeight, components);
+        if (pixels) {
+            trace::count("pixels", std::size_t(inWidth) * std::size_t(inHeight));
+        }
+        return pixels;
+    }();
+    if (!image) {
+        vlog::error("Could not read image {}", args.get<std::string>("in-image"));
+        return 1;
+    }
 
-            auto ofs = std::ofstream(outputData, std::ios::binary);
-            if (!ofs.is_open()) {
-                fmt::print(stderr, "Could not write file {}", outputData);
-                return 1;
-            }
+    const auto sizes = gfx2agb::measure_bitmap(settings, inWidth, inHeight);
+    if (!sizes) {
+        vlog::error("{}", sizes.error);
+        return 1;
+    }
 
-            ofs.write(
-                data.data(),
-                static_cast<std::streamsize>(data.size())
-            );
-            ofs.close();
+    // Data is packed straight into its mapped output, the rest is gathered for encoding
+    // Compressed data is only as large as its stream, so it is gathered too
+    auto buffers = gfx2agb::bitmap_outputs{};
+    auto compressedData = std::vector<std::byte>(outputData && !settings.compress.empty() ? sizes.dataSize : 0);
+    if (!compressedData.empty()) {
+        buffers.data = compressedData;
+    } else if (outputData) {
+        vlog::print("Writing {}", [&](){return fmt::make_format_args(outputData);});
+        const auto data = outputs.map("out-data", sizes.dataSize);
+        if (!data) {
+            return 1;
         }
+        buffers.data = *data;
+    }
 
-        if (outputPaletteData) {
-            vlog::print("Writing {}", [&](){return fmt::make_format_args(outputPaletteData);});
-            const auto data = image::to_data(image::flatten(palette), static_cast<int>(palette.size()), 1, 1.0f / outGamma, colorFormat);
-
-            auto ofs = std::ofstream(outputPaletteData, std::ios::binary);
-            if (!ofs.is_open()) {
-                fmt::print(stderr, "Could not write file {}", outputPaletteData);
-                return 1;
-            }
+    auto preview = std::vector<std::byte>(outputPng ? sizes.previewSize : 0);
+    buffers.preview = preview;
 
-            ofs.write(
-                reinterpret_cast<const char*>(data.data()),
-                static_cast<std::streamsize>(data.size())
-            );
-            ofs.close();
-        }
+    auto palette = std::vector<std::array<float, 4>>(outputPaletteGpl || outputPalettePng ? sizes.paletteColors : 0);
+    buffers.palette = palette;
 
-        return 0;
-    }
+    auto paletteData = std::vector<std::byte>(outputPaletteData ? sizes.paletteDataSize : 0);
+    buffers.paletteData = paletteData;
 
-    // Mode 3/5 bitmap
-    if (!outputPng && !outputData) {
-        fmt::print(stderr, "No outputs");
-        fmt::print("{}", get_opts_bitmap.help_str());
+    const auto imageBytes = std::size_t(inWidth) * std::size_t(inHeight) * png_components;
+    const auto result = gfx2agb::convert_bitmap({std::as_bytes(std::span{image.get(), imageBytes}), inWidth, inHeight}, settings, buffers);
+    if (!result) {
+        vlog::error("{}", result.error);
         return 1;
     }
+    palette.resize(result.paletteColors);
 
-    const auto colors = args.get<int>("colors");
+    if (!compressedData.empty()) {
+        vlog::print("Writing {}", [&](){return fmt::make_format_args(outputData);});
+        if (!outputs.write("out-data", std::span{compressedData}.first(result.dataSize))) {
+            return 1;
+        }
+    }
 
-    if (inPalette) { // Apply palette
-        auto palette = load_palette();
-        if (colors) { // And reduce colors
-            vlog::print("Reducing to {} colors", [&](){return fmt::make_format_args(colors);});
-            palette = palette::quantize(palette, colors);
+    const auto write_png = [&](std::string_view name, const char* path, int width, int height, const void* pixels) {
+        vlog::print("Writing {}", [&](){return fmt::make_format_args(path);});
+        const auto span = trace::scope{"write png"};
+        trace::count("pixels", std::size_t(width) * std::size_t(height));
+
+        auto encoded = std::vector<std::byte>{};
+        const auto append = [](void* context, void* data, int size) {
+            const auto* bytes = static_cast<const std::byte*>(data);
+            auto& out = *static_cast<std::vector<std::byte>*>(context);
+            out.insert(out.end(), bytes, bytes + size);
+        };
+        if (!stbi_write_png_to_func(append, &encoded, width, height, png_components, pixels, width * png_components)) {
+            vlog::error("Could not write file {}", path);
+            return false;
         }
+        return outputs.write(name, encoded);
+    };
 
-        vlog::print("Applying palette ({} colors)", [&](){return fmt::make_format_args(palette.size());});
-        imageLinear = image::expand(
-            image::palettize(imageLinear, palette),
-            palette
-        );
-    } else if (colors) { // Reduce colors
-        vlog::print("Reducing to {} colors", [&](){return fmt::make_format_args(colors);});
-        const auto palette = palette::quantize(
-            palette::extract(colorFormat, imageLinear, outWidth, outHeight),
-            colors
-        );
-
-        vlog::print("Applying palette ({} colors)", [&](){return fmt::make_format_args(palette.size());});
-        imageLinear = image::expand(
-            image::palettize(imageLinear, palette),
-            palette
-        );
+    if (outputPng && !write_png("out-png", outputPng, result.width, result.height, preview.data())) {
+        return 1;
     }
 
-    if (!image::is_normal(major, minor)) {
-        vlog::print("Applying orientation {}", [&](){return fmt::make_format_args(args.get<std::string>("direction"));});
-        imageLinear = image::orientate(imageLinear, outWidth, outHeight, major, minor);
-        if (image::is_x_axis(minor)) {
-            std::swap(outWidth, outHeight);
+    if (outputPaletteGpl) {
+        vlog::print("Writing {}", [&](){return fmt::make_format_args(outputPaletteGpl);});
+        const auto span = trace::scope{"write palette"};
+        const auto data = palette::to_gpl(palette, 1.0f / settings.outGamma);
+        if (!outputs.write("out-palette-gpl", std::as_bytes(std::span{data}))) {
+            return 1;
         }
     }
 
-    if (outputPng) {
-        vlog::print("Writing {}", [&](){return fmt::make_format_args(outputPng);});
-        const auto imagePng = image::to_data(imageLinear, outWidth, outHeight, 1.0f / outGamma, png_pixel_format);
+    if (outputPalettePng) {
+        const auto span = trace::scope{"write palette"};
+        const auto palWidth = std::max(static_cast<int>(std::sqrt(palette.size())), 1);
+        const auto palHeight = static_cast<int>((palette.size() + (palWidth - 1)) / palWidth);
+        auto flat = image::buffer<float>{};
+        image::flatten(palette, palWidth, palHeight, flat);
 
-        const bool written = stbi_write_png(outputPng, outWidth, outHeight, png_components, imagePng.data(), outWidth * png_components);
-        if (!written) {
-            fmt::print(stderr, "Could not write file {}", outputPng);
+        auto packed = std::vector<stbi_uc>{};
+        image::to_data(flat, 1.0f / settings.outGamma, png_pixel_format, packed);
+        if (!write_png("out-palette-png", outputPalettePng, palWidth, palHeight, packed.data())) {
             return 1;
         }
     }
 
-    if (outputData) {
-        vlog::print("Writing {}", [&](){return fmt::make_format_args(outputData);});
-        const auto data = image::to_data(imageLinear, outWidth, outHeight, 1.0f / outGamma, colorFormat);
-
-        auto ofs = std::ofstream(outputData, std::ios::binary);
-        if (!ofs.is_open()) {
-            fmt::print(stderr, "Could not write file {}", outputData);
+    if (outputPaletteData) {
+        vlog::print("Writing {}", [&](){return fmt::make_format_args(outputPaletteData);});
+        const auto span = trace::scope{"write palette"};
+        if (!outputs.write("out-palette-data", std::span{paletteData}.first(result.paletteDataSize))) {
             return 1;
         }
+    }
+
+    return finish();
+}
+
+int bitmap(const std::vector<std::string>& arguments, std::span<const std::array<float, 4>> sharedPalette, image::decode_cache* decodeCache) {
+    return with_arguments(arguments, [&](ctopt::args::const_iterator begin, ctopt::args::const_iterator end) {
+        return bitmap(std::move(begin), std::move(end), sharedPalette, decodeCache);
+    });
+}
+
+int bitmap_histogram(ctopt::args::const_iterator begin, ctopt::args::const_iterator end, gfx2agb::color_histogram& histogram, gfx2agb::bitmap_options& settings) {
+    using namespace options;
+
+    const auto args = get_opts_bitmap(std::move(begin), std::move(end));
+    if (!args) {
+        vlog::error("{}\n", args.error_str());
+        return 1;
+    }
+
+    settings = to_options(args);
 
-        ofs.write(
-            reinterpret_cast<const char*>(data.data()),
-            static_cast<std::streamsize>(data.size())
-        );
-        ofs.close();
+    int inWidth, inHeight, components;
+    vlog::print("Counting colors of {}", [&](){return fmt::make_format_args(args.get<const char*>("in-image"));});
+    const auto image = image::load_shared(nullptr, args.get<const char*>("in-image"), inWidth, inHeight, components);
+    if (!image) {
+        vlog::error("Could not read image {}", args.get<std::string>("in-image"));
+        return 1;
     }
 
+    const auto imageBytes = std::size_t(inWidth) * std::size_t(inHeight) * png_components;
+    const auto result = gfx2agb::add_histogram({std::as_bytes(std::span{image.get(), imageBytes}), inWidth, inHeight}, settings, histogram);
+    if (!result) {
+        vlog::error("{}", result.error);
+        return 1;
+    }
     return 0;
 }
+
+int bitmap_histogram(const std::vector<std::string>& arguments, gfx2agb::color_histogram& histogram, gfx2agb::bitmap_options& settings) {
+    return with_arguments(arguments, [&](ctopt::args::const_iterator begin, ctopt::args::const_iterator end) {
+        return bitmap_histogram(std::move(begin), std::move(end), histogram, settings);
+    });
+}
@@ -0,0 +1,187 @@
+#include "cache.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <optional>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "logging.hpp"
+#include "output.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+    constexpr auto fnv_prime = std::uint64_t{0x100000001b3};
+
+    [[nodiscard]]
+    constexpr std::uint64_t mix(std::uint64_t x) noexcept {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccd;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53;
+        return x ^ (x >> 33);
+    }
+
+    struct entry_type {
+        fs::path path;
+        fs::file_time_type used;
+        std::uintmax_t bytes;
+    };
+
+}
+
+static std::uintmax_t entry_size(const fs::path& entry) noexcept;
+static std::string temporary_name(std::string_view key);
+
+void cache::hasher::update(std::span<const std::byte> bytes) noexcept {
+    auto lane0 = m_lanes[0];
+    auto lane1 = m_lanes[1];
+    for (const auto b : bytes) {
+        lane0 = (lane0 ^ std::uint64_t(b)) * fnv_prime;
+        lane1 = (lane1 ^ (std::uint64_t(b) + 0x9e)) * fnv_prime;
+    }
+    m_lanes[0] = lane0;
+    m_lanes[1] = lane1;
+}
+
+void cache::hasher::update(std::string_view str) noexcept {
+    update(std::as_bytes(std::span{str}));
+    static constexpr auto terminator = std::array{std::byte{}};
+    update(terminator); // So consecutive strings can't run together
+}
+
+bool cache::hasher::update_file(const char* path) noexcept {
+    auto ifs = std::ifstream(path, std::ios::binary);
+    if (!ifs.is_open()) {
+        return false;
+    }
+
+    auto buffer = std::array<char, 64 * 1024>{};
+    auto total = std::uint64_t{};
+    while (ifs) {
+        ifs.read(buffer.data(), buffer.size());
+        const auto count = static_cast<std::size_t>(ifs.gcount());
+        update(std::as_bytes(std::span{buffer.data(), count}));
+        total += count;
+    }
+    update(fmt::format("{}", total));
+    return !ifs.bad();
+}
+
+std::string cache::hasher::digest() const noexcept {
+    const auto high = mix(m_lanes[0] ^ mix(m_lanes[1]));
+    const auto low = mix(m_lanes[1] ^ high);
+    return fmt::format("{:016x}{:016x}", high, low);
+}
+
+bool cache::restore(const fs::path& dir, std::string_view key, std::span<const output_type> outputs) noexcept {
+    const auto entry = dir / key;
+
+    auto ec = std::error_code{};
+    if (!fs::is_directory(entry, ec)) {
+        vlog::print("Cache miss {}", [&](){return fmt::make_format_args(key);});
+        return false;
+    }
+
+    // Each output is read into a temporary file beside its path, then all are renamed into place together as a conversion's are
+    auto plan = output::plan{};
+    for (const auto& [name, path] : outputs) {
+        const auto source = entry / name;
+        const auto size = fs::file_size(source, ec);
+        auto ifs = std::ifstream(source, std::ios::binary);
+        const auto data = !ec && ifs.is_open() && plan.add(name, path) ? plan.map(name, std::size_t(size)) : std::nullopt;
+        if (!data || !ifs.read(reinterpret_cast<char*>(data->data()), static_cast<std::streamsize>(data->size()))) {
+            vlog::print("Cache miss {} (could not restore {})", [&](){return fmt::make_format_args(key, path);});
+            return false;
+        }
+    }
+
+    if (!plan.commit()) {
+        return false;
+    }
+
+    fs::last_write_time(entry, fs::file_time_type::clock::now(), ec); // Mark as recently used
+    vlog::print("Cache hit {}", [&](){return fmt::make_format_args(key);});
+    return true;
+}
+
+void cache::store(const fs::path& dir, std::string_view key, std::span<const output_type> outputs, std::uintmax_t maxBytes) noexcept {
+    auto ec = std::error_code{};
+    fs::create_directories(dir, ec);
+
+    // Assemble the entry beside its final name, then rename it into place so readers never see part of one
+    const auto temporary = dir / temporary_name(key);
+    fs::create_directory(temporary, ec);
+    if (ec) {
+        fmt::print(stderr, "Could not write cache entry {}: {}\n", temporary.string(), ec.message());
+        return;
+    }
+
+    for (const auto& [name, path] : outputs) {
+        if (!fs::copy_file(path, temporary / name, ec)) {
+            fmt::print(stderr, "Could not cache {}: {}\n", path, ec.message());
+            fs::remove_all(temporary, ec);
+            return;
+        }
+    }
+
+    fs::rename(temporary, dir / key, ec);
+    if (ec) { // Another process stored it first
+        fs::remove_all(temporary, ec);
+    }
+
+    auto entries = std::vector<entry_type>{};
+    auto totalBytes = std::uintmax_t{};
+    for (const auto& item : fs::directory_iterator(dir, ec)) {
+        if (!item.is_directory(ec) || item.path().filename().string().find('.') != std::string::npos) {
+            continue; // Skip anything that isn't a finished entry
+        }
+
+        const auto bytes = entry_size(item.path());
+        entries.push_back({item.path(), item.last_write_time(ec), bytes});
+        totalBytes += bytes;
+    }
+
+    std::ranges::sort(entries, {}, &entry_type::used);
+
+    auto evicted = std::size_t{};
+    for (const auto& entry : entries) {
+        if (totalBytes <= maxBytes) {
+            break;
+        }
+        if (fs::remove_all(entry.path, ec) != static_cast<std::uintmax_t>(-1)) {
+            totalBytes -= entry.bytes;
+            ++evicted;
+        }
+    }
+
+    vlog::print("Cache stored {} ({} entries, {:.1f} MiB, {} evicted)", [&](){return fmt::make_format_args(key, entries.size() - evicted, double(totalBytes) / (1024.0 * 1024.0), evicted);});
+}
+
+static std::uintmax_t entry_size(const fs::path& entry) noexcept {
+    auto ec = std::error_code{};
+    auto bytes = std::uintmax_t{};
+    for (const auto& item : fs::directory_iterator(entry, ec)) {
+        const auto size = item.file_size(ec);
+        if (!ec) {
+            bytes += size;
+        }
+    }
+    return bytes;
+}
+
+static std::string temporary_name(std::string_view key) {
+    static auto counter = std::atomic<std::size_t>{};
+
+    const auto thread = std::hash<std::thread::id>{}(std::this_thread::get_id());
+    const auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+    return fmt::format("{}.tmp-{:x}-{:x}-{}", key, thread, now, counter++);
+}
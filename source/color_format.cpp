@@ -10,9 +10,14 @@
 using gathered_components_type = std::pair<std::vector<char>, std::size_t>;
 
 static gathered_components_type gather_components(std::string_view::iterator& begin, std::string_view::const_iterator end) noexcept;
-static void print_duplicate(const std::vector<color_format::component_type>& components, auto index) noexcept;
+static std::string describe_duplicate(const std::vector<color_format::component_type>& components, auto index) noexcept;
 
 std::vector<color_format::component_type> color_format::parse(std::string_view sv) noexcept {
+    auto error = std::string{};
+    return parse(sv, error);
+}
+
+std::vector<color_format::component_type> color_format::parse(std::string_view sv, std::string& error) noexcept {
     std::vector<component_type> result;
     result.reserve(4);
     std::size_t totalSize{};
@@ -31,7 +36,7 @@ std::vector<color_format::component_type> color_format::parse(std::string_view s
         return lhs.channel == rhs.channel;
     });
     if (dup != result.cend()) {
-        print_duplicate(result, std::distance(result.cbegin(), dup));
+        error = describe_duplicate(result, std::distance(result.cbegin(), dup));
         return {};
     }
 
@@ -62,13 +67,13 @@ static gathered_components_type gather_components(std::string_view::iterator& be
     return std::make_pair(components, size);
 }
 
-static void print_duplicate(const std::vector<color_format::component_type>& components, auto index) noexcept {
+static std::string describe_duplicate(const std::vector<color_format::component_type>& components, auto index) noexcept {
     const auto componentString = std::accumulate(components.cbegin(), components.cend(), std::string(), [](auto acc, const auto& c) {
         acc += c.channel;
         return acc;
     });
 
-    fmt::print(stderr, "Encountered duplicate channel {}>{}<{}\n",
+    return fmt::format("duplicate channel {}>{}<{}",
         componentString.substr(0, index),
         componentString.substr(index, 1),
         componentString.substr(index + 1)
@@ -0,0 +1,462 @@
+#include "compress.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <queue>
+#include <utility>
+
+namespace {
+
+    constexpr auto lz77_type = std::byte{0x10};
+    constexpr auto huffman_type = std::byte{0x20};
+    constexpr auto rle_type = std::byte{0x30};
+
+    constexpr auto min_match = std::size_t{3};
+    constexpr auto max_match = std::size_t{18};
+    constexpr auto window_size = std::size_t{4096};
+
+    constexpr auto hash_bits = 15;
+    constexpr auto greedy_chain = std::size_t{128}; // Candidates tried per position, all of the window when optimal
+
+    constexpr auto min_run = std::size_t{3};
+    constexpr auto max_run = std::size_t{130};
+    constexpr auto max_literals = std::size_t{128};
+
+    constexpr auto max_tree_offset = std::size_t{63}; // Bits of a Huffman node's offset to its children
+
+    [[nodiscard]]
+    std::size_t hash3(const std::byte* data) noexcept {
+        const auto value = (std::uint32_t(data[0]) << 16) | (std::uint32_t(data[1]) << 8) | std::uint32_t(data[2]);
+        return std::size_t((value * 0x9e3779b1u) >> (32 - hash_bits));
+    }
+
+    [[nodiscard]]
+    std::size_t round_up4(std::size_t size) noexcept {
+        return (size + 3) & ~std::size_t{3};
+    }
+
+    struct huffman_node {
+        std::size_t count;
+        int children[2]; // -1 for a leaf
+        std::uint8_t symbol;
+    };
+
+}
+
+std::optional<compress::method> compress::parse_method(std::string_view name) noexcept {
+    if (name == "lz77") {
+        return method::lz77;
+    } else if (name == "lz77-vram") {
+        return method::lz77_vram;
+    } else if (name == "rle") {
+        return method::rle;
+    } else if (name == "huff4") {
+        return method::huff4;
+    } else if (name == "huff8") {
+        return method::huff8;
+    }
+    return std::nullopt;
+}
+
+std::size_t compress::max_size(method m, std::size_t size) noexcept {
+    switch (m) {
+        case method::lz77:
+        case method::lz77_vram: // Every byte a literal, a flag byte per 8
+            return round_up4(4 + size + ((size + 7) / 8));
+        case method::rle: // Every byte a literal, a flag byte per 128
+            return round_up4(4 + size + ((size + max_literals - 1) / max_literals));
+        case method::huff4:
+        case method::huff8: { // A Huffman code averages under a bit more than the unit, the tree has at most 256 leaves
+            const auto bits = m == method::huff4 ? 4 : 8;
+            const auto units = (size * 8) / std::size_t(bits);
+            const auto codeBits = units * std::size_t(bits + 1);
+            return 4 + 512 + (((codeBits + 31) / 32) * 4);
+        }
+    }
+    return size;
+}
+
+compress::encoder::encoder(method m, bool optimal) noexcept : m_method{m}, m_optimal{optimal} {
+    m_output.resize(4); // Header, written by finish
+    if (m_method == method::lz77 || m_method == method::lz77_vram) {
+        m_head.assign(std::size_t{1} << hash_bits, 0);
+    }
+}
+
+void compress::encoder::append(std::span<const std::byte> data) noexcept {
+    m_input.insert(m_input.cend(), data.begin(), data.end());
+
+    switch (m_method) {
+        case method::lz77:
+        case method::lz77_vram:
+            // A match can run up to max_match bytes ahead, so stop short of the end until more input arrives
+            if (!m_optimal && m_input.size() > max_match) {
+                lz77_encode(m_input.size() - max_match);
+            }
+            break;
+        case method::rle:
+            if (m_input.size() > max_run) {
+                rle_encode(m_input.size() - max_run);
+            }
+            break;
+        case method::huff4:
+            for (const auto byte : data) {
+                ++m_counts[std::size_t(byte) & 0xf];
+                ++m_counts[std::size_t(byte) >> 4];
+            }
+            break;
+        case method::huff8:
+            for (const auto byte : data) {
+                ++m_counts[std::size_t(byte)];
+            }
+            break;
+    }
+}
+
+std::optional<std::vector<std::byte>> compress::encoder::finish() noexcept {
+    if (m_input.size() > max_input_size) {
+        return std::nullopt;
+    }
+
+    auto type = std::byte{};
+    switch (m_method) {
+        case method::lz77:
+        case method::lz77_vram:
+            type = lz77_type;
+            if (m_optimal) {
+                lz77_optimal();
+            } else {
+                lz77_encode(m_input.size());
+            }
+            break;
+        case method::rle:
+            type = rle_type;
+            rle_encode(m_input.size());
+            rle_flush();
+            break;
+        case method::huff4:
+        case method::huff8:
+            type = huffman_type | std::byte(m_method == method::huff4 ? 4 : 8);
+            if (!huffman_encode()) {
+                return std::nullopt;
+            }
+            break;
+    }
+
+    m_output[0] = type;
+    m_output[1] = std::byte(m_input.size() & 0xff);
+    m_output[2] = std::byte((m_input.size() >> 8) & 0xff);
+    m_output[3] = std::byte((m_input.size() >> 16) & 0xff);
+    m_output.resize(round_up4(m_output.size()));
+    return std::move(m_output);
+}
+
+// Longest earlier match at pos as (length, distance), following the hash chain through at most maxChain candidates
+std::pair<std::size_t, std::size_t> compress::encoder::lz77_match(std::size_t pos, std::size_t maxChain) noexcept {
+    const auto size = m_input.size();
+    const auto* data = m_input.data();
+
+    // Chain every earlier position that has 3 bytes to hash
+    m_previous.resize(size);
+    for (; m_hashed < pos && m_hashed + min_match <= size; ++m_hashed) {
+        auto& head = m_head[hash3(data + m_hashed)];
+        m_previous[m_hashed] = head;
+        head = std::uint32_t(m_hashed + 1);
+    }
+
+    const auto limit = std::min(max_match, size - pos);
+    if (limit < min_match) {
+        return {0, 0};
+    }
+
+    // VRAM is written 16 bits at a time, so the byte before pos may not be there to copy yet
+    const auto minDistance = m_method == method::lz77_vram ? std::size_t{2} : std::size_t{1};
+
+    auto best = std::pair<std::size_t, std::size_t>{0, 0};
+    auto candidate = m_head[hash3(data + pos)];
+    for (auto chain = std::size_t{}; candidate && chain < maxChain; ++chain, candidate = m_previous[candidate - 1]) {
+        const auto from = std::size_t(candidate - 1);
+        const auto distance = pos - from;
+        if (distance > window_size) {
+            break;
+        }
+        if (distance < minDistance) {
+            continue;
+        }
+
+        auto length = std::size_t{};
+        while (length < limit && data[from + length] == data[pos + length]) {
+            ++length;
+        }
+        if (length > best.first) {
+            best = {length, distance};
+            if (length == limit) {
+                break;
+            }
+        }
+    }
+
+    if (best.first < min_match) {
+        return {0, 0};
+    }
+    return best;
+}
+
+// Appends a match of length at distance, or a literal when length is below min_match
+void compress::encoder::lz77_token(std::size_t length, std::size_t distance) noexcept {
+    if (!m_tokens) {
+        m_flags = m_output.size();
+        m_output.emplace_back();
+    }
+
+    if (length >= min_match) {
+        m_output[m_flags] |= std::byte(0x80 >> m_tokens);
+        m_output.emplace_back(std::byte(((length - min_match) << 4) | ((distance - 1) >> 8)));
+        m_output.emplace_back(std::byte((distance - 1) & 0xff));
+        m_encoded += length;
+    } else {
+        m_output.emplace_back(m_input[m_encoded++]);
+    }
+
+    m_tokens = (m_tokens + 1) % 8;
+}
+
+void compress::encoder::lz77_encode(std::size_t end) noexcept {
+    while (m_encoded < end) {
+        const auto [length, distance] = lz77_match(m_encoded, greedy_chain);
+        lz77_token(length, distance);
+    }
+}
+
+// Cheapest sequence of tokens by bits: a literal is a flag and a byte, a match a flag and two bytes
+void compress::encoder::lz77_optimal() noexcept {
+    static constexpr auto literal_bits = std::size_t{9};
+    static constexpr auto match_bits = std::size_t{17};
+
+    const auto begin = m_encoded;
+    const auto count = m_input.size() - begin;
+
+    auto matches = std::vector<std::pair<std::size_t, std::size_t>>(count);
+    for (auto ii = std::size_t{}; ii < count; ++ii) {
+        matches[ii] = lz77_match(begin + ii, window_size);
+    }
+
+    // Any prefix of the longest match is also a match, at the same distance
+    auto cost = std::vector<std::size_t>(count + 1);
+    auto step = std::vector<std::size_t>(count);
+    for (auto ii = count; ii-- > 0;) {
+        cost[ii] = cost[ii + 1] + literal_bits;
+        step[ii] = 1;
+        for (auto length = min_match; length <= matches[ii].first; ++length) {
+            if (cost[ii + length] + match_bits < cost[ii]) {
+                cost[ii] = cost[ii + length] + match_bits;
+                step[ii] = length;
+            }
+        }
+    }
+
+    while (m_encoded < m_input.size()) {
+        const auto ii = m_encoded - begin;
+        lz77_token(step[ii], matches[ii].second);
+    }
+}
+
+void compress::encoder::rle_encode(std::size_t end) noexcept {
+    const auto size = m_input.size();
+    while (m_encoded < end) {
+        const auto value = m_input[m_encoded];
+        const auto limit = std::min(max_run, size - m_encoded);
+
+        auto run = std::size_t{1};
+        while (run < limit && m_input[m_encoded + run] == value) {
+            ++run;
+        }
+
+        if (run >= min_run) {
+            rle_flush();
+            m_output.emplace_back(std::byte(0x80 | (run - min_run)));
+            m_output.emplace_back(value);
+            m_encoded += run;
+            m_literalBegin = m_encoded;
+        } else if (++m_encoded - m_literalBegin == max_literals) {
+            rle_flush();
+        }
+    }
+}
+
+// Writes the bytes since the last run as literal blocks
+void compress::encoder::rle_flush() noexcept {
+    while (m_literalBegin < m_encoded) {
+        const auto count = std::min(max_literals, m_encoded - m_literalBegin);
+        m_output.emplace_back(std::byte(count - 1));
+        m_output.insert(m_output.cend(), m_input.cbegin() + std::ptrdiff_t(m_literalBegin), m_input.cbegin() + std::ptrdiff_t(m_literalBegin + count));
+        m_literalBegin += count;
+    }
+}
+
+bool compress::encoder::huffman_encode() noexcept {
+    const auto bits = m_method == method::huff4 ? 4 : 8;
+    const auto symbols = std::size_t{1} << bits;
+
+    // Leaves of every unit that occurs, and enough unused ones for a tree of at least two
+    auto nodes = std::vector<huffman_node>{};
+    for (auto symbol = std::size_t{}; symbol < symbols; ++symbol) {
+        if (m_counts[symbol]) {
+            nodes.push_back({m_counts[symbol], {-1, -1}, std::uint8_t(symbol)});
+        }
+    }
+    for (auto symbol = std::size_t{}; nodes.size() < 2; ++symbol) {
+        if (!m_counts[symbol]) {
+            nodes.push_back({0, {-1, -1}, std::uint8_t(symbol)});
+        }
+    }
+
+    const auto heavier = [&nodes](int lhs, int rhs) {
+        return nodes[std::size_t(lhs)].count > nodes[std::size_t(rhs)].count;
+    };
+    auto queue = std::priority_queue<int, std::vector<int>, decltype(heavier)>{heavier};
+    for (auto ii = std::size_t{}; ii < nodes.size(); ++ii) {
+        queue.push(int(ii));
+    }
+    while (queue.size() > 1) {
+        const auto first = queue.top();
+        queue.pop();
+        const auto second = queue.top();
+        queue.pop();
+        nodes.push_back({nodes[std::size_t(first)].count + nodes[std::size_t(second)].count, {first, second}, 0});
+        queue.push(int(nodes.size() - 1));
+    }
+    const auto root = queue.top();
+
+    const auto is_leaf = [&nodes](int node) {
+        return nodes[std::size_t(node)].children[0] < 0;
+    };
+
+    // Table byte 0 holds its size, the root is byte 1, and each pair of children sits at bytes 2n and 2n+1
+    // A node's children must be within max_tree_offset pairs after its own, so rather than breadth first,
+    // subtrees are laid out depth first while every waiting node can still reach its children in time
+    struct waiting_type {
+        int node;
+        std::size_t index; // Table byte of the node
+        std::size_t deadline; // Last pair its children may take
+    };
+    auto table = std::vector<std::uint8_t>(2);
+    auto waiting = std::vector<waiting_type>{};
+    auto codes = std::vector<std::pair<std::uint64_t, int>>(symbols); // Code, length in bits
+    auto paths = std::vector<std::pair<std::uint64_t, int>>(nodes.size());
+
+    if (!is_leaf(root)) {
+        waiting.push_back({root, 1, max_tree_offset + 1});
+    }
+
+    const auto fits = [&](std::size_t taken, std::size_t next) {
+        auto deadlines = std::vector<std::size_t>{};
+        deadlines.reserve(waiting.size() + 2);
+        for (auto ii = std::size_t{}; ii < waiting.size(); ++ii) {
+            if (ii != taken) {
+                deadlines.push_back(waiting[ii].deadline);
+            }
+        }
+        const auto& node = nodes[std::size_t(waiting[taken].node)];
+        for (const auto child : node.children) {
+            if (!is_leaf(child)) {
+                deadlines.push_back(next + max_tree_offset + 1);
+            }
+        }
+        std::ranges::sort(deadlines);
+        for (auto ii = std::size_t{}; ii < deadlines.size(); ++ii) {
+            if (next + 1 + ii > deadlines[ii]) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    for (auto next = std::size_t{1}; !waiting.empty(); ++next) {
+        // Deepest waiting node if that leaves time for the rest, else the one due soonest
+        auto taken = waiting.size() - 1;
+        if (!fits(taken, next)) {
+            taken = std::size_t(std::ranges::min_element(waiting, {}, &waiting_type::deadline) - waiting.cbegin());
+            if (next > waiting[taken].deadline) {
+                return false; // Not reached for trees of up to 256 leaves, but a broken tree must not be written
+            }
+        }
+
+        const auto parent = waiting[taken];
+        waiting.erase(waiting.cbegin() + std::ptrdiff_t(taken));
+
+        const auto& node = nodes[std::size_t(parent.node)];
+        auto flags = std::uint8_t(next - (parent.index / 2) - 1);
+        table.resize(2 * (next + 1));
+        for (auto side = 0; side < 2; ++side) {
+            const auto child = node.children[side];
+            const auto [code, length] = paths[std::size_t(parent.node)];
+            paths[std::size_t(child)] = {(code << 1) | std::uint64_t(side), length + 1};
+
+            if (is_leaf(child)) {
+                flags |= std::uint8_t(0x80 >> side);
+                table[(2 * next) + std::size_t(side)] = nodes[std::size_t(child)].symbol;
+                codes[nodes[std::size_t(child)].symbol] = paths[std::size_t(child)];
+            } else {
+                waiting.push_back({child, (2 * next) + std::size_t(side), next + max_tree_offset + 1});
+            }
+        }
+        table[parent.index] = flags;
+    }
+
+    table.resize(round_up4(table.size()));
+    table[0] = std::uint8_t((table.size() / 2) - 1);
+    for (const auto byte : table) {
+        m_output.emplace_back(std::byte(byte));
+    }
+
+    // Codes fill 32-bit little-endian words from bit 31 down, 4-bit units in a byte low nibble first
+    auto word = std::uint32_t{};
+    auto used = 0;
+    const auto put = [&](std::size_t symbol) {
+        const auto [code, length] = codes[symbol];
+        for (auto bit = length; bit-- > 0;) {
+            word |= std::uint32_t((code >> bit) & 1) << (31 - used);
+            if (++used == 32) {
+                for (auto shift = 0; shift < 32; shift += 8) {
+                    m_output.emplace_back(std::byte((word >> shift) & 0xff));
+                }
+                word = 0;
+                used = 0;
+            }
+        }
+    };
+    for (const auto byte : m_input) {
+        if (bits == 4) {
+            put(std::size_t(byte) & 0xf);
+            put(std::size_t(byte) >> 4);
+        } else {
+            put(std::size_t(byte));
+        }
+    }
+    if (used) {
+        for (auto shift = 0; shift < 32; shift += 8) {
+            m_output.emplace_back(std::byte((word >> shift) & 0xff));
+        }
+    }
+    m_encoded = m_input.size();
+    return true;
+}
+
+std::optional<std::vector<std::byte>> compress::lz77(std::span<const std::byte> data, bool vram, bool optimal) noexcept {
+    auto stream = encoder{vram ? method::lz77_vram : method::lz77, optimal};
+    stream.append(data);
+    return stream.finish();
+}
+
+std::optional<std::vector<std::byte>> compress::rle(std::span<const std::byte> data) noexcept {
+    auto stream = encoder{method::rle, false};
+    stream.append(data);
+    return stream.finish();
+}
+
+std::optional<std::vector<std::byte>> compress::huffman(std::span<const std::byte> data, int bits) noexcept {
+    auto stream = encoder{bits == 4 ? method::huff4 : method::huff8, false};
+    stream.append(data);
+    return stream.finish();
+}
@@ -0,0 +1,90 @@
+#include "decode_cache.hpp"
+
+#include <algorithm>
+#include <string_view>
+#include <system_error>
+
+#include <fmt/format.h>
+
+#include "image_io.hpp"
+#include "logging.hpp"
+
+namespace {
+
+    constexpr auto rgba_channels = 4;
+
+    [[nodiscard]]
+    image::shared_pixels decode(const char* filename, int& width, int& height, int& channels) noexcept {
+        auto pixels = image::load(filename, width, height, channels);
+        if (!pixels) {
+            return {};
+        }
+        return image::shared_pixels{pixels.release(), stbi_image_free};
+    }
+
+}
+
+image::shared_pixels image::decode_cache::load(const char* filename, int& width, int& height, int& channels) noexcept {
+    auto ec = std::error_code{};
+    const auto modified = std::filesystem::last_write_time(filename, ec);
+    const auto fileSize = ec ? 0 : std::filesystem::file_size(filename, ec);
+    if (ec) { // Let stb_image report it
+        return decode(filename, width, height, channels);
+    }
+
+    {
+        const auto lock = std::scoped_lock{m_mutex};
+        const auto it = std::ranges::find(m_entries, std::string_view{filename}, &entry_type::path);
+        if (it != m_entries.end()) {
+            if (it->modified == modified && it->fileSize == fileSize) {
+                m_entries.splice(m_entries.begin(), m_entries, it);
+                width = it->width;
+                height = it->height;
+                channels = it->channels;
+                ++m_hits;
+                vlog::print("Decoded {} from memory ({} hits, {} misses)", [&](){return fmt::make_format_args(filename, m_hits, m_misses);});
+                return it->pixels;
+            }
+
+            // Changed on disk
+            m_bytes -= std::size_t(it->width) * std::size_t(it->height) * rgba_channels;
+            m_entries.erase(it);
+        }
+        ++m_misses;
+    }
+
+    auto pixels = decode(filename, width, height, channels);
+    if (!pixels) {
+        return pixels;
+    }
+
+    const auto bytes = std::size_t(width) * std::size_t(height) * rgba_channels;
+    if (bytes > m_maxBytes) {
+        return pixels;
+    }
+
+    const auto lock = std::scoped_lock{m_mutex};
+    const auto it = std::ranges::find(m_entries, std::string_view{filename}, &entry_type::path);
+    if (it != m_entries.end()) { // Decoded concurrently by another conversion
+        m_bytes -= std::size_t(it->width) * std::size_t(it->height) * rgba_channels;
+        m_entries.erase(it);
+    }
+
+    m_entries.push_front({filename, modified, fileSize, width, height, channels, pixels});
+    m_bytes += bytes;
+
+    while (m_bytes > m_maxBytes) { // Evict least recently used
+        const auto& last = m_entries.back();
+        m_bytes -= std::size_t(last.width) * std::size_t(last.height) * rgba_channels;
+        m_entries.pop_back();
+    }
+
+    return pixels;
+}
+
+image::shared_pixels image::load_shared(decode_cache* cache, const char* filename, int& width, int& height, int& channels) noexcept {
+    if (cache) {
+        return cache->load(filename, width, height, channels);
+    }
+    return decode(filename, width, height, channels);
+}
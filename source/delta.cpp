@@ -0,0 +1,148 @@
+#include "delta.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+    constexpr auto word_bytes = std::size_t{4};
+
+    // A span costs a word of header and a DMA setup, so gaps of up to this many unchanged words are copied rather than split
+    constexpr auto span_merge_gap = std::size_t{2};
+
+    [[nodiscard]]
+    std::size_t word_count(std::span<const std::byte> frame) noexcept {
+        return (frame.size() + word_bytes - 1) / word_bytes;
+    }
+
+    // Word index of frame, zero past its end
+    [[nodiscard]]
+    std::uint32_t load_word(std::span<const std::byte> frame, std::size_t index) noexcept {
+        auto word = std::uint32_t{};
+        const auto offset = index * word_bytes;
+        if (offset < frame.size()) {
+            std::memcpy(&word, frame.data() + offset, std::min(word_bytes, frame.size() - offset));
+        }
+        return word;
+    }
+
+    void put_u16(std::vector<std::byte>& out, std::size_t value) noexcept {
+        out.push_back(std::byte(value & 0xff));
+        out.push_back(std::byte((value >> 8) & 0xff));
+    }
+
+    void put_words(std::vector<std::byte>& out, std::span<const std::byte> frame, std::size_t begin, std::size_t end) noexcept {
+        const auto offset = out.size();
+        out.resize(offset + ((end - begin) * word_bytes));
+        for (auto ii = begin; ii < end; ++ii) {
+            const auto word = load_word(frame, ii);
+            std::memcpy(out.data() + offset + ((ii - begin) * word_bytes), &word, word_bytes);
+        }
+    }
+
+    // Sets the count of a record's u16 header
+    void set_count(std::vector<std::byte>& record, std::size_t count) noexcept {
+        record[0] = std::byte(count & 0xff);
+        record[1] = std::byte((count >> 8) & 0xff);
+    }
+
+}
+
+std::optional<delta::granularity> delta::parse_granularity(std::string_view name) noexcept {
+    if (name == "word") {
+        return granularity::word;
+    } else if (name == "scanline") {
+        return granularity::scanline;
+    }
+    return std::nullopt;
+}
+
+delta::frame_type delta::encode(std::span<const std::byte> previous, std::span<const std::byte> next, granularity g, std::size_t rowBytes) noexcept {
+    const auto words = word_count(next);
+    const auto keyframe = previous.empty();
+    const auto changed = [&](std::size_t index) {
+        return keyframe || load_word(previous, index) != load_word(next, index);
+    };
+
+    auto frame = frame_type{};
+    frame.record.resize(word_bytes); // Count, written once known
+    auto count = std::size_t{};
+
+    if (g == granularity::word) {
+        for (auto ii = std::size_t{}; ii < words;) {
+            if (!changed(ii)) {
+                ++ii;
+                continue;
+            }
+
+            auto end = ii + 1;
+            for (auto jj = end; jj < words && jj - ii < max_frame_words; ++jj) {
+                if (changed(jj)) {
+                    end = jj + 1;
+                } else if (jj + 1 - end > span_merge_gap) {
+                    break;
+                }
+            }
+
+            put_u16(frame.record, ii);
+            put_u16(frame.record, end - ii);
+            put_words(frame.record, next, ii, end);
+            frame.copied += (end - ii) * word_bytes;
+            ++frame.transfers;
+            ++count;
+            ii = end;
+        }
+    } else {
+        const auto rowWords = std::max(rowBytes / word_bytes, std::size_t{1});
+        const auto rows = words / rowWords;
+
+        // Changed words [first, second) of a row, empty if the row is unchanged
+        const auto changed_range = [&](std::size_t row) {
+            auto first = rowWords;
+            auto last = std::size_t{};
+            for (auto xx = std::size_t{}; xx < rowWords; ++xx) {
+                if (changed((row * rowWords) + xx)) {
+                    first = std::min(first, xx);
+                    last = xx + 1;
+                }
+            }
+            return std::make_pair(first, last);
+        };
+
+        for (auto yy = std::size_t{}; yy < rows;) {
+            auto [first, last] = changed_range(yy);
+            if (first >= last) {
+                ++yy;
+                continue;
+            }
+
+            // Consecutive changed rows share one rectangle of their widest changes
+            auto end = yy + 1;
+            for (; end < rows; ++end) {
+                const auto [rowFirst, rowLast] = changed_range(end);
+                if (rowFirst >= rowLast) {
+                    break;
+                }
+                first = std::min(first, rowFirst);
+                last = std::max(last, rowLast);
+            }
+
+            put_u16(frame.record, first);
+            put_u16(frame.record, yy);
+            put_u16(frame.record, last - first);
+            put_u16(frame.record, end - yy);
+            for (auto row = yy; row < end; ++row) {
+                put_words(frame.record, next, (row * rowWords) + first, (row * rowWords) + last);
+            }
+            frame.copied += (last - first) * (end - yy) * word_bytes;
+            frame.transfers += last - first == rowWords ? 1 : end - yy; // Whole rows are contiguous
+            ++count;
+            yy = end;
+        }
+    }
+
+    set_count(frame.record, count);
+    return frame;
+}
@@ -0,0 +1,774 @@
+#include "gfx2agb.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "color_format.hpp"
+#include "compress.hpp"
+#include "image_io.hpp"
+#include "logging.hpp"
+#include "palette.hpp"
+#include "trace.hpp"
+#include "util.hpp"
+
+namespace {
+
+    constexpr auto rgba_components = 4;
+
+    const auto preview_format = color_format::parse("ABGR8");
+
+    // Options parsed into the forms the stages take
+    struct settings_type {
+        std::vector<color_format::component_type> colorFormat;
+        palette::quantizer quantizer;
+        resample::filter filter;
+        image::direction major;
+        image::direction minor;
+        std::optional<compress::method> compression;
+        int outWidth; // Before direction
+        int outHeight;
+        std::optional<std::vector<std::array<float, 4>>> palette; // options.palette, once loaded to count a mode 4 palette
+    };
+
+    // Output rows per band for the working set of a band to fit in budget, and that working set in bytes
+    // A multiple of 8, so each band of packed indices ends on a whole byte, which can exceed budget when even 8 rows don't fit
+    int band_rows(std::size_t budget, std::size_t fixedBytes, int inWidth, int inHeight, int outWidth, int outHeight, std::size_t& workingSet) noexcept {
+        static constexpr auto linear_pixel = sizeof(float) * rgba_components;
+        static constexpr auto min_rows = std::size_t{8};
+
+        const auto scale = double(inHeight) / double(outHeight);
+        const auto inRow = std::size_t(inWidth) * linear_pixel;
+
+        // Linear source rows including the resize margin, then the band itself, its indices, expanded and packed copies
+        const auto marginBytes = std::size_t(2 * (std::ceil(2.0 * std::max(scale, 1.0)) + 2)) * inRow;
+        const auto rowBytes = std::size_t(std::ceil(scale) * double(inRow)) +
+            (std::size_t(outWidth) * ((linear_pixel * 2) + sizeof(std::size_t) + rgba_components));
+
+        const auto used = fixedBytes + marginBytes;
+        const auto rows = budget > used ? (budget - used) / rowBytes : 0;
+        const auto result = std::min(std::max(rows - (rows % min_rows), min_rows), std::size_t(outHeight));
+        workingSet = used + (result * rowBytes);
+        return int(result);
+    }
+
+    // Next size bytes of out
+    std::span<stbi_uc> take(std::span<stbi_uc>& out, std::size_t size) noexcept {
+        const auto result = out.first(size);
+        out = out.subspan(size);
+        return result;
+    }
+
+    // Oriented rows per pass of a transpose, a multiple of 8 so each pass of packed indices ends on a whole byte
+    constexpr auto oriented_band_rows = 64;
+
+    // Calls func with image in the order major then minor walks it
+    // Flips happen in place, transposes a band of rows at a time into scratch, so no whole oriented copy is made
+    template <typename T>
+    void for_each_oriented_band(image::buffer<T>& image, image::direction major, image::direction minor, const std::string& direction, image::buffer<T>& scratch, auto func) {
+        if (image::is_normal(major, minor)) {
+            func(image);
+            return;
+        }
+
+        vlog::print("Applying orientation {}", [&](){return fmt::make_format_args(direction);});
+        if (image::is_x_axis(major)) {
+            {
+                const auto span = trace::scope{"orientate"};
+                trace::count("pixels", image.pixel_count());
+                image::orientate_in_place(image, major, minor, scratch);
+            }
+            func(image);
+            return;
+        }
+
+        for (auto rowBegin = 0; rowBegin < image.width; rowBegin += oriented_band_rows) {
+            {
+                const auto span = trace::scope{"orientate"};
+                image::orientate_rows(image, major, minor, rowBegin, std::min(rowBegin + oriented_band_rows, image.width), scratch);
+                trace::count("pixels", scratch.pixel_count());
+            }
+            func(scratch);
+        }
+    }
+
+    // Compresses an output as it is packed, timing the compressor alone
+    class compressed_output {
+    public:
+        compressed_output(compress::method m, bool optimal) noexcept : m_encoder{m, optimal} {}
+
+        void append(std::span<const std::byte> data) noexcept {
+            const auto span = trace::scope{"compress"};
+            trace::count("bytes in", data.size());
+            const auto start = std::chrono::steady_clock::now();
+            m_encoder.append(data);
+            m_inBytes += data.size();
+            m_elapsed += std::chrono::steady_clock::now() - start;
+        }
+
+        // Copies the stream into out, returning its size, nullopt if the encoder failed
+        std::optional<std::size_t> finish(std::string_view name, std::span<std::byte> out) noexcept {
+            const auto stream = [&]() {
+                const auto span = trace::scope{"compress"};
+                const auto start = std::chrono::steady_clock::now();
+                auto result = m_encoder.finish();
+                m_elapsed += std::chrono::steady_clock::now() - start;
+                if (result) {
+                    trace::count("bytes out", result->size());
+                }
+                return result;
+            }();
+            if (!stream) {
+                return std::nullopt;
+            }
+
+            vlog::print("Compressed {} from {} to {} bytes ({:.1f}%) in {:.2f} ms", [&](){return fmt::make_format_args(
+                name, m_inBytes, stream->size(), 100.0 * double(stream->size()) / double(std::max(m_inBytes, std::size_t{1})),
+                std::chrono::duration<double, std::milli>(m_elapsed).count()
+            );});
+            std::ranges::copy(*stream, out.begin());
+            return stream->size();
+        }
+
+    private:
+        compress::encoder m_encoder;
+        std::size_t m_inBytes{};
+        std::chrono::steady_clock::duration m_elapsed{};
+    };
+
+    // Linear pixels of an image at its output size, made whole or a band of rows at a time
+    class linear_source {
+    public:
+        // fixedBytes of the working set stay allocated whatever the band size
+        linear_source(const gfx2agb::rgba_image& image, const gfx2agb::bitmap_options& options, const settings_type& settings, std::size_t fixedBytes) noexcept;
+
+        // Calls func with each band of rows in order, or once with the whole image when not streaming
+        void for_each_band(auto func) {
+            if (m_bandRows == m_outHeight) {
+                func(m_linear);
+                return;
+            }
+
+            for (int rowBegin = 0; rowBegin < m_outHeight; rowBegin += m_bandRows) {
+                linearize_rows(rowBegin, std::min(rowBegin + m_bandRows, m_outHeight), m_linear);
+                func(m_linear);
+            }
+        }
+
+        // Free for stages to use between bands
+        image::buffer<float> scratch;
+
+    private:
+        // Linear output rows [rowBegin, rowEnd)
+        void linearize_rows(int rowBegin, int rowEnd, image::buffer<float>& out) noexcept;
+
+        const stbi_uc* m_source;
+        int m_inWidth;
+        int m_inHeight;
+        int m_outWidth;
+        int m_outHeight;
+        float m_gamma;
+        resample::filter m_filter;
+        int m_bandRows;
+        image::buffer<float> m_linear;
+    };
+
+    palette::histogram_type extract_histogram(linear_source& source, const std::vector<color_format::component_type>& colorFormat) noexcept {
+        const auto span = trace::scope{"histogram"};
+        auto histogram = palette::histogram_type{};
+        auto first = true;
+        source.for_each_band([&](const image::buffer<float>& band) {
+            trace::count("pixels", band.pixel_count());
+            if (first) {
+                histogram = palette::extract(colorFormat, band);
+                first = false;
+            } else {
+                palette::merge(colorFormat, histogram, palette::extract(colorFormat, band));
+            }
+        });
+        trace::count("colors", histogram.colors.size());
+        return histogram;
+    }
+
+    std::vector<std::array<float, 4>> reduce_colors(const palette::histogram_type& histogram, int colors, const settings_type& settings, const gfx2agb::bitmap_options& options) noexcept {
+        if (histogram.colors.size() <= std::size_t(colors)) {
+            vlog::print("Palette already fits in {} colors ({} colors)", [&](){return fmt::make_format_args(colors, histogram.colors.size());});
+            return histogram.colors;
+        }
+
+        const auto span = trace::scope{"quantize"};
+        trace::count("colors", histogram.colors.size());
+        return palette::quantize(histogram.colors, colors, settings.quantizer, options.refine, histogram.counts);
+    }
+
+}
+
+static std::optional<settings_type> parse_settings(const gfx2agb::bitmap_options& options, std::string& error) noexcept;
+static std::optional<settings_type> measure(const gfx2agb::bitmap_options& options, int inWidth, int inHeight, gfx2agb::bitmap_result& result) noexcept;
+
+gfx2agb::bitmap_result gfx2agb::check_bitmap(const bitmap_options& options) noexcept {
+    auto result = bitmap_result{};
+    parse_settings(options, result.error);
+    return result;
+}
+
+gfx2agb::bitmap_result gfx2agb::measure_bitmap(const bitmap_options& options, int inWidth, int inHeight) noexcept {
+    const auto quiet = vlog::scope{nullptr};
+    auto result = bitmap_result{};
+    measure(options, inWidth, inHeight, result);
+    return result;
+}
+
+gfx2agb::bitmap_result gfx2agb::convert_bitmap(std::span<const std::byte> encoded, const bitmap_options& options, const bitmap_outputs& outputs) noexcept {
+    int width, height, components;
+    const auto pixels = [&]() {
+        const auto span = trace::scope{"decode"};
+        return image::load(encoded, width, height, components);
+    }();
+    if (!pixels) {
+        return {.error = "Could not decode image"};
+    }
+
+    const auto bytes = std::size_t(width) * std::size_t(height) * rgba_components;
+    return convert_bitmap({std::as_bytes(std::span{pixels.get(), bytes}), width, height}, options, outputs);
+}
+
+gfx2agb::bitmap_result gfx2agb::convert_bitmap(const rgba_image& image, const bitmap_options& options, const bitmap_outputs& outputs) noexcept {
+    const auto log = vlog::scope{&options.log};
+
+    const auto inWidth = image.width;
+    const auto inHeight = image.height;
+
+    auto result = bitmap_result{};
+    auto settings = measure(options, inWidth, inHeight, result);
+    if (!settings) {
+        return result;
+    }
+
+    const auto imageBytes = std::size_t(inWidth) * std::size_t(inHeight) * rgba_components;
+    if (image.pixels.size() < imageBytes) {
+        return {.error = fmt::format("Image holds {} bytes, {}x{} RGBA needs {}", image.pixels.size(), inWidth, inHeight, imageBytes)};
+    }
+
+    // Nothing is written unless every output fits
+    const auto check_size = [&](std::string_view name, std::size_t size, std::size_t needed) {
+        if (size && size < needed) {
+            result.error = fmt::format("{} buffer holds {} bytes, {} needed", name, size, needed);
+            return false;
+        }
+        return true;
+    };
+    if (!check_size("Data", outputs.data.size(), result.dataSize) ||
+        !check_size("Preview", outputs.preview.size(), result.previewSize) ||
+        !check_size("Palette", outputs.palette.size_bytes(), result.paletteColors * sizeof(std::array<float, 4>)) ||
+        !check_size("Palette data", outputs.paletteData.size(), result.paletteDataSize)) {
+        return result;
+    }
+
+    const auto mode = options.mode;
+    const auto& colorFormat = settings->colorFormat;
+    const auto major = settings->major;
+    const auto minor = settings->minor;
+    const auto inGamma = options.inGamma;
+    const auto outGamma = options.outGamma;
+
+    auto dataOut = std::span<stbi_uc>{reinterpret_cast<stbi_uc*>(outputs.data.data()), outputs.data.empty() ? 0 : result.dataSize};
+    auto previewOut = std::span<stbi_uc>{reinterpret_cast<stbi_uc*>(outputs.preview.data()), outputs.preview.empty() ? 0 : result.previewSize};
+    const auto writeData = !dataOut.empty();
+    const auto writePreview = !previewOut.empty();
+
+    // Compressed data is packed into a band-sized buffer and fed to the compressor, then copied out whole
+    auto dataStream = std::optional<compressed_output>{};
+    auto packed = std::vector<stbi_uc>{};
+    if (writeData && settings->compression) {
+        dataStream.emplace(*settings->compression, options.optimalParse);
+    }
+    const auto finish_data = [&]() {
+        if (dataStream) {
+            const auto size = dataStream->finish("data", outputs.data);
+            if (!size) {
+                result.error = "Could not compress data";
+                return;
+            }
+            result.dataSize = *size;
+        }
+    };
+
+    const auto load_palette = [&]() {
+        if (!options.sharedPalette.empty()) {
+            vlog::print("Using shared palette ({} colors)", [&](){return fmt::make_format_args(options.sharedPalette.size());});
+            return std::vector<std::array<float, 4>>{options.sharedPalette.begin(), options.sharedPalette.end()};
+        }
+
+        if (settings->palette) {
+            return std::move(*settings->palette);
+        }
+
+        const auto span = trace::scope{"load palette"};
+        auto palette = palette::load(options.palette, colorFormat, inGamma);
+        trace::count("colors", palette.size());
+        return palette;
+    };
+
+    // Already the output size with every color kept, the 8-bit pixels pack straight into the format
+    const auto passThrough = mode != 4 && !options.antiAlias && inWidth == settings->outWidth && inHeight == settings->outHeight &&
+        !options.colors && options.palette.empty() && options.sharedPalette.empty() && image::is_normal(major, minor);
+    if (passThrough) {
+        vlog::print("Packing 8-bit pixels directly, as nothing is resized or reduced", [](){return fmt::make_format_args();});
+        const auto pixels = std::span<const stbi_uc>{reinterpret_cast<const stbi_uc*>(image.pixels.data()), imageBytes};
+        const auto pixelCount = std::size_t(inWidth) * std::size_t(inHeight);
+
+        if (writeData) {
+            const auto span = trace::scope{"pack data"};
+            trace::count("pixels", pixelCount);
+            if (dataStream) {
+                packed.resize(pixelCount * image::data_pixel_size(colorFormat));
+            }
+            const auto data = dataStream ? std::span{packed} : dataOut;
+            image::pack_rgba8(pixels, inWidth, inHeight, inGamma, 1.0f / outGamma, colorFormat, data);
+            if (dataStream) {
+                dataStream->append(std::as_bytes(data));
+            }
+        }
+
+        if (writePreview) {
+            const auto span = trace::scope{"pack preview"};
+            trace::count("pixels", pixelCount);
+            image::pack_rgba8(pixels, inWidth, inHeight, inGamma, 1.0f / outGamma, preview_format, previewOut);
+        }
+
+        finish_data();
+        return result;
+    }
+
+    // The 8-bit source and preview stay whole
+    auto fixedBytes = imageBytes;
+    if (writePreview) {
+        fixedBytes += result.previewSize;
+    }
+    auto source = linear_source{image, options, *settings, fixedBytes};
+    auto& scratch = source.scratch;
+
+    if (mode == 4) {
+        const auto bpp = options.bpp;
+
+        const auto palette = [&]() {
+            if (!options.sharedPalette.empty() || !options.palette.empty()) {
+                return load_palette();
+            }
+
+            const auto colors = options.colors ? options.colors : 1 << bpp;
+            vlog::print("Reducing to {} colors ({} bits per pixel) with {}", [&](){return fmt::make_format_args(colors, bpp, options.quantizer);});
+            return reduce_colors(extract_histogram(source, colorFormat), colors, *settings, options);
+        }();
+
+        result.paletteColors = palette.size();
+        result.paletteDataSize = palette.size() * image::data_pixel_size(colorFormat);
+
+        if (!outputs.palette.empty()) {
+            std::ranges::copy(palette, outputs.palette.begin());
+        }
+
+        if (!outputs.paletteData.empty()) {
+            image::flatten(palette, static_cast<int>(palette.size()), 1, scratch);
+            if (!settings->compression) {
+                image::to_data(scratch, 1.0f / outGamma, colorFormat, {reinterpret_cast<stbi_uc*>(outputs.paletteData.data()), result.paletteDataSize});
+            } else {
+                auto packed = std::vector<stbi_uc>(result.paletteDataSize);
+                image::to_data(scratch, 1.0f / outGamma, colorFormat, packed);
+                auto stream = compressed_output{*settings->compression, options.optimalParse};
+                stream.append(std::as_bytes(std::span{packed}));
+                const auto size = stream.finish("palette data", outputs.paletteData);
+                if (!size) {
+                    result.error = "Could not compress palette data";
+                    return result;
+                }
+                result.paletteDataSize = *size;
+            }
+        }
+
+        vlog::print("Applying palette ({} colors)", [&](){return fmt::make_format_args(palette.size());});
+        const auto lookup = image::palette_lookup{palette, colorFormat, 1.0f / outGamma};
+        image::with_index_type(palette.size(), [&]<typename Index>(Index) {
+            auto indices = image::buffer<Index>{};
+            auto oriented = image::buffer<Index>{};
+            source.for_each_band([&](const image::buffer<float>& band) {
+                {
+                    const auto span = trace::scope{"palettize"};
+                    trace::count("pixels", band.pixel_count());
+                    trace::count("colors", palette.size());
+                    lookup.palettize(band, indices);
+                }
+
+                for_each_oriented_band(indices, major, minor, options.direction, oriented, [&](const image::buffer<Index>& rows) {
+                    if (writePreview) {
+                        const auto span = trace::scope{"pack preview"};
+                        trace::count("pixels", rows.pixel_count());
+                        image::expand(rows, palette, scratch);
+                        image::to_data(scratch, 1.0f / outGamma, preview_format, take(previewOut, scratch.pixel_count() * rgba_components));
+                    }
+
+                    if (writeData) { // Bands are a multiple of 8 rows, so each ends on a whole byte
+                        const auto span = trace::scope{"pack data"};
+                        trace::count("pixels", rows.pixel_count());
+                        const auto data = util::repack_data(rows.data, bpp);
+                        if (dataStream) {
+                            dataStream->append(std::as_bytes(std::span{data}));
+                        } else {
+                            std::memcpy(take(dataOut, data.size()).data(), data.data(), data.size());
+                        }
+                    }
+                });
+            });
+        });
+
+        finish_data();
+        return result;
+    }
+
+    // Mode 3/5 bitmap
+    const auto colors = options.colors;
+    const auto reduced = !options.sharedPalette.empty() || !options.palette.empty() || colors;
+
+    const auto palette = [&]() {
+        if (!options.sharedPalette.empty()) { // Apply shared palette, already reduced
+            return load_palette();
+        } else if (!options.palette.empty()) { // Apply palette
+            auto palette = load_palette();
+            if (colors) { // And reduce colors
+                vlog::print("Reducing to {} colors with {}", [&](){return fmt::make_format_args(colors, options.quantizer);});
+                palette = reduce_colors(palette::histogram_type{palette, {}}, colors, *settings, options);
+            }
+            return palette;
+        } else if (colors) { // Reduce colors
+            vlog::print("Reducing to {} colors with {}", [&](){return fmt::make_format_args(colors, options.quantizer);});
+            return reduce_colors(extract_histogram(source, colorFormat), colors, *settings, options);
+        }
+        return std::vector<std::array<float, 4>>{};
+    }();
+
+    // The preview's pixels are also the data's when both share a format
+    const auto sharedPack = writePreview && writeData && std::ranges::equal(colorFormat, preview_format, [](const auto& a, const auto& b) {
+        return a.channel == b.channel && a.size == b.size && a.shift == b.shift;
+    });
+
+    if (reduced) {
+        vlog::print("Applying palette ({} colors)", [&](){return fmt::make_format_args(palette.size());});
+    }
+    const auto lookup = image::palette_lookup{reduced ? palette : std::vector<std::array<float, 4>>{}, colorFormat, 1.0f / outGamma};
+    source.for_each_band([&](image::buffer<float>& band) {
+        if (reduced) {
+            const auto span = trace::scope{"palettize"};
+            trace::count("pixels", band.pixel_count());
+            trace::count("colors", palette.size());
+            image::with_index_type(palette.size(), [&]<typename Index>(Index) {
+                auto indices = image::buffer<Index>{};
+                lookup.palettize(band, indices);
+                image::expand(indices, palette, band);
+            });
+        }
+
+        for_each_oriented_band(band, major, minor, options.direction, scratch, [&](const image::buffer<float>& rows) {
+            if (writeData) {
+                const auto span = trace::scope{"pack data"};
+                trace::count("pixels", rows.pixel_count());
+                const auto size = rows.pixel_count() * image::data_pixel_size(colorFormat);
+                if (dataStream) {
+                    packed.resize(size);
+                }
+                const auto data = dataStream ? std::span{packed} : take(dataOut, size);
+                image::to_data(rows, 1.0f / outGamma, colorFormat, data);
+                if (dataStream) {
+                    dataStream->append(std::as_bytes(data));
+                }
+                if (sharedPack) {
+                    std::ranges::copy(data, take(previewOut, data.size()).begin());
+                }
+            }
+
+            if (writePreview && !sharedPack) {
+                const auto span = trace::scope{"pack preview"};
+                trace::count("pixels", rows.pixel_count());
+                image::to_data(rows, 1.0f / outGamma, preview_format, take(previewOut, rows.pixel_count() * rgba_components));
+            }
+        });
+    });
+
+    finish_data();
+    return result;
+}
+
+gfx2agb::bitmap_result gfx2agb::add_histogram(const rgba_image& image, const bitmap_options& options, color_histogram& histogram) noexcept {
+    const auto log = vlog::scope{&options.log};
+
+    if (!histogram.format.empty() && histogram.format != options.format) {
+        return {.error = fmt::format("Histogram of format {} can't count colors of format {}", histogram.format, options.format)};
+    }
+
+    auto result = bitmap_result{};
+    const auto settings = measure(options, image.width, image.height, result);
+    if (!settings) {
+        return result;
+    }
+
+    const auto imageBytes = std::size_t(image.width) * std::size_t(image.height) * rgba_components;
+    if (image.pixels.size() < imageBytes) {
+        return {.error = fmt::format("Image holds {} bytes, {}x{} RGBA needs {}", image.pixels.size(), image.width, image.height, imageBytes)};
+    }
+
+    auto source = linear_source{image, options, *settings, imageBytes};
+    auto extracted = extract_histogram(source, settings->colorFormat);
+
+    if (histogram.colors.empty()) {
+        histogram.format = options.format;
+        histogram.colors = std::move(extracted.colors);
+        histogram.counts = std::move(extracted.counts);
+        return result;
+    }
+
+    auto merged = palette::histogram_type{std::move(histogram.colors), std::move(histogram.counts)};
+    palette::merge(settings->colorFormat, merged, extracted);
+    histogram.colors = std::move(merged.colors);
+    histogram.counts = std::move(merged.counts);
+    return result;
+}
+
+gfx2agb::bitmap_result gfx2agb::merge_histograms(color_histogram& histogram, color_histogram other) noexcept {
+    if (other.colors.empty()) {
+        return {};
+    }
+
+    if (histogram.colors.empty()) {
+        histogram = std::move(other);
+        return {};
+    }
+
+    if (histogram.format != other.format) {
+        return {.error = fmt::format("Can't merge histograms of formats {} and {}", histogram.format, other.format)};
+    }
+
+    const auto span = trace::scope{"merge histograms"};
+    auto merged = palette::histogram_type{std::move(histogram.colors), std::move(histogram.counts)};
+    palette::merge(color_format::parse(histogram.format), merged, palette::histogram_type{std::move(other.colors), std::move(other.counts)});
+    trace::count("colors", merged.colors.size());
+    histogram.colors = std::move(merged.colors);
+    histogram.counts = std::move(merged.counts);
+    return {};
+}
+
+gfx2agb::bitmap_result gfx2agb::reduce_histogram(const color_histogram& histogram, const bitmap_options& options, std::vector<std::array<float, 4>>& palette) noexcept {
+    const auto log = vlog::scope{&options.log};
+
+    auto result = bitmap_result{};
+    const auto settings = parse_settings(options, result.error);
+    if (!settings) {
+        return result;
+    }
+
+    if (!histogram.colors.empty() && histogram.format != options.format) {
+        return {.error = fmt::format("Histogram of format {} can't make a palette of format {}", histogram.format, options.format)};
+    }
+
+    const auto colors = options.colors ? options.colors : (options.mode == 4 ? 1 << options.bpp : 0);
+    if (!colors) {
+        return {.error = fmt::format("Mode {} needs a number of colors to reduce to", options.mode)};
+    }
+
+    vlog::print("Reducing {} shared colors to {} with {}", [&](){return fmt::make_format_args(histogram.colors.size(), colors, options.quantizer);});
+    palette = reduce_colors({histogram.colors, histogram.counts}, colors, *settings, options);
+
+    result.paletteColors = palette.size();
+    result.paletteDataSize = palette.size() * image::data_pixel_size(settings->colorFormat);
+    return result;
+}
+
+static std::optional<settings_type> parse_settings(const gfx2agb::bitmap_options& options, std::string& error) noexcept {
+    if (options.mode < 3 || options.mode > 5) {
+        error = fmt::format("{} is not a bitmap mode (expected 3, 4, 5)", options.mode);
+        return std::nullopt;
+    }
+
+    auto settings = settings_type{};
+
+    auto formatError = std::string{};
+    settings.colorFormat = color_format::parse(options.format, formatError);
+    if (settings.colorFormat.empty()) {
+        error = formatError.empty() ? fmt::format("Could not parse color format {}", options.format) : fmt::format("Could not parse color format {}: {}", options.format, formatError);
+        return std::nullopt;
+    }
+
+    std::tie(settings.major, settings.minor) = image::direction_pair(options.direction);
+    if (image::same_axis(settings.major, settings.minor)) {
+        error = fmt::format("Invalid direction {}", options.direction);
+        return std::nullopt;
+    }
+
+    const auto quantizer = palette::parse_quantizer(options.quantizer);
+    if (!quantizer) {
+        error = fmt::format("Unknown quantizer {} (expected kmeans, median-cut, octree, wu)", options.quantizer);
+        return std::nullopt;
+    }
+    settings.quantizer = *quantizer;
+
+    const auto filter = resample::parse_filter(options.filter);
+    if (!filter) {
+        error = fmt::format("Unknown filter {} (expected auto, box, triangle, cubic, catmull-rom, mitchell)", options.filter);
+        return std::nullopt;
+    }
+    settings.filter = *filter;
+
+    if (!options.compress.empty()) {
+        settings.compression = compress::parse_method(options.compress);
+        if (!settings.compression) {
+            error = fmt::format("Unknown compression {} (expected lz77, lz77-vram, rle, huff4, huff8)", options.compress);
+            return std::nullopt;
+        }
+    }
+
+    if (options.mode == 4 && !util::is_pow2_or_mul8(options.bpp)) {
+        error = fmt::format("bpp ({}) must be a power of 2 or a multiple of 8", options.bpp);
+        return std::nullopt;
+    }
+
+    return settings;
+}
+
+static std::optional<settings_type> measure(const gfx2agb::bitmap_options& options, int inWidth, int inHeight, gfx2agb::bitmap_result& result) noexcept {
+    auto settings = parse_settings(options, result.error);
+    if (!settings) {
+        return std::nullopt;
+    }
+
+    std::tie(settings->outWidth, settings->outHeight) = util::parse_width_height(inWidth, inHeight,
+        options.width.empty() ? (options.mode == 5 ? "160" : "240") : options.width,
+        options.height.empty() ? (options.mode == 5 ? "120" : "160") : options.height
+    );
+    if (settings->outWidth <= 0 || settings->outHeight <= 0) {
+        result.error = fmt::format("Invalid output size {}x{}", settings->outWidth, settings->outHeight);
+        return std::nullopt;
+    }
+
+    const auto transpose = !image::is_x_axis(settings->major);
+    result.width = transpose ? settings->outHeight : settings->outWidth;
+    result.height = transpose ? settings->outWidth : settings->outHeight;
+
+    const auto pixels = std::size_t(settings->outWidth) * std::size_t(settings->outHeight);
+    result.previewSize = pixels * rgba_components;
+
+    // Compressed outputs are sized for the largest stream their bytes could make, convert_bitmap gives the actual size
+    const auto compressed = [&](std::size_t size) {
+        return settings->compression ? compress::max_size(*settings->compression, size) : size;
+    };
+
+    const auto dataSize = options.mode == 4 ? ((pixels * options.bpp) + 7) / 8 : pixels * image::data_pixel_size(settings->colorFormat);
+    if (settings->compression && dataSize > compress::max_input_size) {
+        result.error = fmt::format("{} bytes of data is too large to compress (at most {})", dataSize, compress::max_input_size);
+        return std::nullopt;
+    }
+    result.dataSize = compressed(dataSize);
+
+    if (options.mode != 4) {
+        return settings;
+    }
+
+    if (options.bpp < 31 && options.sharedPalette.size() > (std::size_t{1} << options.bpp)) {
+        result.error = fmt::format("Shared palette of {} colors doesn't fit in {} bits per pixel", options.sharedPalette.size(), options.bpp);
+        return std::nullopt;
+    }
+
+    // A generated palette has no more colors than the limit or the pixels
+    result.paletteColors = [&]() {
+        if (!options.sharedPalette.empty()) {
+            return options.sharedPalette.size();
+        }
+
+        if (!options.palette.empty()) {
+            const auto span = trace::scope{"load palette"};
+            settings->palette = palette::load(options.palette, settings->colorFormat, options.inGamma);
+            trace::count("colors", settings->palette->size());
+            return settings->palette->size();
+        }
+
+        const auto limit = options.colors ? std::size_t(options.colors) : (options.bpp < 31 ? std::size_t{1} << options.bpp : std::size_t(INT_MAX));
+        return std::min(limit, pixels);
+    }();
+    result.paletteDataSize = compressed(result.paletteColors * image::data_pixel_size(settings->colorFormat));
+    return settings;
+}
+
+linear_source::linear_source(const gfx2agb::rgba_image& image, const gfx2agb::bitmap_options& options, const settings_type& settings, std::size_t fixedBytes) noexcept :
+    m_source{reinterpret_cast<const stbi_uc*>(image.pixels.data())},
+    m_inWidth{image.width},
+    m_inHeight{image.height},
+    m_outWidth{settings.outWidth},
+    m_outHeight{settings.outHeight},
+    m_gamma{options.inGamma},
+    m_filter{settings.filter},
+    m_bandRows{settings.outHeight}
+{
+    // With a memory budget the output is made in bands of rows, each linearized and resized from only the source rows it needs
+    if (options.maxMemory) {
+        if (options.antiAlias || !image::is_normal(settings.major, settings.minor)) {
+            vlog::print("Ignoring the memory budget of {} bytes, processing the whole image as anti-aliasing and direction need every row", [&](){return fmt::make_format_args(options.maxMemory);});
+        } else {
+            auto workingSet = std::size_t{};
+            m_bandRows = band_rows(options.maxMemory, fixedBytes, m_inWidth, m_inHeight, m_outWidth, m_outHeight, workingSet);
+            if (workingSet > options.maxMemory) {
+                vlog::print("Exceeding the memory budget of {} bytes: the 8-bit source, preview and {} rows at a time need {}", [&](){return fmt::make_format_args(options.maxMemory, m_bandRows, workingSet);});
+            }
+        }
+    }
+
+    if (m_bandRows < m_outHeight) {
+        vlog::print("Streaming {} rows at a time", [&](){return fmt::make_format_args(m_bandRows);});
+        return;
+    }
+
+    vlog::print("Converting to linear with gamma {}", [&](){return fmt::make_format_args(m_gamma);});
+    {
+        const auto span = trace::scope{"linearize"};
+        trace::count("pixels", std::size_t(m_inWidth) * std::size_t(m_inHeight));
+        image::to_float({m_source, std::size_t(m_inWidth) * std::size_t(m_inHeight) * rgba_components}, m_inWidth, m_inHeight, m_gamma, m_linear);
+    }
+
+    if (options.antiAlias) { // Apply sub-pixel anti-aliasing
+        vlog::print("Resizing to {}x{} with sub-pixel anti-aliasing", [&](){return fmt::make_format_args(m_outWidth, m_outHeight);});
+        const auto span = trace::scope{"anti-alias"};
+        trace::count("pixels", std::size_t(m_outWidth) * std::size_t(m_outHeight));
+        auto resolved = image::buffer<float>{};
+        image::resize_and_resolve(m_linear, m_outWidth, m_outHeight, m_filter, resolved);
+        std::swap(m_linear, resolved);
+    } else if (m_inWidth != m_outWidth || m_inHeight != m_outHeight) {
+        vlog::print("Resizing to {}x{}", [&](){return fmt::make_format_args(m_outWidth, m_outHeight);});
+        const auto span = trace::scope{"resize"};
+        trace::count("pixels", std::size_t(m_outWidth) * std::size_t(m_outHeight));
+        image::resize(m_linear, m_outWidth, m_outHeight, m_filter, scratch);
+        std::swap(m_linear, scratch);
+    }
+}
+
+void linear_source::linearize_rows(int rowBegin, int rowEnd, image::buffer<float>& out) noexcept {
+    const auto resized = m_inWidth != m_outWidth || m_inHeight != m_outHeight;
+    const auto [srcBegin, srcEnd] = resized ? image::resize_source_rows(m_inHeight, m_outHeight, m_filter, rowBegin, rowEnd) : std::make_pair(rowBegin, rowEnd);
+
+    const auto rowBytes = std::size_t(m_inWidth) * rgba_components;
+    const auto rows = std::span<const stbi_uc>{m_source + (std::size_t(srcBegin) * rowBytes), std::size_t(srcEnd - srcBegin) * rowBytes};
+    {
+        const auto span = trace::scope{"linearize"};
+        trace::count("pixels", std::size_t(m_inWidth) * std::size_t(srcEnd - srcBegin));
+        image::to_float(rows, m_inWidth, srcEnd - srcBegin, m_gamma, resized ? scratch : out);
+    }
+
+    if (resized) {
+        const auto span = trace::scope{"resize"};
+        trace::count("pixels", std::size_t(m_outWidth) * std::size_t(rowEnd - rowBegin));
+        image::resize_rows(scratch, m_inHeight, srcBegin, m_outWidth, m_outHeight, m_filter, rowBegin, rowEnd, out);
+    }
+}
@@ -5,20 +5,36 @@
 #include <cmath>
 #include <cstring>
 #include <iterator>
+#include <limits>
 #include <numeric>
 #include <ranges>
+#include <utility>
 
-#include "stb_image_resize.h"
+#include "packer.hpp"
+#include "parallel.hpp"
+#include "trace.hpp"
 #include "util.hpp"
 
 namespace {
 
 constexpr auto rgba_channels = 4;
 
+// Below this many pixels building the packer's channel tables costs more than it saves
+constexpr auto specialize_min_pixels = std::size_t{4096};
+
 auto bitlen_to_byte_size(auto x) noexcept {
     return (x + 7) / 8;
 }
 
+void shift_bits(std::size_t& pixel, auto bits, const color_format::color_channel_type& channel) noexcept {
+    if (channel.low) {
+        pixel |= std::size_t(bits & channel.low.mask()) << channel.low.shift;
+    }
+    if (channel.high) {
+        pixel |= std::size_t((bits >> channel.low.size) & channel.high.mask()) << channel.high.shift;
+    }
+}
+
 }
 
 std::unique_ptr<stbi_uc[], void(*)(void*)> image::load(const char* filename, int& width, int& height, int& channels) noexcept {
@@ -26,203 +42,449 @@ std::unique_ptr<stbi_uc[], void(*)(void*)> image::load(const char* filename, int
     return {img, img ? stbi_image_free : [](void*){}};
 }
 
-std::vector<float> image::to_float(const std::unique_ptr<stbi_uc[], void(*)(void*)>& image, int width, int height, float pow) noexcept {
-    const auto imageStride = width * rgba_channels * sizeof(stbi_uc);
-
-    auto result = std::vector<float>{};
-    result.reserve(width * height * rgba_channels);
-
-    for (int yy = 0; yy < height; ++yy) {
-        for (int xx = 0; xx < imageStride; xx += 4) {
-            result.emplace_back(util::pow_clamp(image[yy * imageStride + xx + 0] / 255.0, pow));
-            result.emplace_back(util::pow_clamp(image[yy * imageStride + xx + 1] / 255.0, pow));
-            result.emplace_back(util::pow_clamp(image[yy * imageStride + xx + 2] / 255.0, pow));
-            result.emplace_back(util::pow_clamp(image[yy * imageStride + xx + 3] / 255.0, 1.0));
-        }
+std::unique_ptr<stbi_uc[], void(*)(void*)> image::load(std::span<const std::byte> encoded, int& width, int& height, int& channels) noexcept {
+    if (encoded.size() > std::size_t(std::numeric_limits<int>::max())) {
+        return {nullptr, [](void*){}};
     }
 
-    return result;
+    auto* img = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(encoded.data()), static_cast<int>(encoded.size()), &width, &height, &channels, rgba_channels);
+    return {img, img ? stbi_image_free : [](void*){}};
 }
 
-std::vector<float> image::resize(const std::vector<float>& image, int inWidth, int inHeight, int outWidth, int outHeight) noexcept {
-    auto result = std::vector<float>{};
-    result.resize(outWidth * outHeight * rgba_channels);
-
-    stbir_resize_float(
-        image.data(), inWidth, inHeight, static_cast<int>(inWidth * rgba_channels * sizeof(float)),
-        result.data(), outWidth, outHeight, static_cast<int>(outWidth * rgba_channels * sizeof(float)),
-        rgba_channels
-    );
+std::unique_ptr<stbi_uc[], void(*)(void*)> image::load_gif(std::span<const std::byte> encoded, int& width, int& height, int& frames) noexcept {
+    if (encoded.size() > std::size_t(std::numeric_limits<int>::max())) {
+        return {nullptr, [](void*){}};
+    }
 
-    return result;
+    int channels;
+    auto* img = stbi_load_gif_from_memory(reinterpret_cast<const stbi_uc*>(encoded.data()), static_cast<int>(encoded.size()), nullptr, &width, &height, &frames, &channels, rgba_channels);
+    return {img, img ? stbi_image_free : [](void*){}};
 }
 
-std::vector<float> image::resize_and_resolve(const std::vector<float>& image, int inWidth, int inHeight, int outWidth, int outHeight) noexcept {
-    const auto aliasedWidth = outWidth * 3;
+void image::to_float(std::span<const stbi_uc> image, int width, int height, float pow, buffer<float>& out) noexcept {
+    const auto imageStride = std::size_t(width) * rgba_channels;
 
-    auto resized = resize(image, inWidth, inHeight, aliasedWidth, outHeight);
+    // 8-bit input has only 256 possible results per channel
+    const auto colorTable = util::gamma_table(pow);
+    const auto alphaTable = util::gamma_table(1.0f);
 
-    const auto read_pixel = [&resized, aliasedWidth](int x, int y) {
-        const auto stride = aliasedWidth * rgba_channels;
-        x = std::min(x, aliasedWidth - 1); // Clamp X
+    out.reshape(width, height, layout::rgba);
 
-        return std::array<float, rgba_channels>{
-            resized[y * stride + (x * rgba_channels) + 0],
-            resized[y * stride + (x * rgba_channels) + 1],
-            resized[y * stride + (x * rgba_channels) + 2],
-            resized[y * stride + (x * rgba_channels) + 3]
-        };
-    };
+    const auto minRows = std::max(std::size_t{16384} / std::max(imageStride, std::size_t{1}), std::size_t{1});
+    parallel::for_each_band(std::size_t(height), minRows, [&](std::size_t rowBegin, std::size_t rowEnd) {
+        for (auto yy = rowBegin; yy < rowEnd; ++yy) {
+            const auto* src = image.data() + (yy * imageStride);
+            auto* dst = out.row(int(yy)).data();
 
-    auto result = std::vector<float>{};
-    result.reserve(outWidth * outHeight * rgba_channels);
+            for (auto xx = std::size_t{}; xx < imageStride; xx += 4) {
+                dst[xx + 0] = colorTable[src[xx + 0]];
+                dst[xx + 1] = colorTable[src[xx + 1]];
+                dst[xx + 2] = colorTable[src[xx + 2]];
+                dst[xx + 3] = alphaTable[src[xx + 3]];
+            }
+        }
+    });
+}
 
-    for (int yy = 0; yy < outHeight; ++yy) {
-        for (int xx = 0; xx < outWidth; ++xx) {
-            const auto left = read_pixel(xx * 3 + 0, yy);
-            const auto center = read_pixel(xx * 3 + 1, yy);
-            const auto right = read_pixel(xx * 3 + 2, yy);
+void image::resize(const buffer<float>& image, int outWidth, int outHeight, resample::filter f, buffer<float>& out) noexcept {
+    resample::apply(image, 0, *resample::kernel(image.width, outWidth, f), *resample::kernel(image.height, outHeight, f), 0, outHeight, out);
+}
 
-            result.emplace_back((right[0] + center[0]) / 2.0f);
-            result.emplace_back((left[1] + center[1] + right[1]) / 3.0f);
-            result.emplace_back((center[2] + left[2]) / 2.0f);
-            result.emplace_back((left[3] + center[3] + right[3]) / 3.0f);
-        }
-    }
+std::pair<int, int> image::resize_source_rows(int inHeight, int outHeight, resample::filter f, int outRowBegin, int outRowEnd) noexcept {
+    return resample::source_range(*resample::kernel(inHeight, outHeight, f), outRowBegin, outRowEnd);
+}
 
-    return result;
+void image::resize_rows(const buffer<float>& band, int inHeight, int inRowBegin, int outWidth, int outHeight, resample::filter f, int outRowBegin, int outRowEnd, buffer<float>& out) noexcept {
+    resample::apply(band, inRowBegin, *resample::kernel(band.width, outWidth, f), *resample::kernel(inHeight, outHeight, f), outRowBegin, outRowEnd, out);
 }
 
-std::vector<stbi_uc> image::to_data(const std::vector<float>& image, int width, int height, float pow, const std::vector<color_format::component_type>& format) noexcept {
+void image::resize_and_resolve(const buffer<float>& image, int outWidth, int outHeight, resample::filter f, buffer<float>& out) noexcept {
+    // Resolving the sub-pixels is folded into the horizontal weights, so the 3x wide image is never made
+    resample::apply(image, 0, *resample::subpixel_kernel(image.width, outWidth, f), *resample::kernel(image.height, outHeight, f), 0, outHeight, out);
+}
+
+std::size_t image::data_pixel_size(const std::vector<color_format::component_type>& format) noexcept {
     const auto channels = color_format::to_rgba_channels(format);
 
-    const auto bytesPerPixel = bitlen_to_byte_size(std::accumulate(std::cbegin(channels), std::cend(channels), std::size_t{0}, [](auto acc, const auto& c) {
+    return bitlen_to_byte_size(std::accumulate(std::cbegin(channels), std::cend(channels), std::size_t{0}, [](auto acc, const auto& c) {
         acc += c.size();
         return acc;
     }));
+}
 
-    static constexpr auto shift_bits = [](auto& pixel, auto bits, const auto& channel) {
-        if (channel.low) {
-            pixel |= std::size_t(bits & channel.low.mask()) << channel.low.shift;
-        }
-        if (channel.high) {
-            pixel |= std::size_t((bits >> channel.low.size) & channel.high.mask()) << channel.high.shift;
-        }
-    };
+void image::to_data(const buffer<float>& image, float pow, const std::vector<color_format::component_type>& format, std::vector<stbi_uc>& out) noexcept {
+    out.resize(image.pixel_count() * data_pixel_size(format));
+    to_data(image, pow, format, std::span{out});
+}
 
-    auto result = std::vector<stbi_uc>{};
-    result.resize(width * height * bytesPerPixel);
+void image::to_data(const buffer<float>& image, float pow, const std::vector<color_format::component_type>& format, std::span<stbi_uc> out) noexcept {
+    const auto channels = color_format::to_rgba_channels(format);
+    const auto bytesPerPixel = data_pixel_size(format);
 
-    for (int yy = 0; yy < height; ++yy) {
-        for (int xx = 0; xx < width; ++xx) {
-            auto pixel = std::size_t{};
+    const auto minRows = std::max(std::size_t{16384} / std::max(std::size_t(image.width), std::size_t{1}), std::size_t{1});
 
-            for (int ii = 0; ii < 3; ++ii) {
-                const auto bits = channels[ii].pow(image[yy * (width * rgba_channels) + (xx * rgba_channels) + ii], pow);
-                shift_bits(pixel, bits, channels[ii]);
-            }
+    // Large images in a common format go through a packer with the layout baked in and no std::pow per pixel
+    const auto packRows = pow > 0.0f && image.pixel_count() >= specialize_min_pixels ? packer::find(format) : nullptr;
+    if (packRows) {
+        const auto tables = packer::channel_tables{
+            packer::channel_table{channels[0], pow},
+            packer::channel_table{channels[1], pow},
+            packer::channel_table{channels[2], pow}
+        };
+
+        parallel::for_each_band(std::size_t(image.height), minRows, [&](std::size_t rowBegin, std::size_t rowEnd) {
+            packRows(image, rowBegin, rowEnd, tables, out.data());
+        });
+        return;
+    }
 
-            const auto alpha = channels[3].convert(image[yy * (width * rgba_channels) + (xx * rgba_channels) + 3]);
-            shift_bits(pixel, alpha, channels[3]);
+    parallel::for_each_band(std::size_t(image.height), minRows, [&](std::size_t rowBegin, std::size_t rowEnd) {
+        auto* dest = out.data() + (rowBegin * std::size_t(image.width) * bytesPerPixel);
 
-            auto* dest = result.data() + (yy * (width * bytesPerPixel) + (xx * bytesPerPixel));
-            std::memcpy(dest, &pixel, bytesPerPixel);
+        for (auto yy = int(rowBegin); yy < int(rowEnd); ++yy) {
+            const auto* src = image.row(yy).data();
+
+            for (int xx = 0; xx < image.width; ++xx, src += rgba_channels, dest += bytesPerPixel) {
+                auto pixel = std::size_t{};
+
+                for (int ii = 0; ii < 3; ++ii) {
+                    const auto bits = channels[ii].pow(src[ii], pow);
+                    shift_bits(pixel, bits, channels[ii]);
+                }
+
+                const auto alpha = channels[3].convert(src[3]);
+                shift_bits(pixel, alpha, channels[3]);
+
+                std::memcpy(dest, &pixel, bytesPerPixel);
+            }
+        }
+    });
+}
+
+void image::pack_rgba8(std::span<const stbi_uc> image, int width, int height, float inPow, float outPow, const std::vector<color_format::component_type>& format, std::span<stbi_uc> out) noexcept {
+    const auto channels = color_format::to_rgba_channels(format);
+    const auto bytesPerPixel = data_pixel_size(format);
+    const auto imageStride = std::size_t(width) * rgba_channels;
+
+    // Each channel's bits in place for every 8-bit input, through the same floats as to_float then to_data
+    const auto colorTable = util::gamma_table(inPow);
+    const auto alphaTable = util::gamma_table(1.0f);
+    auto tables = std::array<std::array<std::size_t, 256>, rgba_channels>{};
+    for (auto ii = std::size_t{}; ii < 256; ++ii) {
+        for (auto cc = std::size_t{}; cc < 3; ++cc) {
+            shift_bits(tables[cc][ii], channels[cc].pow(colorTable[ii], outPow), channels[cc]);
         }
+        shift_bits(tables[3][ii], channels[3].convert(alphaTable[ii]), channels[3]);
     }
 
-    return result;
-}
+    // A constant size lets each copy compile to a single store
+    const auto pack = [&]<std::size_t Bytes>(std::size_t rowBegin, std::size_t rowEnd, std::size_t bytes) {
+        for (auto yy = rowBegin; yy < rowEnd; ++yy) {
+            const auto* src = image.data() + (yy * imageStride);
+            auto* dest = out.data() + (yy * std::size_t(width) * bytes);
 
-std::vector<float> image::flatten(const std::vector<std::array<float, 4>>& image) noexcept {
-    auto result = std::vector<float>{};
-    result.reserve(image.size() * 4);
+            for (auto xx = std::size_t{}; xx < imageStride; xx += rgba_channels, dest += bytes) {
+                const auto pixel = tables[0][src[xx + 0]] | tables[1][src[xx + 1]] | tables[2][src[xx + 2]] | tables[3][src[xx + 3]];
+                std::memcpy(dest, &pixel, Bytes ? Bytes : bytes);
+            }
+        }
+    };
 
-    [[maybe_unused]]
-    const auto end = std::accumulate(std::cbegin(image), std::cend(image), std::back_inserter(result), [](auto out, auto c){
-        return std::copy_n(std::cbegin(c), 4, out);
+    const auto minRows = std::max(std::size_t{16384} / std::max(std::size_t(width), std::size_t{1}), std::size_t{1});
+    parallel::for_each_band(std::size_t(height), minRows, [&](std::size_t rowBegin, std::size_t rowEnd) {
+        switch (bytesPerPixel) {
+        case 2:
+            pack.template operator()<2>(rowBegin, rowEnd, bytesPerPixel);
+            break;
+        case 4:
+            pack.template operator()<4>(rowBegin, rowEnd, bytesPerPixel);
+            break;
+        default:
+            pack.template operator()<0>(rowBegin, rowEnd, bytesPerPixel);
+            break;
+        }
     });
+}
 
-    return result;
+void image::flatten(const std::vector<std::array<float, 4>>& palette, int width, int height, buffer<float>& out) noexcept {
+    out.reshape(width, height, layout::rgba);
+    std::ranges::fill(out.data, 0.0f);
+
+    const auto count = std::min(palette.size(), out.pixel_count());
+    for (auto ii = std::size_t{}; ii < count; ++ii) {
+        std::ranges::copy(palette[ii], out.data.begin() + static_cast<std::ptrdiff_t>(ii * rgba_channels));
+    }
 }
 
 using color_type = std::array<float, 4>;
 
-std::vector<std::size_t> image::palettize(const std::vector<float>& image, const std::vector<color_type>& palette) noexcept {
-    const auto nearest_point_index = [&](const auto& p) {
-        const auto compare_distance = [&](const auto& p1, const auto& p2) {
-            const auto distance = [](const auto& p1, const auto& p2) {
+namespace {
+
+    // Palette entries in structure-of-arrays form, padded to whole blocks so the distance loop vectorizes without a remainder
+    constexpr auto palette_block = std::size_t{16};
+
+    struct palette_soa {
+        explicit palette_soa(const std::vector<color_type>& palette) noexcept : size{palette.size()} {
+            const auto padded = ((palette.size() + palette_block - 1) / palette_block) * palette_block;
+            for (auto* channel : {&red, &green, &blue}) {
+                channel->assign(padded, std::numeric_limits<float>::infinity());
+            }
+            for (auto ii = std::size_t{}; ii < palette.size(); ++ii) {
+                red[ii] = palette[ii][0];
+                green[ii] = palette[ii][1];
+                blue[ii] = palette[ii][2];
+            }
+        }
+
+        std::size_t size;
+        std::vector<float> red;
+        std::vector<float> green;
+        std::vector<float> blue;
+    };
+
+}
+
+namespace {
+
+    // Nearest palette entry of a pixel, with ties resolved exactly as std::ranges::min_element would under the reference metric
+    class nearest_search {
+    public:
+        explicit nearest_search(const std::vector<color_type>& palette) noexcept : m_palette{palette}, m_soa{palette}, m_distances(m_soa.red.size()) {}
+
+        [[nodiscard]]
+        std::size_t operator()(const float* pixel) noexcept {
+            // Reference metric: candidates are re-checked with it
+            static constexpr auto distance = [](const auto& p1, const auto& p2) {
                 return std::sqrt(std::pow(p1[0] - p2[0], 2) +
                                  std::pow(p1[1] - p2[1], 2) +
                                  std::pow(p1[2] - p2[2], 2)); // Don't compare alpha
             };
-            return distance(p1, p) < distance(p2, p);
-        };
-        auto min_point_it = std::ranges::min_element(palette, compare_distance);
-        return std::distance(std::begin(palette), min_point_it);
-    };
 
-    auto result = std::vector<std::size_t>{};
-    result.reserve(image.size() / 4);
+            // Single precision squared distances stay within 2^-20 of the reference, so anything further than this from the minimum can't win
+            static constexpr auto candidate_tolerance = 1.0f + 0x1p-20f;
+            static constexpr auto candidate_epsilon = 1e-30f;
+
+            const auto padded = m_soa.red.size();
+            const auto* red = m_soa.red.data();
+            const auto* green = m_soa.green.data();
+            const auto* blue = m_soa.blue.data();
+
+            const auto pr = pixel[0];
+            const auto pg = pixel[1];
+            const auto pb = pixel[2];
+
+            auto minDistances = std::array<float, palette_block>{};
+            minDistances.fill(std::numeric_limits<float>::infinity());
+
+            for (auto block = std::size_t{}; block < padded; block += palette_block) {
+                auto blockDistances = std::array<float, palette_block>{};
+                for (auto ii = std::size_t{}; ii < palette_block; ++ii) {
+                    const auto dr = red[block + ii] - pr;
+                    const auto dg = green[block + ii] - pg;
+                    const auto db = blue[block + ii] - pb;
+                    blockDistances[ii] = (dr * dr) + (dg * dg) + (db * db);
+                    minDistances[ii] = std::min(minDistances[ii], blockDistances[ii]);
+                }
+                std::copy(blockDistances.cbegin(), blockDistances.cend(), m_distances.begin() + static_cast<std::ptrdiff_t>(block));
+            }
+
+            const auto minDistance = *std::ranges::min_element(minDistances);
+
+            const auto limit = (minDistance * candidate_tolerance) + candidate_epsilon;
+            const auto p = color_type{pr, pg, pb, pixel[3]};
+
+            auto bestIndex = m_soa.size;
+            auto bestDistance = double{};
+            for (auto ii = std::size_t{}; ii < m_soa.size; ++ii) {
+                if (!(m_distances[ii] <= limit)) {
+                    continue;
+                }
+
+                const auto d = distance(m_palette[ii], p);
+                if (bestIndex == m_soa.size || d < bestDistance) {
+                    bestIndex = ii;
+                    bestDistance = d;
+                }
+            }
+
+            return bestIndex == m_soa.size ? 0 : bestIndex;
+        }
+
+    private:
+        const std::vector<color_type>& m_palette;
+        palette_soa m_soa;
+        std::vector<float> m_distances;
+    };
 
-    for (int ii = 0; ii < image.size(); ii += 4) {
-        result.emplace_back(nearest_point_index(color_type{
-                image[ii + 0],
-                image[ii + 1],
-                image[ii + 2],
-                image[ii + 3]
-        }));
+    [[nodiscard]]
+    std::size_t palettize_min_rows(int width) noexcept {
+        return std::max(std::size_t{4096} / std::max(std::size_t(width), std::size_t{1}), std::size_t{1});
     }
 
-    return result;
 }
 
-std::vector<float> image::expand(const std::vector<std::size_t>& indices, const std::vector<std::array<float, 4>>& palette) noexcept {
-    auto result = std::vector<float>{};
-    result.reserve(indices.size() * 4);
+template <typename Index>
+void image::palettize(const buffer<float>& image, const std::vector<color_type>& palette, buffer<Index>& out) noexcept {
+    out.reshape(image.width, image.height, layout::index);
+    if (palette.empty()) {
+        std::ranges::fill(out.data, Index{});
+        return;
+    }
+
+    trace::count("distance_evaluations", image.pixel_count() * palette.size());
+
+    parallel::for_each_band(std::size_t(image.height), palettize_min_rows(image.width), [&](std::size_t rowBegin, std::size_t rowEnd) {
+        auto nearest = nearest_search{palette};
 
-    for (auto idx : indices) {
-        if (idx >= palette.size()) {
-            continue;
+        for (auto yy = int(rowBegin); yy < int(rowEnd); ++yy) {
+            const auto* pixel = image.row(yy).data();
+            for (auto& index : out.row(yy)) {
+                index = Index(nearest(pixel));
+                pixel += rgba_channels;
+            }
         }
+    });
+}
+
+template void image::palettize<std::uint8_t>(const buffer<float>& image, const std::vector<color_type>& palette, buffer<std::uint8_t>& out) noexcept;
+template void image::palettize<std::uint16_t>(const buffer<float>& image, const std::vector<color_type>& palette, buffer<std::uint16_t>& out) noexcept;
+template void image::palettize<std::uint32_t>(const buffer<float>& image, const std::vector<color_type>& palette, buffer<std::uint32_t>& out) noexcept;
+
+image::palette_lookup::palette_lookup(std::vector<std::array<float, 4>> palette, const std::vector<color_format::component_type>& format, float pow) noexcept :
+    m_palette{std::move(palette)} {
+    const auto channels = color_format::to_rgba_channels(format);
 
-        const auto color = palette[idx];
-        result.emplace_back(color[0]);
-        result.emplace_back(color[1]);
-        result.emplace_back(color[2]);
-        result.emplace_back(color[3]);
+    // Keys use the same thresholds as packer::channel_table, so a pixel keys to the codes to_data packs it to
+    for (auto ii = std::size_t{}; ii < m_channels.size(); ++ii) {
+        auto& channel = m_channels[ii];
+        const auto mask = channels[ii].mask();
+        m_exact = m_exact || !mask;
+        channel.shift = m_keyBits;
+        channel.bits = std::size_t(channels[ii].size());
+        m_keyBits += channel.bits;
+
+        channel.thresholds = packer::code_thresholds(channels[ii], pow);
+        channel.levels.resize(std::size_t(mask) + 1);
+        for (auto level = 0; level <= mask; ++level) {
+            channel.levels[std::size_t(level)] = mask ? std::pow(float(level) / float(mask), 1.0f / pow) : 0.0f;
+        }
     }
 
-    return result;
+    if (!m_exact && !m_palette.empty() && m_keyBits <= max_table_bits) {
+        m_table = std::make_unique<std::atomic<std::uint32_t>[]>(std::size_t{1} << m_keyBits);
+        for (auto ii = std::size_t{}; ii < (std::size_t{1} << m_keyBits); ++ii) {
+            m_table[ii].store(unknown_index, std::memory_order_relaxed);
+        }
+    }
 }
 
-std::vector<color_type> image::gamma_pow(const std::vector<std::array<float, 4>>& image, float gamma) noexcept {
-    auto result = std::vector<std::array<float, 4>>{};
-    result.reserve(image.size());
+template <typename Index>
+void image::palette_lookup::palettize(const buffer<float>& image, buffer<Index>& out) const noexcept {
+    if (m_exact) {
+        image::palettize(image, m_palette, out);
+        return;
+    }
 
-    for (auto& v : image) {
-        result.push_back(std::array<float, 4>{
-            util::pow_clamp(v[0], gamma),
-            util::pow_clamp(v[1], gamma),
-            util::pow_clamp(v[2], gamma),
-            v[3]
-        });
+    out.reshape(image.width, image.height, layout::index);
+    if (m_palette.empty()) {
+        std::ranges::fill(out.data, Index{});
+        return;
     }
 
-    return result;
-}
+    const auto key_of = [&](const float* pixel) {
+        auto key = std::uint64_t{};
+        for (auto ii = std::size_t{}; ii < m_channels.size(); ++ii) {
+            const auto& thresholds = m_channels[ii].thresholds;
+            const auto level = std::upper_bound(thresholds.cbegin(), thresholds.cend(), pixel[ii]) - thresholds.cbegin();
+            key |= std::uint64_t(level) << m_channels[ii].shift;
+        }
+        return key;
+    };
 
-static auto directional_for(int low, int high, int dir, auto lambda) noexcept {
-    if (dir < 0) {
-        for (int ii = high - 1; ii >= low; --ii) {
-            lambda(ii);
+    // Every pixel of a key takes the index nearest the color the key packs from, so the result doesn't depend on which pixel was seen first
+    const auto nearest_of = [&](nearest_search& nearest, std::uint64_t key) {
+        auto color = color_type{};
+        for (auto ii = std::size_t{}; ii < m_channels.size(); ++ii) {
+            const auto level = std::size_t((key >> m_channels[ii].shift) & ((std::uint64_t{1} << m_channels[ii].bits) - 1));
+            color[ii] = m_channels[ii].levels[level];
         }
-    } else {
-        for (int ii = low; ii < high; ++ii) {
-            lambda(ii);
+        color[3] = 1.0f;
+        return std::uint32_t(nearest(color.data()));
+    };
+
+    auto searches = std::atomic<std::size_t>{};
+    parallel::for_each_band(std::size_t(image.height), palettize_min_rows(image.width), [&](std::size_t rowBegin, std::size_t rowEnd) {
+        auto nearest = nearest_search{m_palette};
+        // Formats too wide for the table remember recent colors in a direct-mapped memo, which costs little more than a search when colors rarely repeat
+        auto memo = std::vector<std::pair<std::uint64_t, std::uint32_t>>(m_table ? 0 : memo_size, {unknown_key, 0});
+        auto misses = std::size_t{};
+
+        for (auto yy = int(rowBegin); yy < int(rowEnd); ++yy) {
+            const auto* pixel = image.row(yy).data();
+            for (auto& index : out.row(yy)) {
+                const auto key = key_of(pixel);
+                pixel += rgba_channels;
+
+                if (m_table) {
+                    // Bands racing on a key store the same index
+                    auto found = m_table[key].load(std::memory_order_relaxed);
+                    if (found == unknown_index) {
+                        found = nearest_of(nearest, key);
+                        m_table[key].store(found, std::memory_order_relaxed);
+                        ++misses;
+                    }
+                    index = Index(found);
+                    continue;
+                }
+
+                auto& entry = memo[(key * 0x9e3779b97f4a7c15) >> (64 - memo_bits)];
+                if (entry.first != key) {
+                    entry = {key, nearest_of(nearest, key)};
+                    ++misses;
+                }
+                index = Index(entry.second);
+            }
+        }
+        searches += misses;
+    });
+
+    trace::count("lookups", image.pixel_count());
+    trace::count("distance_evaluations", searches * m_palette.size());
+}
+
+template void image::palette_lookup::palettize<std::uint8_t>(const buffer<float>& image, buffer<std::uint8_t>& out) const noexcept;
+template void image::palette_lookup::palettize<std::uint16_t>(const buffer<float>& image, buffer<std::uint16_t>& out) const noexcept;
+template void image::palette_lookup::palettize<std::uint32_t>(const buffer<float>& image, buffer<std::uint32_t>& out) const noexcept;
+
+template <typename Index>
+void image::expand(const buffer<Index>& indices, const std::vector<std::array<float, 4>>& palette, buffer<float>& out) noexcept {
+    out.reshape(indices.width, indices.height, layout::rgba);
+
+    for (int yy = 0; yy < indices.height; ++yy) {
+        auto* dst = out.row(yy).data();
+
+        for (auto idx : indices.row(yy)) {
+            if (idx < palette.size()) {
+                dst = std::ranges::copy(palette[idx], dst).out;
+            } else {
+                dst = std::fill_n(dst, rgba_channels, 0.0f);
+            }
         }
     }
 }
 
+template void image::expand<std::uint8_t>(const buffer<std::uint8_t>& indices, const std::vector<std::array<float, 4>>& palette, buffer<float>& out) noexcept;
+template void image::expand<std::uint16_t>(const buffer<std::uint16_t>& indices, const std::vector<std::array<float, 4>>& palette, buffer<float>& out) noexcept;
+template void image::expand<std::uint32_t>(const buffer<std::uint32_t>& indices, const std::vector<std::array<float, 4>>& palette, buffer<float>& out) noexcept;
+
+void image::gamma_pow(std::vector<std::array<float, 4>>& palette, float gamma) noexcept {
+    for (auto& v : palette) {
+        v[0] = util::pow_clamp(v[0], gamma);
+        v[1] = util::pow_clamp(v[1], gamma);
+        v[2] = util::pow_clamp(v[2], gamma);
+    }
+}
+
 std::pair<image::direction, image::direction> image::direction_pair(const std::string& str) noexcept {
     if (str.length() != 4) {
         return {direction::plus_x, direction::plus_x};
@@ -254,50 +516,140 @@ std::pair<image::direction, image::direction> image::direction_pair(const std::s
     return {v[0], v[1]};
 }
 
-std::vector<float> image::orientate(const std::vector<float>& image, int width, int height, image::direction major, image::direction minor) noexcept {
-    auto result = std::vector<float>{};
-    result.reserve(image.size());
+namespace {
 
-    const int majorStride = -1 + (2 * (major == direction::plus_x || major == direction::plus_y));
-    const int minorStride = -1 + (2 * (minor == direction::plus_x || minor == direction::plus_y));
+    // Pixels along each side of the squares a transpose moves at once, so the rows it reads and the rows it writes both stay in cache
+    constexpr auto transpose_tile = 32;
 
-    if (major == direction::plus_x || major == direction::minus_x) {
-        directional_for(0, height, minorStride, [&](auto yy) {
-            directional_for(0, width, majorStride, [&](auto xx) {
-                result.emplace_back(image[yy * width + xx]);
-            });
-        });
-    } else {
-        directional_for(0, width, majorStride, [&](auto xx) {
-            directional_for(0, height, minorStride, [&](auto yy) {
-                result.emplace_back(image[yy * width + xx]);
-            });
-        });
+    [[nodiscard]]
+    constexpr bool is_reversed(image::direction d) noexcept {
+        return d == image::direction::minus_x || d == image::direction::minus_y;
+    }
+
+    // Output rows [rowBegin, rowEnd) of image::orientate, into rows of dst dstStride elements apart
+    template <std::size_t Channels, typename T>
+    void orientate_rows(const image::buffer<T>& image, image::direction major, image::direction minor, int rowBegin, int rowEnd, T* dst, std::size_t dstStride) noexcept {
+        const auto majorReversed = is_reversed(major);
+        const auto minorReversed = is_reversed(minor);
+
+        // Output rows are source rows, each copied whole or mirrored
+        if (image::is_x_axis(major)) {
+            for (auto row = rowBegin; row < rowEnd; ++row, dst += dstStride) {
+                const auto* src = image.row(minorReversed ? image.height - 1 - row : row).data();
+                if (!majorReversed) {
+                    std::copy_n(src, std::size_t(image.width) * Channels, dst);
+                    continue;
+                }
+
+                for (auto xx = std::size_t{}; xx < std::size_t(image.width); ++xx) {
+                    std::copy_n(src + ((std::size_t(image.width) - 1 - xx) * Channels), Channels, dst + (xx * Channels));
+                }
+            }
+            return;
+        }
+
+        // Output rows are source columns, moved a tile at a time
+        for (auto tileRow = rowBegin; tileRow < rowEnd; tileRow += transpose_tile) {
+            const auto tileRowEnd = std::min(tileRow + transpose_tile, rowEnd);
+
+            for (auto tileColumn = 0; tileColumn < image.height; tileColumn += transpose_tile) {
+                const auto tileColumnEnd = std::min(tileColumn + transpose_tile, image.height);
+
+                for (auto column = tileColumn; column < tileColumnEnd; ++column) {
+                    const auto* src = image.row(minorReversed ? image.height - 1 - column : column).data();
+                    auto* out = dst + (std::size_t(tileRow - rowBegin) * dstStride) + (std::size_t(column) * Channels);
+                    for (auto row = tileRow; row < tileRowEnd; ++row, out += dstStride) {
+                        const auto xx = majorReversed ? image.width - 1 - row : row;
+                        std::copy_n(src + (std::size_t(xx) * Channels), Channels, out);
+                    }
+                }
+            }
+        }
+    }
+
+    // Swaps each pixel of a with the pixel as far from the end of b, which mirrors a row when a and b are the same row
+    template <std::size_t Channels, typename T>
+    void swap_mirrored(T* a, T* b, std::size_t width) noexcept {
+        const auto count = a == b ? width / 2 : width;
+        for (auto xx = std::size_t{}; xx < count; ++xx) {
+            auto* left = a + (xx * Channels);
+            auto* right = b + ((width - 1 - xx) * Channels);
+            for (auto cc = std::size_t{}; cc < Channels; ++cc) {
+                std::swap(left[cc], right[cc]);
+            }
+        }
     }
 
-    return result;
 }
 
-std::vector<std::size_t> image::orientate(const std::vector<std::size_t>& image, int width, int height, image::direction major, image::direction minor) noexcept {
-    auto result = std::vector<std::size_t>{};
-    result.reserve(image.size());
+template <typename T>
+void image::orientate_rows(const buffer<T>& image, direction major, direction minor, int rowBegin, int rowEnd, buffer<T>& out) noexcept {
+    out.reshape(is_x_axis(major) ? image.width : image.height, rowEnd - rowBegin, image.layout);
 
-    const int majorStride = -1 + (2 * (major == direction::plus_x || major == direction::plus_y));
-    const int minorStride = -1 + (2 * (minor == direction::plus_x || minor == direction::plus_y));
+    parallel::for_each_band(std::size_t(rowEnd - rowBegin), transpose_tile, [&](std::size_t bandBegin, std::size_t bandEnd) {
+        auto* dst = out.data.data() + (bandBegin * out.stride);
+        if (image.channels() == 1) {
+            ::orientate_rows<1>(image, major, minor, rowBegin + int(bandBegin), rowBegin + int(bandEnd), dst, out.stride);
+        } else {
+            ::orientate_rows<4>(image, major, minor, rowBegin + int(bandBegin), rowBegin + int(bandEnd), dst, out.stride);
+        }
+    });
+}
 
-    if (major == direction::plus_x || major == direction::minus_x) {
-        directional_for(0, height, minorStride, [&](auto yy) {
-            directional_for(0, width, majorStride, [&](auto xx) {
-                result.emplace_back(image[yy * width + xx]);
-            });
-        });
-    } else {
-        directional_for(0, width, majorStride, [&](auto xx) {
-            directional_for(0, height, minorStride, [&](auto yy) {
-                result.emplace_back(image[yy * width + xx]);
-            });
-        });
+template <typename T>
+void image::orientate(const buffer<T>& image, image::direction major, image::direction minor, buffer<T>& out) noexcept {
+    orientate_rows(image, major, minor, 0, is_x_axis(major) ? image.height : image.width, out);
+}
+
+template <typename T>
+void image::orientate_in_place(buffer<T>& image, direction major, direction minor, buffer<T>& scratch) noexcept {
+    if (is_normal(major, minor)) {
+        return;
+    } else if (!is_x_axis(major)) {
+        orientate(image, major, minor, scratch);
+        std::swap(image, scratch);
+        return;
     }
 
-    return result;
+    // Each band swaps rows from the top with their partners from the bottom, mirroring them in the same pass
+    const auto majorReversed = is_reversed(major);
+    const auto minorReversed = is_reversed(minor);
+    const auto swap_mirrored = [&](T* a, T* b) {
+        if (image.channels() == 1) {
+            ::swap_mirrored<1>(a, b, std::size_t(image.width));
+        } else {
+            ::swap_mirrored<4>(a, b, std::size_t(image.width));
+        }
+    };
+
+    const auto minRows = std::max(std::size_t{16384} / std::max(image.stride, std::size_t{1}), std::size_t{1});
+    parallel::for_each_band(std::size_t(image.height + 1) / 2, minRows, [&](std::size_t pairBegin, std::size_t pairEnd) {
+        for (auto top = int(pairBegin); top < int(pairEnd); ++top) {
+            auto* upper = image.row(top).data();
+            auto* lower = image.row(image.height - 1 - top).data();
+            if (majorReversed && minorReversed) {
+                swap_mirrored(upper, lower);
+            } else if (minorReversed) {
+                std::swap_ranges(upper, upper + image.stride, lower);
+            } else {
+                swap_mirrored(upper, upper);
+                if (upper != lower) {
+                    swap_mirrored(lower, lower);
+                }
+            }
+        }
+    });
 }
+
+template void image::orientate_rows<float>(const buffer<float>& image, direction major, direction minor, int rowBegin, int rowEnd, buffer<float>& out) noexcept;
+template void image::orientate_rows<std::uint8_t>(const buffer<std::uint8_t>& image, direction major, direction minor, int rowBegin, int rowEnd, buffer<std::uint8_t>& out) noexcept;
+template void image::orientate_rows<std::uint16_t>(const buffer<std::uint16_t>& image, direction major, direction minor, int rowBegin, int rowEnd, buffer<std::uint16_t>& out) noexcept;
+template void image::orientate_rows<std::uint32_t>(const buffer<std::uint32_t>& image, direction major, direction minor, int rowBegin, int rowEnd, buffer<std::uint32_t>& out) noexcept;
+template void image::orientate<float>(const buffer<float>& image, direction major, direction minor, buffer<float>& out) noexcept;
+template void image::orientate<std::uint8_t>(const buffer<std::uint8_t>& image, direction major, direction minor, buffer<std::uint8_t>& out) noexcept;
+template void image::orientate<std::uint16_t>(const buffer<std::uint16_t>& image, direction major, direction minor, buffer<std::uint16_t>& out) noexcept;
+template void image::orientate<std::uint32_t>(const buffer<std::uint32_t>& image, direction major, direction minor, buffer<std::uint32_t>& out) noexcept;
+template void image::orientate_in_place<float>(buffer<float>& image, direction major, direction minor, buffer<float>& scratch) noexcept;
+template void image::orientate_in_place<std::uint8_t>(buffer<std::uint8_t>& image, direction major, direction minor, buffer<std::uint8_t>& scratch) noexcept;
+template void image::orientate_in_place<std::uint16_t>(buffer<std::uint16_t>& image, direction major, direction minor, buffer<std::uint16_t>& scratch) noexcept;
+template void image::orientate_in_place<std::uint32_t>(buffer<std::uint32_t>& image, direction major, direction minor, buffer<std::uint32_t>& scratch) noexcept;
@@ -1,9 +1,13 @@
 #include <ctopt.hpp>
 #include <fmt/format.h>
 
+#include "batch.hpp"
 #include "bitmap.hpp"
 #include "logging.hpp"
+#include "tiles.hpp"
 #include "options.hpp"
+#include "sequence.hpp"
+#include "serve.hpp"
 
 int main(int argc, char* argv[]) {
     using namespace options;
@@ -30,8 +34,11 @@ int main(int argc, char* argv[]) {
         return 0;
     }
 
+    static const auto printer = vlog::sink_type{[](std::string_view message) {
+        fmt::print("- {}\n", message);
+    }};
     if (args.get<bool>("verbose")) {
-        vlog::verbose = true;
+        vlog::sink = &printer;
     }
 
     if (args.cbegin() != args.cend()) {
@@ -39,16 +46,21 @@ int main(int argc, char* argv[]) {
         if (*args.cbegin() == "bitmap") {
             return bitmap(++args.cbegin(), args.cend());
         }
+        if (*args.cbegin() == "tiles") {
+            return tiles(++args.cbegin(), args.cend());
+        }
+        if (*args.cbegin() == "sequence") {
+            return sequence(++args.cbegin(), args.cend());
+        }
+        if (*args.cbegin() == "batch") {
+            return batch(++args.cbegin(), args.cend());
+        }
+        if (*args.cbegin() == "serve") {
+            return serve(++args.cbegin(), args.cend());
+        }
     }
 
     fmt::print(stderr, "No command given\n");
     fmt::print("{}", help_str);
     return 1;
 }
-
-#define STB_IMAGE_IMPLEMENTATION
-#define STB_IMAGE_RESIZE_IMPLEMENTATION
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include <stb_image.h>
-#include <stb_image_resize.h>
-#include <stb_image_write.h>
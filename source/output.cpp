@@ -0,0 +1,324 @@
+#include "output.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#include <fmt/format.h>
+
+#if defined(_WIN32)
+#   define WIN32_LEAN_AND_MEAN
+#   define NOMINMAX
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+#if defined(_WIN32)
+    void* const no_file = nullptr;
+#else
+    constexpr auto no_file = -1;
+#endif
+
+}
+
+static fs::path temporary_path(const fs::path& path);
+
+output::mapped_file::~mapped_file() noexcept {
+    discard();
+}
+
+output::mapped_file::mapped_file(mapped_file&& other) noexcept {
+    *this = std::move(other);
+}
+
+output::mapped_file& output::mapped_file::operator=(mapped_file&& other) noexcept {
+    if (this != &other) {
+        discard();
+        m_path = std::move(other.m_path);
+        m_temporary = std::exchange(other.m_temporary, {});
+        m_file = std::exchange(other.m_file, no_file);
+#if defined(_WIN32)
+        m_mapping = std::exchange(other.m_mapping, nullptr);
+#endif
+        m_data = std::exchange(other.m_data, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+    }
+    return *this;
+}
+
+bool output::mapped_file::create(const fs::path& path) noexcept {
+    discard();
+    m_path = path;
+    m_temporary = temporary_path(path);
+
+#if defined(_WIN32)
+    const auto file = CreateFileW(m_temporary.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        m_temporary.clear();
+        return false;
+    }
+    m_file = file;
+#else
+    m_file = ::open(m_temporary.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (m_file < 0) {
+        m_temporary.clear();
+        return false;
+    }
+#endif
+    return true;
+}
+
+bool output::mapped_file::map(std::size_t size) noexcept {
+    unmap();
+    if (m_temporary.empty()) {
+        return false;
+    }
+    if (!size) {
+        return true; // Nothing to map, the file is already empty
+    }
+
+#if defined(_WIN32)
+    // The mapping extends the file to its size
+    const auto high = static_cast<DWORD>(std::uint64_t(size) >> 32);
+    const auto low = static_cast<DWORD>(size);
+    m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READWRITE, high, low, nullptr);
+    if (!m_mapping) {
+        return false;
+    }
+
+    auto* data = MapViewOfFile(m_mapping, FILE_MAP_WRITE, 0, 0, size);
+    if (!data) {
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+        return false;
+    }
+#else
+    if (::ftruncate(m_file, static_cast<off_t>(size)) != 0) {
+        return false;
+    }
+
+    auto* data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_file, 0);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+#endif
+
+    m_data = static_cast<std::byte*>(data);
+    m_size = size;
+    return true;
+}
+
+bool output::mapped_file::append(std::span<const std::byte> bytes) noexcept {
+    if (m_temporary.empty() || m_data) {
+        return false;
+    }
+
+    // Writes may be partial, so loop until every byte is out
+    while (!bytes.empty()) {
+#if defined(_WIN32)
+        auto written = DWORD{};
+        const auto size = static_cast<DWORD>(std::min(bytes.size(), std::size_t{0x40000000}));
+        if (!WriteFile(m_file, bytes.data(), size, &written, nullptr)) {
+            return false;
+        }
+#else
+        const auto written = ::write(m_file, bytes.data(), bytes.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+#endif
+        bytes = bytes.subspan(std::size_t(written));
+    }
+    return true;
+}
+
+bool output::mapped_file::sync() noexcept {
+    if (m_temporary.empty()) {
+        return false;
+    }
+
+#if defined(_WIN32)
+    if (m_data && !FlushViewOfFile(m_data, 0)) {
+        return false;
+    }
+    return FlushFileBuffers(m_file) != 0;
+#else
+    if (m_data && ::msync(m_data, m_size, MS_SYNC) != 0) {
+        return false;
+    }
+    return ::fsync(m_file) == 0;
+#endif
+}
+
+bool output::mapped_file::commit() noexcept {
+    if (!sync()) {
+        discard();
+        return false;
+    }
+
+    close();
+
+    auto ec = std::error_code{};
+    fs::rename(m_temporary, m_path, ec);
+    if (ec) {
+        fs::remove(m_temporary, ec);
+        m_temporary.clear();
+        return false;
+    }
+
+    m_temporary.clear();
+    return true;
+}
+
+void output::mapped_file::discard() noexcept {
+    if (m_temporary.empty()) {
+        return;
+    }
+
+    close();
+
+    auto ec = std::error_code{};
+    fs::remove(m_temporary, ec);
+    m_temporary.clear();
+}
+
+void output::mapped_file::close() noexcept {
+    unmap();
+#if defined(_WIN32)
+    CloseHandle(m_file);
+#else
+    ::close(m_file);
+#endif
+    m_file = no_file;
+}
+
+void output::mapped_file::unmap() noexcept {
+#if defined(_WIN32)
+    if (m_data) {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_mapping) {
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+    }
+#else
+    if (m_data) {
+        ::munmap(m_data, m_size);
+    }
+#endif
+    m_data = nullptr;
+    m_size = 0;
+}
+
+bool output::plan::add(std::string_view name, const char* path) noexcept {
+    auto file = mapped_file{};
+    if (!file.create(path)) {
+        fmt::print(stderr, "Could not write file {}", path);
+        return false;
+    }
+
+    m_entries.push_back({name, path, std::move(file)});
+    return true;
+}
+
+bool output::plan::contains(std::string_view name) const noexcept {
+    return std::ranges::find(m_entries, name, &entry_type::name) != m_entries.cend();
+}
+
+std::optional<std::span<std::byte>> output::plan::map(std::string_view name, std::size_t size) noexcept {
+    auto* entry = find(name);
+    if (!entry) {
+        return std::nullopt;
+    }
+
+    if (!entry->file.map(size)) {
+        fmt::print(stderr, "Could not write file {}", entry->path);
+        return std::nullopt;
+    }
+    return entry->file.data();
+}
+
+bool output::plan::write(std::string_view name, std::span<const std::byte> bytes) noexcept {
+    const auto data = map(name, bytes.size());
+    if (!data) {
+        return false;
+    }
+
+    if (!bytes.empty()) {
+        std::memcpy(data->data(), bytes.data(), bytes.size());
+    }
+    return true;
+}
+
+bool output::plan::append(std::string_view name, std::span<const std::byte> bytes) noexcept {
+    auto* entry = find(name);
+    if (!entry) {
+        return false;
+    }
+
+    if (!entry->file.append(bytes)) {
+        fmt::print(stderr, "Could not write file {}", entry->path);
+        return false;
+    }
+    return true;
+}
+
+bool output::plan::commit() noexcept {
+    for (auto& entry : m_entries) {
+        if (!entry.file.sync()) {
+            fmt::print(stderr, "Could not write file {}", entry.path);
+            m_entries.clear(); // Discards every temporary file
+            return false;
+        }
+    }
+
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+        if (it->file.commit()) {
+            continue;
+        }
+
+        fmt::print(stderr, "Could not write file {}", it->path);
+        if (it != m_entries.begin()) {
+            auto replaced = std::string{};
+            for (auto done = m_entries.begin(); done != it; ++done) {
+                replaced += fmt::format("{}{}", replaced.empty() ? "" : ", ", done->path);
+            }
+            fmt::print(stderr, " after replacing {}", replaced);
+        }
+        m_entries.clear();
+        return false;
+    }
+    return true;
+}
+
+output::plan::entry_type* output::plan::find(std::string_view name) noexcept {
+    const auto it = std::ranges::find(m_entries, name, &entry_type::name);
+    return it != m_entries.end() ? &*it : nullptr;
+}
+
+static fs::path temporary_path(const fs::path& path) {
+    static auto counter = std::atomic<std::size_t>{};
+
+    // Beside the output, so the rename stays within one file system
+    const auto thread = std::hash<std::thread::id>{}(std::this_thread::get_id());
+    const auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+    auto result = path;
+    result += fmt::format(".tmp-{:x}-{:x}-{}", thread, now, counter++);
+    return result;
+}
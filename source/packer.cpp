@@ -0,0 +1,201 @@
+#include "packer.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace {
+
+    // {low size, low shift, high size, high shift} of the R, G, B, A channels
+    using channel_layout = std::array<std::size_t, 4>;
+
+    struct layout_type {
+        std::array<channel_layout, 4> channels;
+        std::size_t bits;
+    };
+
+    // Compile-time mirror of color_format::parse for well-formed format strings
+    consteval layout_type make_layout(std::string_view format) {
+        auto result = layout_type{};
+
+        struct component {
+            std::size_t channel;
+            bool high;
+            std::size_t size;
+            std::size_t shift;
+        };
+        auto components = std::array<component, 8>{};
+        auto count = std::size_t{};
+        auto pending = std::size_t{};
+
+        for (auto ii = std::size_t{}; ii < format.size();) {
+            const auto c = format[ii];
+            if (c >= '0' && c <= '9') {
+                auto size = std::size_t{};
+                while (ii < format.size() && format[ii] >= '0' && format[ii] <= '9') {
+                    size = (size * 10) + std::size_t(format[ii++] - '0');
+                }
+                for (auto jj = count - pending; jj < count; ++jj) {
+                    components[jj].size = size;
+                    components[jj].shift = result.bits;
+                    result.bits += size;
+                }
+                pending = 0;
+                continue;
+            }
+
+            const auto lower = char(c | 0x20);
+            const auto channel = std::string_view("rgba").find(lower);
+            components[count++] = component{channel, c != lower, 0, 0};
+            ++pending;
+            ++ii;
+        }
+
+        for (auto ii = std::size_t{}; ii < count; ++ii) {
+            const auto& comp = components[ii];
+            const auto shift = result.bits - comp.size - comp.shift; // Flip to big-endian
+            auto& layout = result.channels[comp.channel];
+            if (comp.high) {
+                layout[2] = comp.size;
+                layout[3] = shift;
+            } else {
+                layout[0] = comp.size;
+                layout[1] = shift;
+            }
+        }
+
+        return result;
+    }
+
+    [[nodiscard]]
+    constexpr std::size_t mask(std::size_t size) noexcept {
+        return (std::size_t{1} << size) - 1;
+    }
+
+    template <channel_layout Channel>
+    constexpr void shift_bits(std::size_t& pixel, std::size_t bits) noexcept {
+        if constexpr (Channel[0] != 0) {
+            pixel |= (bits & mask(Channel[0])) << Channel[1];
+        }
+        if constexpr (Channel[2] != 0) {
+            pixel |= ((bits >> Channel[0]) & mask(Channel[2])) << Channel[3];
+        }
+    }
+
+    template <layout_type Layout>
+    void pack_rows(const image::buffer<float>& image, std::size_t rowBegin, std::size_t rowEnd, const packer::channel_tables& tables, stbi_uc* out) {
+        static constexpr auto bytes_per_pixel = (Layout.bits + 7) / 8;
+        static constexpr auto alpha_size = Layout.channels[3][0] + Layout.channels[3][2];
+        static constexpr auto has_channel = [](std::size_t ii) {
+            return (Layout.channels[ii][0] + Layout.channels[ii][2]) != 0;
+        };
+
+        auto* dest = out + (rowBegin * std::size_t(image.width) * bytes_per_pixel);
+
+        for (auto yy = rowBegin; yy < rowEnd; ++yy) {
+            const auto* src = image.row(int(yy)).data();
+
+            for (int xx = 0; xx < image.width; ++xx, src += 4, dest += bytes_per_pixel) {
+                auto pixel = std::size_t{};
+
+                if constexpr (has_channel(0)) {
+                    shift_bits<Layout.channels[0]>(pixel, std::size_t(tables[0](src[0])));
+                }
+                if constexpr (has_channel(1)) {
+                    shift_bits<Layout.channels[1]>(pixel, std::size_t(tables[1](src[1])));
+                }
+                if constexpr (has_channel(2)) {
+                    shift_bits<Layout.channels[2]>(pixel, std::size_t(tables[2](src[2])));
+                }
+                if constexpr (alpha_size != 0) {
+                    static constexpr auto alpha_mask = int(mask(alpha_size));
+                    const auto alpha = std::clamp(int(std::round(src[3] * float(alpha_mask))), 0, alpha_mask);
+                    shift_bits<Layout.channels[3]>(pixel, std::size_t(alpha));
+                }
+
+                std::memcpy(dest, &pixel, bytes_per_pixel);
+            }
+        }
+    }
+
+    struct specialization {
+        layout_type layout;
+        packer::pack_rows_func func;
+    };
+
+    template <layout_type Layout>
+    constexpr auto specialize() noexcept {
+        return specialization{Layout, &pack_rows<Layout>};
+    }
+
+    // The formats we ship
+    const auto specializations = std::array{
+        specialize<make_layout("g1BGR5")>(),
+        specialize<make_layout("BGR5")>(),
+        specialize<make_layout("BGRA8")>(),
+        specialize<make_layout("ABGR8")>(), // PNG output
+        specialize<make_layout("A8R8G8B8")>(),
+        specialize<make_layout("R8")>()
+    };
+
+    [[nodiscard]]
+    bool matches(const layout_type& layout, const color_format::color_channel_type& channel, std::size_t ii) noexcept {
+        const auto& [lowSize, lowShift, highSize, highShift] = layout.channels[ii];
+        return lowSize == channel.low.size && highSize == channel.high.size &&
+            (!lowSize || lowShift == channel.low.shift) &&
+            (!highSize || highShift == channel.high.shift);
+    }
+
+}
+
+std::vector<float> packer::code_thresholds(const color_format::color_channel_type& channel, float pow) noexcept {
+    const auto maxCode = std::size_t(channel.mask());
+    auto result = std::vector<float>{};
+    result.reserve(maxCode);
+
+    // Conversion is monotonic over (0, 1], so each code begins at a single threshold
+    const auto lowBits = std::bit_cast<std::uint32_t>(0.0f);
+    const auto highBits = std::bit_cast<std::uint32_t>(1.0f);
+    for (auto code = std::size_t{1}; code <= maxCode; ++code) {
+        auto lo = result.empty() ? lowBits : std::bit_cast<std::uint32_t>(result.back());
+        auto hi = highBits;
+        while (lo < hi) {
+            const auto mid = lo + ((hi - lo) / 2);
+            if (std::size_t(channel.pow(std::bit_cast<float>(mid), pow)) >= code) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+        result.emplace_back(std::bit_cast<float>(lo));
+    }
+    return result;
+}
+
+packer::channel_table::channel_table(const color_format::color_channel_type& channel, float pow) noexcept :
+    m_channel{channel}, m_pow{pow}, m_thresholds{code_thresholds(channel, pow)}, m_buckets{} {
+    auto next = std::size_t{};
+    for (auto bucket = std::size_t{}; bucket <= bucket_count; ++bucket) {
+        while (next < m_thresholds.size() && std::size_t(m_thresholds[next] * float(bucket_count)) < bucket) {
+            ++next;
+        }
+        m_buckets[bucket] = next;
+    }
+}
+
+packer::pack_rows_func packer::find(const std::vector<color_format::component_type>& format) noexcept {
+    const auto channels = color_format::to_rgba_channels(format);
+
+    for (const auto& [layout, func] : specializations) {
+        auto same = true;
+        for (auto ii = std::size_t{}; ii < channels.size(); ++ii) {
+            same = same && matches(layout, channels[ii], ii);
+        }
+        if (same) {
+            return func;
+        }
+    }
+    return nullptr;
+}
@@ -2,7 +2,7 @@
 
 #include <algorithm>
 #include <charconv>
-#include <fstream>
+#include <cstdint>
 #include <iterator>
 #include <limits>
 #include <map>
@@ -11,41 +11,131 @@
 #include <sstream>
 #include <string>
 #include <string_view>
+#include <tuple>
+#include <unordered_map>
 
 #include <fmt/format.h>
 
+#include "image_io.hpp"
+#include "logging.hpp"
+#include "trace.hpp"
 #include "util.hpp"
 
-static auto to_bits(const std::array<color_format::color_channel_type, 4>& channels, std::array<float, 4> x) noexcept -> std::size_t;
-
-std::vector<std::array<float, 4>> palette::extract(const std::vector<color_format::component_type>& format, const std::vector<float>& image, int width, int height) noexcept {
-    using color = std::array<float, 4>;
+palette::histogram_type palette::extract(const std::vector<color_format::component_type>& format, const image::buffer<float>& image) noexcept {
+    // Formats up to this many bits count into a flat array indexed by packed value, wider ones into a hash table
+    static constexpr auto max_dense_bits = std::size_t{24};
 
     const auto channels = color_format::to_rgba_channels(format);
+    const auto bits = std::accumulate(std::cbegin(channels), std::cend(channels), std::size_t{}, [](auto acc, const auto& c) {
+        acc += c.size();
+        return acc;
+    });
+
+    const auto pixels = image.pixel_count();
+    const auto color_at = [&image](std::size_t idx) {
+        const auto width = std::size_t(image.width);
+        const auto* pixel = image.row(int(idx / width)).data() + ((idx % width) * 4);
+        return std::array<float, 4>{pixel[0], pixel[1], pixel[2], pixel[3]};
+    };
 
-    const auto color_compare = [&channels](color lhs, color rhs) {
-        return to_bits(channels, lhs) < to_bits(channels, rhs);
+    const auto for_each_pixel = [&image](auto func) {
+        auto idx = std::size_t{};
+        for (int yy = 0; yy < image.height; ++yy) {
+            const auto row = image.row(yy);
+            for (auto xx = std::size_t{}; xx < row.size(); xx += 4, ++idx) {
+                func(idx, std::array<float, 4>{row[xx + 0], row[xx + 1], row[xx + 2], row[xx + 3]});
+            }
+        }
     };
 
-    auto result = std::set<color, decltype(color_compare)>{color_compare};
-
-    const int stride = width * 4;
-    for (int yy = 0; yy < height; ++yy) {
-        for (int xx = 0; xx < stride; xx += 4) {
-            const auto col = color{
-                image[yy * stride + xx + 0],
-                image[yy * stride + xx + 1],
-                image[yy * stride + xx + 2],
-                image[yy * stride + xx + 3]
-            };
-            result.emplace(col);
+    // Packed value, first pixel index, count
+    auto uniques = std::vector<std::tuple<std::size_t, std::size_t, std::size_t>>{};
+
+    // Dense counting only pays off when the array isn't much larger than the image
+    if (bits <= 16 || (bits <= max_dense_bits && (std::size_t{1} << bits) <= pixels * 8)) {
+        auto counts = std::vector<std::uint32_t>(std::size_t{1} << bits);
+        auto firsts = std::vector<std::pair<std::size_t, std::size_t>>{};
+
+        for_each_pixel([&](std::size_t idx, const auto& color) {
+            const auto key = to_bits(channels, color);
+            if (!counts[key]++) {
+                firsts.emplace_back(key, idx);
+            }
+        });
+
+        uniques.reserve(firsts.size());
+        for (const auto& [key, first] : firsts) {
+            uniques.emplace_back(key, first, counts[key]);
+        }
+    } else {
+        auto table = std::unordered_map<std::size_t, std::pair<std::size_t, std::size_t>>{};
+        table.reserve(std::min(pixels, std::size_t{1} << 16));
+
+        for_each_pixel([&](std::size_t idx, const auto& color) {
+            const auto [it, inserted] = table.try_emplace(to_bits(channels, color), idx, 0);
+            ++it->second.second;
+        });
+
+        uniques.reserve(table.size());
+        for (const auto& [key, entry] : table) {
+            uniques.emplace_back(key, entry.first, entry.second);
         }
     }
 
-    return std::vector<std::array<float, 4>>{std::cbegin(result), std::cend(result)};
+    std::ranges::sort(uniques, {}, [](const auto& u) {
+        return std::get<0>(u);
+    });
+
+    // Each unique color is represented by its first occurrence
+    auto result = histogram_type{};
+    result.colors.reserve(uniques.size());
+    result.counts.reserve(uniques.size());
+    for (const auto& [key, first, count] : uniques) {
+        result.colors.emplace_back(color_at(first));
+        result.counts.emplace_back(count);
+    }
+
+    return result;
 }
 
-static auto to_bits(const std::array<color_format::color_channel_type, 4>& channels, std::array<float, 4> x) noexcept -> std::size_t {
+void palette::merge(const std::vector<color_format::component_type>& format, histogram_type& histogram, const histogram_type& other) noexcept {
+    const auto channels = color_format::to_rgba_channels(format);
+
+    // Both are ordered by packed value, and a color always packs to the value it was counted under
+    const auto keys = [&](const histogram_type& h) {
+        auto result = std::vector<std::size_t>{};
+        result.reserve(h.colors.size());
+        for (const auto& color : h.colors) {
+            result.emplace_back(to_bits(channels, color));
+        }
+        return result;
+    };
+    const auto lhsKeys = keys(histogram);
+    const auto rhsKeys = keys(other);
+
+    auto result = histogram_type{};
+    result.colors.reserve(histogram.colors.size() + other.colors.size());
+    result.counts.reserve(histogram.colors.size() + other.colors.size());
+
+    auto lhs = std::size_t{};
+    auto rhs = std::size_t{};
+    while (lhs < lhsKeys.size() || rhs < rhsKeys.size()) {
+        if (rhs == rhsKeys.size() || (lhs < lhsKeys.size() && lhsKeys[lhs] < rhsKeys[rhs])) {
+            result.colors.emplace_back(histogram.colors[lhs]);
+            result.counts.emplace_back(histogram.counts[lhs++]);
+        } else if (lhs == lhsKeys.size() || rhsKeys[rhs] < lhsKeys[lhs]) {
+            result.colors.emplace_back(other.colors[rhs]);
+            result.counts.emplace_back(other.counts[rhs++]);
+        } else { // Same color, keep the earlier occurrence
+            result.colors.emplace_back(histogram.colors[lhs]);
+            result.counts.emplace_back(histogram.counts[lhs++] + other.counts[rhs++]);
+        }
+    }
+
+    histogram = std::move(result);
+}
+
+std::size_t palette::to_bits(const std::array<color_format::color_channel_type, 4>& channels, std::array<float, 4> x) noexcept {
     const auto red = std::clamp(static_cast<int>(std::round(x[0] * static_cast<float>(channels[0].mask()))), 0, channels[0].mask());
     const auto green = std::clamp(static_cast<int>(std::round(x[1] * static_cast<float>(channels[1].mask()))), 0, channels[1].mask());
     const auto blue = std::clamp(static_cast<int>(std::round(x[2] * static_cast<float>(channels[2].mask()))), 0, channels[2].mask());
@@ -60,6 +150,20 @@ using color_type = std::array<float, 4>;
 using palette_type = std::vector<color_type>;
 
 std::vector<std::array<float, 4>> palette::quantize(const std::vector<std::array<float, 4>>& palette, int colors) noexcept {
+    const auto maxColors = std::min(palette.size(), std::size_t(colors));
+
+    auto clusterCenters = std::vector<color_type>(maxColors);
+    auto rng = std::mt19937{};
+    rng.seed(0xF3BCC909);
+    auto dist = std::uniform_int_distribution<std::size_t>{0, palette.size() - 1};
+    for (auto& center : clusterCenters) {
+        center = palette[dist(rng)];
+    }
+
+    return kmeans(palette, std::move(clusterCenters));
+}
+
+std::vector<std::array<float, 4>> palette::kmeans(const std::vector<std::array<float, 4>>& palette, std::vector<std::array<float, 4>> clusterCenters) noexcept {
     static constexpr auto square_distance = [](color_type a, color_type b) {
         const auto c = std::array<float, 3>{
             a[0] - b[0],
@@ -69,19 +173,23 @@ std::vector<std::array<float, 4>> palette::quantize(const std::vector<std::array
         return (c[0] * c[0]) + (c[1] * c[1]) + (c[2] * c[2]);
     };
 
-    const auto maxColors = std::min(palette.size(), std::size_t(colors));
+    const auto maxColors = clusterCenters.size();
 
-    auto clusterCenters = std::vector<color_type>(maxColors);
-    auto rng = std::mt19937{};
-    rng.seed(0xF3BCC909);
-    auto dist = std::uniform_int_distribution<std::size_t>{0, palette.size() - 1};
-    for (auto& center : clusterCenters) {
-        center = palette[dist(rng)];
-    }
+    const auto span = trace::scope{"kmeans"};
+    trace::count("colors", palette.size());
+
+    // Running sums replace per-iteration cluster lists; members are still summed in palette order
+    auto sums = std::vector<color_type>(maxColors);
+    auto counts = std::vector<std::size_t>(maxColors);
 
     for (auto iter = std::size_t{}; iter < 100; ++iter) {
+        std::ranges::fill(sums, color_type{});
+        std::ranges::fill(counts, std::size_t{});
+
+        trace::count("iterations", 1);
+        trace::count("distance_evaluations", palette.size() * maxColors);
+
         // Assign each data point to the nearest cluster center
-        auto clusters = std::vector<palette_type>(maxColors);
         for (const auto& color : palette) {
             auto minDistance = std::numeric_limits<double>::max();
             auto minIndex = std::size_t{};
@@ -92,29 +200,27 @@ std::vector<std::array<float, 4>> palette::quantize(const std::vector<std::array
                     minIndex = ii;
                 }
             }
-            clusters[minIndex].push_back(color);
+
+            auto& sum = sums[minIndex];
+            sum[0] += color[0];
+            sum[1] += color[1];
+            sum[2] += color[2];
+            sum[3] += color[3];
+            ++counts[minIndex];
         }
 
         // Update the cluster centers to the mean of the assigned data points
         auto converged = true;
         for (auto ii = std::size_t{}; ii < maxColors; ++ii) {
-            if (clusters[ii].empty()) {
+            if (!counts[ii]) {
                 continue;
             }
 
-            auto newCenter = color_type{};
-
-            for (const auto& color : clusters[ii]) {
-                newCenter[0] += color[0];
-                newCenter[1] += color[1];
-                newCenter[2] += color[2];
-                newCenter[3] += color[3];
-            }
-
-            newCenter[0] /= float(clusters[ii].size());
-            newCenter[1] /= float(clusters[ii].size());
-            newCenter[2] /= float(clusters[ii].size());
-            newCenter[3] /= float(clusters[ii].size());
+            auto newCenter = sums[ii];
+            newCenter[0] /= float(counts[ii]);
+            newCenter[1] /= float(counts[ii]);
+            newCenter[2] /= float(counts[ii]);
+            newCenter[3] /= float(counts[ii]);
 
             if (newCenter != clusterCenters[ii]) {
                 converged = false;
@@ -130,18 +236,47 @@ std::vector<std::array<float, 4>> palette::quantize(const std::vector<std::array
     return clusterCenters;
 }
 
-static std::map<std::string, std::string> parse_gpl_meta(std::ifstream& file) noexcept;
+static std::map<std::string, std::string> parse_gpl_meta(std::istream& file) noexcept;
 static std::string trim(const std::string& str) noexcept;
-static palette_type parse_gpl_entries(std::ifstream& file, std::vector<std::string>& names) noexcept;
+static palette_type parse_gpl_entries(std::istream& file, std::vector<std::string>& names) noexcept;
 
-palette_type palette::gpl_load(const char* path, std::string& name, int& columns) noexcept {
-    name = "";
-    columns = 0;
+palette_type palette::load(std::span<const std::byte> bytes, const std::vector<color_format::component_type>& format, float gamma) noexcept {
+    int width, height, components;
+    const auto pal = image::load(bytes, width, height, components);
+
+    if (pal) {
+        vlog::print("Extracting palette from image with gamma {}", [&](){return fmt::make_format_args(gamma);});
+        auto linear = image::buffer<float>{};
+        image::to_float({pal.get(), std::size_t(width) * std::size_t(height) * 4}, width, height, gamma, linear);
+        return extract(format, linear).colors;
+    }
+
+    std::string name;
+    int columns;
+    auto stream = std::istringstream{std::string{reinterpret_cast<const char*>(bytes.data()), bytes.size()}};
+    auto palette = gpl_load(stream, name, columns);
+    if (palette.empty()) { // Retry as binary
+        vlog::print("Loading binary palette", [](){return fmt::make_format_args();});
+        return binary_load(bytes, format);
+    }
 
-    auto file = std::ifstream(path);
-    if (!file.is_open()) {
+    vlog::print("Loaded GPL palette (Name: {} Columns: {})", [&](){return fmt::make_format_args(name, columns);});
+    image::gamma_pow(palette, gamma);
+    return palette;
+}
+
+palette_type palette::load(const char* path, const std::vector<color_format::component_type>& format, float gamma) noexcept {
+    vlog::print("Reading palette {}", [&](){return fmt::make_format_args(path);});
+    const auto bytes = util::read_file(path);
+    if (!bytes) {
         return {};
     }
+    return load(*bytes, format, gamma);
+}
+
+palette_type palette::gpl_load(std::istream& file, std::string& name, int& columns) noexcept {
+    name = "";
+    columns = 0;
 
     auto line = std::string{};
     std::getline(file, line);
@@ -157,13 +292,10 @@ palette_type palette::gpl_load(const char* path, std::string& name, int& columns
 
     // Parse color entries
     auto names = std::vector<std::string>{};
-    auto result = parse_gpl_entries(file, names);
-
-    file.close();
-    return result;
+    return parse_gpl_entries(file, names);
 }
 
-static std::map<std::string, std::string> parse_gpl_meta(std::ifstream& file) noexcept {
+static std::map<std::string, std::string> parse_gpl_meta(std::istream& file) noexcept {
     auto meta = std::map<std::string, std::string>{};
 
     auto line = std::string{};
@@ -194,7 +326,7 @@ static std::string trim(const std::string& str) noexcept {
     return str.substr(first, last - first + 1);
 }
 
-static palette_type parse_gpl_entries(std::ifstream& file, std::vector<std::string>& names) noexcept {
+static palette_type parse_gpl_entries(std::istream& file, std::vector<std::string>& names) noexcept {
     auto result = palette_type{};
 
     auto line = std::string{};
@@ -255,12 +387,7 @@ static palette_type parse_gpl_entries(std::ifstream& file, std::vector<std::stri
 
 static std::array<std::size_t, 4> from_bits(const std::array<color_format::color_channel_type, 4>& format, std::size_t bits) noexcept;
 
-palette_type palette::binary_load(const char* path, const std::vector<color_format::component_type>& format) noexcept {
-    auto file = std::ifstream(path, std::ios::binary);
-    if (!file.is_open()) {
-        return {};
-    }
-
+palette_type palette::binary_load(std::span<const std::byte> bytes, const std::vector<color_format::component_type>& format) noexcept {
     const auto channels = color_format::to_rgba_channels(format);
     const auto bpp = std::accumulate(std::cbegin(channels), std::cend(channels), std::size_t{}, [](auto acc, const color_format::color_channel_type& c) {
         acc += c.size();
@@ -270,16 +397,13 @@ palette_type palette::binary_load(const char* path, const std::vector<color_form
 
     auto result = std::set<std::array<std::size_t, 4>>{};
 
-    auto value = std::array<char, sizeof(std::size_t)>{};
-    while (file.read(value.data(), bytePerPixel)) {
+    for (auto offset = std::size_t{}; offset + std::size_t(bytePerPixel) <= bytes.size(); offset += std::size_t(bytePerPixel)) {
         auto bits = std::size_t{};
-        std::memcpy(&bits, value.data(), bytePerPixel);
+        std::memcpy(&bits, bytes.data() + offset, bytePerPixel);
 
         result.emplace(from_bits(channels, bits));
     }
 
-    file.close();
-
     auto palette = palette_type{};
     palette.reserve(result.size());
 
@@ -0,0 +1,451 @@
+#include "palette.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+
+using color_type = std::array<float, 4>;
+using palette_type = std::vector<color_type>;
+
+namespace {
+
+    [[nodiscard]]
+    auto weight_of(std::span<const std::size_t> weights, std::size_t idx) noexcept {
+        return weights.empty() ? 1.0 : double(weights[idx]);
+    }
+
+    // Weighted RGBA mean accumulator
+    struct color_sum {
+        void add(const color_type& c, double w) noexcept {
+            for (auto ii = 0; ii < 4; ++ii) {
+                sum[ii] += double(c[ii]) * w;
+            }
+            weight += w;
+        }
+
+        void add(const color_sum& other) noexcept {
+            for (auto ii = 0; ii < 4; ++ii) {
+                sum[ii] += other.sum[ii];
+            }
+            weight += other.weight;
+        }
+
+        [[nodiscard]]
+        color_type mean() const noexcept {
+            return color_type{
+                float(sum[0] / weight),
+                float(sum[1] / weight),
+                float(sum[2] / weight),
+                float(sum[3] / weight)
+            };
+        }
+
+        std::array<double, 4> sum{};
+        double weight{};
+    };
+
+}
+
+std::optional<palette::quantizer> palette::parse_quantizer(std::string_view name) noexcept {
+    if (name == "kmeans") return quantizer::kmeans;
+    if (name == "median-cut") return quantizer::median_cut;
+    if (name == "octree") return quantizer::octree;
+    if (name == "wu") return quantizer::wu;
+    return std::nullopt;
+}
+
+palette_type palette::quantize(const palette_type& palette, int colors, quantizer method, bool refine, std::span<const std::size_t> weights) noexcept {
+    if (palette.empty() || colors <= 0) {
+        return {};
+    }
+
+    auto result = [&]() {
+        switch (method) {
+            case quantizer::median_cut:
+                return median_cut(palette, weights, colors);
+            case quantizer::octree:
+                return octree(palette, weights, colors);
+            case quantizer::wu:
+                return wu(palette, weights, colors);
+            case quantizer::kmeans:
+                break;
+        }
+        return quantize(palette, colors);
+    }();
+
+    if (refine && method != quantizer::kmeans) {
+        result = kmeans(palette, std::move(result));
+    }
+    return result;
+}
+
+palette_type palette::median_cut(const palette_type& palette, std::span<const std::size_t> weights, int colors) noexcept {
+    struct box_type {
+        std::size_t begin;
+        std::size_t end;
+        int axis;
+        double score;
+    };
+
+    auto order = std::vector<std::size_t>(palette.size());
+    std::iota(order.begin(), order.end(), std::size_t{});
+
+    const auto make_box = [&](std::size_t begin, std::size_t end) {
+        auto low = color_type{1.0f, 1.0f, 1.0f, 1.0f};
+        auto high = color_type{0.0f, 0.0f, 0.0f, 0.0f};
+        auto weight = 0.0;
+        for (auto ii = begin; ii < end; ++ii) {
+            const auto& c = palette[order[ii]];
+            for (auto ch = 0; ch < 3; ++ch) {
+                low[ch] = std::min(low[ch], c[ch]);
+                high[ch] = std::max(high[ch], c[ch]);
+            }
+            weight += weight_of(weights, order[ii]);
+        }
+
+        auto axis = 0;
+        for (auto ch = 1; ch < 3; ++ch) {
+            if (high[ch] - low[ch] > high[axis] - low[axis]) {
+                axis = ch;
+            }
+        }
+
+        const auto range = double(high[axis] - low[axis]);
+        const auto score = (end - begin > 1 && range > 0.0) ? range * range * weight : 0.0;
+        return box_type{begin, end, axis, score};
+    };
+
+    auto boxes = std::vector<box_type>{make_box(0, order.size())};
+    boxes.reserve(std::size_t(colors));
+
+    while (boxes.size() < std::size_t(colors)) {
+        const auto it = std::ranges::max_element(boxes, {}, &box_type::score);
+        if (it->score <= 0.0) {
+            break; // Nothing left to split
+        }
+
+        const auto box = *it;
+        const auto first = order.begin() + std::ptrdiff_t(box.begin);
+        const auto last = order.begin() + std::ptrdiff_t(box.end);
+        std::sort(first, last, [&](auto lhs, auto rhs) {
+            return palette[lhs][box.axis] < palette[rhs][box.axis];
+        });
+
+        // Split at the weighted median, keeping at least one color on each side
+        auto total = 0.0;
+        for (auto ii = box.begin; ii < box.end; ++ii) {
+            total += weight_of(weights, order[ii]);
+        }
+
+        auto split = box.begin + 1;
+        for (auto acc = weight_of(weights, order[box.begin]); split < box.end - 1 && acc < total / 2.0; ++split) {
+            acc += weight_of(weights, order[split]);
+        }
+
+        *it = make_box(box.begin, split);
+        boxes.emplace_back(make_box(split, box.end));
+    }
+
+    auto result = palette_type{};
+    result.reserve(boxes.size());
+    for (const auto& box : boxes) {
+        auto sum = color_sum{};
+        for (auto ii = box.begin; ii < box.end; ++ii) {
+            sum.add(palette[order[ii]], weight_of(weights, order[ii]));
+        }
+        result.emplace_back(sum.mean());
+    }
+    return result;
+}
+
+palette_type palette::octree(const palette_type& palette, std::span<const std::size_t> weights, int colors) noexcept {
+    static constexpr auto max_depth = 8;
+
+    struct node_type {
+        std::array<std::uint32_t, 8> children{}; // 0 is the root, so doubles as "no child"
+        color_sum sum{};
+        bool leaf{};
+    };
+
+    auto nodes = std::vector<node_type>(1);
+    auto levels = std::array<std::vector<std::uint32_t>, max_depth>{}; // Internal nodes by depth
+    levels[0].emplace_back(0);
+    auto leaves = std::size_t{};
+
+    for (auto ii = std::size_t{}; ii < palette.size(); ++ii) {
+        const auto& c = palette[ii];
+        const auto w = weight_of(weights, ii);
+
+        const auto r = std::clamp(int(std::round(c[0] * 255.0f)), 0, 255);
+        const auto g = std::clamp(int(std::round(c[1] * 255.0f)), 0, 255);
+        const auto b = std::clamp(int(std::round(c[2] * 255.0f)), 0, 255);
+
+        auto current = std::uint32_t{};
+        nodes[current].sum.add(c, w);
+        for (auto depth = 0; depth < max_depth; ++depth) {
+            const auto shift = max_depth - 1 - depth;
+            const auto child = (((r >> shift) & 1) << 2) | (((g >> shift) & 1) << 1) | ((b >> shift) & 1);
+
+            if (!nodes[current].children[child]) {
+                const auto idx = std::uint32_t(nodes.size());
+                nodes[current].children[child] = idx;
+                nodes.emplace_back();
+                if (depth + 1 == max_depth) {
+                    nodes.back().leaf = true;
+                    ++leaves;
+                } else {
+                    levels[depth + 1].emplace_back(idx);
+                }
+            }
+
+            current = nodes[current].children[child];
+            nodes[current].sum.add(c, w);
+        }
+    }
+
+    // Fold the lightest nodes of the deepest level into leaves until the palette fits
+    for (auto depth = max_depth - 1; depth >= 0 && leaves > std::size_t(colors); --depth) {
+        auto& level = levels[depth];
+        std::ranges::sort(level, [&](auto lhs, auto rhs) {
+            return nodes[lhs].sum.weight < nodes[rhs].sum.weight;
+        });
+
+        for (auto idx : level) {
+            if (leaves <= std::size_t(colors)) {
+                break;
+            }
+
+            auto& node = nodes[idx];
+            auto children = std::size_t{};
+            for (auto& child : node.children) {
+                if (child) {
+                    ++children;
+                    child = 0;
+                }
+            }
+            node.leaf = true;
+            leaves -= children - 1;
+        }
+    }
+
+    auto result = palette_type{};
+    result.reserve(leaves);
+
+    auto stack = std::vector<std::uint32_t>{0};
+    while (!stack.empty()) {
+        const auto& node = nodes[stack.back()];
+        stack.pop_back();
+
+        if (node.leaf) {
+            result.emplace_back(node.sum.mean());
+            continue;
+        }
+        for (auto child : node.children) {
+            if (child) {
+                stack.emplace_back(child);
+            }
+        }
+    }
+    return result;
+}
+
+namespace {
+
+    // Xiaolin Wu, "Efficient Statistical Computations for Optimal Color Quantization", Graphics Gems II
+    constexpr auto wu_bits = 5;
+    constexpr auto wu_side = (1 << wu_bits) + 1;
+
+    [[nodiscard]]
+    constexpr auto wu_index(int r, int g, int b) noexcept {
+        return std::size_t((r * wu_side * wu_side) + (g * wu_side) + b);
+    }
+
+    struct wu_box {
+        std::array<int, 3> low; // Exclusive
+        std::array<int, 3> high; // Inclusive
+    };
+
+    struct wu_moments {
+        wu_moments() noexcept : weight(wu_side * wu_side * wu_side), red(weight.size()), green(weight.size()), blue(weight.size()), square(weight.size()) {}
+
+        std::vector<double> weight;
+        std::vector<double> red;
+        std::vector<double> green;
+        std::vector<double> blue;
+        std::vector<double> square;
+    };
+
+    [[nodiscard]]
+    double volume(const wu_box& box, const std::vector<double>& m) noexcept {
+        const auto& [r0, g0, b0] = box.low;
+        const auto& [r1, g1, b1] = box.high;
+        return m[wu_index(r1, g1, b1)] - m[wu_index(r1, g1, b0)] - m[wu_index(r1, g0, b1)] + m[wu_index(r1, g0, b0)]
+             - m[wu_index(r0, g1, b1)] + m[wu_index(r0, g1, b0)] + m[wu_index(r0, g0, b1)] - m[wu_index(r0, g0, b0)];
+    }
+
+    [[nodiscard]]
+    double variance(const wu_box& box, const wu_moments& m) noexcept {
+        const auto r = volume(box, m.red);
+        const auto g = volume(box, m.green);
+        const auto b = volume(box, m.blue);
+        const auto w = volume(box, m.weight);
+        if (w <= 0.0) {
+            return 0.0;
+        }
+        return volume(box, m.square) - (((r * r) + (g * g) + (b * b)) / w);
+    }
+
+    // Best cut position along axis, maximizing the between-class variance of the two halves
+    [[nodiscard]]
+    std::pair<double, int> maximize(const wu_box& box, int axis, const wu_moments& m, const std::array<double, 4>& whole) noexcept {
+        auto best = 0.0;
+        auto cut = -1;
+        for (auto pos = box.low[axis] + 1; pos < box.high[axis]; ++pos) {
+            auto lower = box;
+            lower.high[axis] = pos;
+
+            auto half = std::array<double, 4>{
+                volume(lower, m.red),
+                volume(lower, m.green),
+                volume(lower, m.blue),
+                volume(lower, m.weight)
+            };
+            if (half[3] <= 0.0) {
+                continue;
+            }
+            auto temp = ((half[0] * half[0]) + (half[1] * half[1]) + (half[2] * half[2])) / half[3];
+
+            for (auto ii = 0; ii < 4; ++ii) {
+                half[ii] = whole[ii] - half[ii];
+            }
+            if (half[3] <= 0.0) {
+                continue;
+            }
+            temp += ((half[0] * half[0]) + (half[1] * half[1]) + (half[2] * half[2])) / half[3];
+
+            if (temp > best) {
+                best = temp;
+                cut = pos;
+            }
+        }
+        return {best, cut};
+    }
+
+    [[nodiscard]]
+    bool cut(wu_box& box1, wu_box& box2, const wu_moments& m) noexcept {
+        const auto whole = std::array<double, 4>{
+            volume(box1, m.red),
+            volume(box1, m.green),
+            volume(box1, m.blue),
+            volume(box1, m.weight)
+        };
+
+        auto bestAxis = -1;
+        auto bestCut = -1;
+        auto bestValue = 0.0;
+        for (auto axis = 0; axis < 3; ++axis) {
+            const auto [value, pos] = maximize(box1, axis, m, whole);
+            if (pos >= 0 && value > bestValue) {
+                bestValue = value;
+                bestAxis = axis;
+                bestCut = pos;
+            }
+        }
+
+        if (bestAxis < 0) {
+            return false; // Box can't be split
+        }
+
+        box2.high = box1.high;
+        box2.low = box1.low;
+        box1.high[bestAxis] = bestCut;
+        box2.low[bestAxis] = bestCut;
+        return true;
+    }
+
+}
+
+palette_type palette::wu(const palette_type& palette, std::span<const std::size_t> weights, int colors) noexcept {
+    static constexpr auto cell = [](float x) {
+        return std::clamp(int(x * float(1 << wu_bits)), 0, (1 << wu_bits) - 1) + 1;
+    };
+
+    auto m = wu_moments{};
+    for (auto ii = std::size_t{}; ii < palette.size(); ++ii) {
+        const auto& c = palette[ii];
+        const auto w = weight_of(weights, ii);
+        const auto idx = wu_index(cell(c[0]), cell(c[1]), cell(c[2]));
+        m.weight[idx] += w;
+        m.red[idx] += double(c[0]) * w;
+        m.green[idx] += double(c[1]) * w;
+        m.blue[idx] += double(c[2]) * w;
+        m.square[idx] += ((double(c[0]) * c[0]) + (double(c[1]) * c[1]) + (double(c[2]) * c[2])) * w;
+    }
+
+    // Cumulative moments, so the moment of any box is an 8-corner lookup
+    for (auto* moment : {&m.weight, &m.red, &m.green, &m.blue, &m.square}) {
+        auto& v = *moment;
+        for (auto r = 1; r < wu_side; ++r) {
+            auto area = std::array<double, wu_side>{};
+            for (auto g = 1; g < wu_side; ++g) {
+                auto line = 0.0;
+                for (auto b = 1; b < wu_side; ++b) {
+                    line += v[wu_index(r, g, b)];
+                    area[b] += line;
+                    v[wu_index(r, g, b)] = v[wu_index(r - 1, g, b)] + area[b];
+                }
+            }
+        }
+    }
+
+    auto boxes = std::vector<wu_box>{wu_box{{0, 0, 0}, {wu_side - 1, wu_side - 1, wu_side - 1}}};
+    auto variances = std::vector<double>{0.0};
+    boxes.reserve(std::size_t(colors));
+
+    auto next = std::size_t{};
+    while (boxes.size() < std::size_t(colors)) {
+        auto box2 = wu_box{};
+        if (cut(boxes[next], box2, m)) {
+            boxes.emplace_back(box2);
+            variances.emplace_back(0.0);
+            variances[next] = variance(boxes[next], m);
+            variances.back() = variance(boxes.back(), m);
+        } else {
+            variances[next] = 0.0;
+        }
+
+        next = std::size_t(std::ranges::max_element(variances) - variances.begin());
+        if (variances[next] <= 0.0) {
+            break; // Every box is a single cell or a single color
+        }
+    }
+
+    // Average the original colors in each box (alpha isn't part of the cut, so it's only gathered here)
+    auto tags = std::vector<std::uint32_t>(wu_side * wu_side * wu_side);
+    for (auto ii = std::size_t{}; ii < boxes.size(); ++ii) {
+        const auto& box = boxes[ii];
+        for (auto r = box.low[0] + 1; r <= box.high[0]; ++r) {
+            for (auto g = box.low[1] + 1; g <= box.high[1]; ++g) {
+                for (auto b = box.low[2] + 1; b <= box.high[2]; ++b) {
+                    tags[wu_index(r, g, b)] = std::uint32_t(ii);
+                }
+            }
+        }
+    }
+
+    auto sums = std::vector<color_sum>(boxes.size());
+    for (auto ii = std::size_t{}; ii < palette.size(); ++ii) {
+        const auto& c = palette[ii];
+        sums[tags[wu_index(cell(c[0]), cell(c[1]), cell(c[2]))]].add(c, weight_of(weights, ii));
+    }
+
+    auto result = palette_type{};
+    result.reserve(sums.size());
+    for (const auto& sum : sums) {
+        if (sum.weight > 0.0) {
+            result.emplace_back(sum.mean());
+        }
+    }
+    return result;
+}
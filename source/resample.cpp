@@ -0,0 +1,365 @@
+#include "resample.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <list>
+#include <mutex>
+
+#include "parallel.hpp"
+
+namespace {
+
+    constexpr auto channels = std::size_t{4};
+
+    // Kernels kept for reuse, a few for each of the sizes a batch converts between
+    constexpr auto max_kernels = std::size_t{64};
+
+    // Mitchell-Netravali cubic with parameters b and c
+    [[nodiscard]]
+    double cubic(double x, double b, double c) noexcept {
+        x = std::abs(x);
+        if (x < 1.0) {
+            return ((((12.0 - (9.0 * b) - (6.0 * c)) * x * x * x) + ((-18.0 + (12.0 * b) + (6.0 * c)) * x * x) + (6.0 - (2.0 * b))) / 6.0);
+        }
+        if (x < 2.0) {
+            return ((((-b - (6.0 * c)) * x * x * x) + (((6.0 * b) + (30.0 * c)) * x * x) + (((-12.0 * b) - (48.0 * c)) * x) + ((8.0 * b) + (24.0 * c))) / 6.0);
+        }
+        return 0.0;
+    }
+
+    // Reach of a filter either side, in samples of the lower resolution
+    [[nodiscard]]
+    double radius(resample::filter f) noexcept {
+        switch (f) {
+        case resample::filter::box:
+            return 0.5;
+        case resample::filter::triangle:
+            return 1.0;
+        default:
+            return 2.0;
+        }
+    }
+
+    [[nodiscard]]
+    double evaluate(resample::filter f, double x) noexcept {
+        switch (f) {
+        case resample::filter::triangle:
+            return std::max(1.0 - std::abs(x), 0.0);
+        case resample::filter::cubic:
+            return cubic(x, 1.0, 0.0);
+        case resample::filter::catmull_rom:
+            return cubic(x, 0.0, 0.5);
+        default:
+            return cubic(x, 1.0 / 3.0, 1.0 / 3.0);
+        }
+    }
+
+    // Normalized weights of one output over consecutive inputs from first
+    struct taps_type {
+        int first{};
+        std::vector<double> weights;
+    };
+
+    [[nodiscard]]
+    std::vector<taps_type> filter_taps(int inSize, int outSize, resample::filter f) noexcept {
+        const auto scale = double(outSize) / double(inSize);
+        if (f == resample::filter::automatic) {
+            f = scale >= 1.0 ? resample::filter::catmull_rom : resample::filter::mitchell;
+        }
+
+        // Box weights are the parts of each input the output covers, so whole ratios average whole inputs
+        const auto box = f == resample::filter::box;
+        const auto filterScale = box ? scale : std::min(scale, 1.0);
+        const auto reach = radius(f) / filterScale;
+
+        auto result = std::vector<taps_type>(std::size_t(outSize));
+        for (auto oo = 0; oo < outSize; ++oo) {
+            const auto center = (double(oo) + 0.5) / scale;
+            const auto lo = int(std::floor(center - reach));
+            const auto hi = int(std::ceil(center + reach));
+
+            // Samples past an edge repeat the edge sample
+            auto& taps = result[std::size_t(oo)];
+            taps.first = std::clamp(lo, 0, inSize - 1);
+            taps.weights.assign(std::size_t(std::clamp(hi, 0, inSize - 1) - taps.first + 1), 0.0);
+
+            auto sum = 0.0;
+            for (auto ii = lo; ii <= hi; ++ii) {
+                const auto weight = box ?
+                    std::max(std::min(double(ii + 1), center + reach) - std::max(double(ii), center - reach), 0.0) :
+                    evaluate(f, (double(ii) + 0.5 - center) * filterScale);
+                taps.weights[std::size_t(std::clamp(ii, 0, inSize - 1) - taps.first)] += weight;
+                sum += weight;
+            }
+
+            for (auto& weight : taps.weights) {
+                weight /= sum;
+            }
+
+            // Interpolating at whole samples leaves zero weights, which needn't be read
+            while (taps.weights.size() > 1 && taps.weights.back() == 0.0) {
+                taps.weights.pop_back();
+            }
+            while (taps.weights.size() > 1 && taps.weights.front() == 0.0) {
+                taps.weights.erase(taps.weights.begin());
+                ++taps.first;
+            }
+        }
+        return result;
+    }
+
+    // Inputs each output averages, if every output averages that many from output * count, otherwise 0
+    [[nodiscard]]
+    int box_size(const std::vector<taps_type>& outputs) noexcept {
+        const auto size = outputs.front().weights.size();
+        for (auto oo = std::size_t{}; oo < outputs.size(); ++oo) {
+            const auto& taps = outputs[oo];
+            if (taps.weights.size() != size || std::size_t(taps.first) != oo * size) {
+                return 0;
+            }
+            for (const auto weight : taps.weights) {
+                if (std::abs(weight - (1.0 / double(size))) > 1e-9) {
+                    return 0;
+                }
+            }
+        }
+        return int(size);
+    }
+
+    // Kernel with the taps of each channel of each output, over one window covering all four
+    [[nodiscard]]
+    resample::kernel_type interleave(int inSize, const std::vector<std::array<taps_type, channels>>& outputs) noexcept {
+        auto result = resample::kernel_type{};
+        result.first.reserve(outputs.size());
+        for (const auto& output : outputs) {
+            auto first = inSize;
+            auto last = 0;
+            for (const auto& taps : output) {
+                first = std::min(first, taps.first);
+                last = std::max(last, taps.first + int(taps.weights.size()));
+            }
+            result.first.push_back(first);
+            result.taps = std::max(result.taps, last - first);
+        }
+
+        // Every output reads the same number of taps, its window moved back from the end where it would run past it
+        result.weights.assign(outputs.size() * std::size_t(result.taps) * channels, 0.0f);
+        for (auto oo = std::size_t{}; oo < outputs.size(); ++oo) {
+            result.first[oo] = std::max(std::min(result.first[oo], inSize - result.taps), 0);
+
+            auto* weights = result.weights.data() + (oo * std::size_t(result.taps) * channels);
+            for (auto cc = std::size_t{}; cc < channels; ++cc) {
+                const auto& taps = outputs[oo][cc];
+                for (auto tt = std::size_t{}; tt < taps.weights.size(); ++tt) {
+                    const auto tap = std::size_t(taps.first - result.first[oo]) + tt;
+                    weights[(tap * channels) + cc] = float(taps.weights[tt]);
+                }
+            }
+        }
+        return result;
+    }
+
+    // Average of the taps of several samples
+    [[nodiscard]]
+    taps_type average(std::initializer_list<const taps_type*> samples) noexcept {
+        auto result = taps_type{};
+        auto last = 0;
+        result.first = (*samples.begin())->first;
+        for (const auto* taps : samples) {
+            result.first = std::min(result.first, taps->first);
+            last = std::max(last, taps->first + int(taps->weights.size()));
+        }
+
+        result.weights.assign(std::size_t(last - result.first), 0.0);
+        for (const auto* taps : samples) {
+            for (auto tt = std::size_t{}; tt < taps->weights.size(); ++tt) {
+                result.weights[std::size_t(taps->first - result.first) + tt] += taps->weights[tt] / double(samples.size());
+            }
+        }
+        return result;
+    }
+
+    struct key_type {
+        bool operator==(const key_type&) const noexcept = default;
+
+        int inSize;
+        int outSize;
+        resample::filter f;
+        bool subpixel;
+    };
+
+    // Kernel of key, built by build on first use, most recently used first
+    [[nodiscard]]
+    resample::shared_kernel cached(const key_type& key, auto build) noexcept {
+        static auto mutex = std::mutex{};
+        static auto entries = std::list<std::pair<key_type, resample::shared_kernel>>{};
+
+        {
+            const auto lock = std::scoped_lock{mutex};
+            const auto it = std::ranges::find(entries, key, &std::pair<key_type, resample::shared_kernel>::first);
+            if (it != entries.end()) {
+                entries.splice(entries.begin(), entries, it);
+                return it->second;
+            }
+        }
+
+        auto result = std::make_shared<const resample::kernel_type>(build());
+
+        const auto lock = std::scoped_lock{mutex};
+        const auto it = std::ranges::find(entries, key, &std::pair<key_type, resample::shared_kernel>::first);
+        if (it != entries.end()) { // Built concurrently by another conversion
+            return it->second;
+        }
+
+        entries.emplace_front(key, result);
+        if (entries.size() > max_kernels) {
+            entries.pop_back();
+        }
+        return result;
+    }
+
+    // Input row yy filtered vertically into column, returning the scale it still needs
+    [[nodiscard]]
+    float filter_column(const image::buffer<float>& rows, int inRowBegin, const resample::kernel_type& vertical, int yy, std::vector<float>& column) noexcept {
+        const auto first = vertical.first[std::size_t(yy)] - inRowBegin;
+
+        // Box rows are summed, leaving the average to the horizontal pass
+        if (vertical.box) {
+            std::ranges::copy(rows.row(first), column.begin());
+            for (auto tt = 1; tt < vertical.box; ++tt) {
+                const auto* src = rows.row(first + tt).data();
+                for (auto xx = std::size_t{}; xx < column.size(); ++xx) {
+                    column[xx] += src[xx];
+                }
+            }
+            return 1.0f / float(vertical.box);
+        }
+
+        const auto* verticalWeights = vertical.weights.data() + (std::size_t(yy) * std::size_t(vertical.taps) * channels);
+        std::ranges::fill(column, 0.0f);
+        for (auto tt = 0; tt < vertical.taps; ++tt) {
+            const auto* src = rows.row(first + tt).data();
+            const auto* weights = verticalWeights + (std::size_t(tt) * channels);
+            for (auto xx = std::size_t{}; xx < column.size(); xx += channels) {
+                for (auto cc = std::size_t{}; cc < channels; ++cc) {
+                    column[xx + cc] += weights[cc] * src[xx + cc];
+                }
+            }
+        }
+        return 1.0f;
+    }
+
+    // Row filtered horizontally from column into dst, scaled by scale
+    void filter_row(const std::vector<float>& column, const resample::kernel_type& horizontal, float scale, std::span<float> dst) noexcept {
+        const auto outWidth = horizontal.first.size();
+
+        if (horizontal.box) {
+            const auto box = std::size_t(horizontal.box);
+            scale /= float(box);
+            for (auto xx = std::size_t{}; xx < outWidth; ++xx) {
+                const auto* src = column.data() + (xx * box * channels);
+
+                auto sum = std::array<float, channels>{};
+                for (auto tt = std::size_t{}; tt < box * channels; tt += channels) {
+                    for (auto cc = std::size_t{}; cc < channels; ++cc) {
+                        sum[cc] += src[tt + cc];
+                    }
+                }
+                for (auto cc = std::size_t{}; cc < channels; ++cc) {
+                    dst[(xx * channels) + cc] = sum[cc] * scale;
+                }
+            }
+            return;
+        }
+
+        for (auto xx = std::size_t{}; xx < outWidth; ++xx) {
+            const auto* src = column.data() + (std::size_t(horizontal.first[xx]) * channels);
+            const auto* weights = horizontal.weights.data() + (xx * std::size_t(horizontal.taps) * channels);
+
+            auto sum = std::array<float, channels>{};
+            for (auto tt = std::size_t{}; tt < std::size_t(horizontal.taps) * channels; tt += channels) {
+                for (auto cc = std::size_t{}; cc < channels; ++cc) {
+                    sum[cc] += weights[tt + cc] * src[tt + cc];
+                }
+            }
+            for (auto cc = std::size_t{}; cc < channels; ++cc) {
+                dst[(xx * channels) + cc] = sum[cc] * scale;
+            }
+        }
+    }
+
+}
+
+std::optional<resample::filter> resample::parse_filter(std::string_view name) noexcept {
+    if (name == "auto") {
+        return filter::automatic;
+    } else if (name == "box") {
+        return filter::box;
+    } else if (name == "triangle") {
+        return filter::triangle;
+    } else if (name == "cubic") {
+        return filter::cubic;
+    } else if (name == "catmull-rom") {
+        return filter::catmull_rom;
+    } else if (name == "mitchell") {
+        return filter::mitchell;
+    }
+    return std::nullopt;
+}
+
+resample::shared_kernel resample::kernel(int inSize, int outSize, filter f) noexcept {
+    return cached({inSize, outSize, f, false}, [&]() {
+        const auto taps = filter_taps(inSize, outSize, f);
+
+        auto outputs = std::vector<std::array<taps_type, channels>>{};
+        outputs.reserve(taps.size());
+        for (const auto& output : taps) {
+            outputs.push_back({output, output, output, output});
+        }
+
+        auto result = interleave(inSize, outputs);
+        result.box = box_size(taps);
+        return result;
+    });
+}
+
+resample::shared_kernel resample::subpixel_kernel(int inSize, int outSize, filter f) noexcept {
+    return cached({inSize, outSize, f, true}, [&]() {
+        const auto subpixels = filter_taps(inSize, outSize * 3, f);
+
+        auto outputs = std::vector<std::array<taps_type, channels>>{};
+        outputs.reserve(std::size_t(outSize));
+        for (auto oo = std::size_t{}; oo < std::size_t(outSize); ++oo) {
+            const auto* left = &subpixels[(oo * 3) + 0];
+            const auto* center = &subpixels[(oo * 3) + 1];
+            const auto* right = &subpixels[(oo * 3) + 2];
+
+            const auto all = average({left, center, right});
+            outputs.push_back({average({center, right}), all, average({left, center}), all});
+        }
+        return interleave(inSize, outputs);
+    });
+}
+
+std::pair<int, int> resample::source_range(const kernel_type& k, int outBegin, int outEnd) noexcept {
+    const auto taps = k.box ? k.box : k.taps;
+    return {k.first[std::size_t(outBegin)], k.first[std::size_t(outEnd - 1)] + taps};
+}
+
+void resample::apply(const image::buffer<float>& rows, int inRowBegin, const kernel_type& horizontal, const kernel_type& vertical, int outRowBegin, int outRowEnd, image::buffer<float>& out) noexcept {
+    out.reshape(int(horizontal.first.size()), outRowEnd - outRowBegin, image::layout::rgba);
+
+    const auto inStride = std::size_t(rows.width) * channels;
+    const auto taps = std::size_t(vertical.box ? vertical.box : vertical.taps);
+    const auto minRows = std::max(std::size_t{16384} / std::max(inStride * taps, std::size_t{1}), std::size_t{1});
+    parallel::for_each_band(std::size_t(out.height), minRows, [&](std::size_t rowBegin, std::size_t rowEnd) {
+        auto column = std::vector<float>(inStride); // The output row filtered vertically, at the input width
+
+        for (auto yy = rowBegin; yy < rowEnd; ++yy) {
+            const auto scale = filter_column(rows, inRowBegin, vertical, outRowBegin + int(yy), column);
+            filter_row(column, horizontal, scale, out.row(int(yy)));
+        }
+    });
+}
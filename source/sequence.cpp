@@ -0,0 +1,488 @@
+#include "sequence.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <ctopt.hpp>
+#include <fmt/format.h>
+
+#include "decode_cache.hpp"
+#include "delta.hpp"
+#include "gfx2agb.hpp"
+#include "image_io.hpp"
+#include "logging.hpp"
+#include "options.hpp"
+#include "output.hpp"
+#include "parallel.hpp"
+#include "util.hpp"
+
+namespace {
+
+    template <std::floating_point T>
+    constexpr auto pc_display_sRGB = static_cast<T>(2.2);
+
+    constexpr auto png_components = 4;
+
+    constexpr auto gif_signature = std::string_view{"GIF8"};
+
+    // Numbers tried for the first numbered image when --first isn't given
+    constexpr auto default_firsts = std::array{0, 1};
+
+    // Path of a numbered image, for a pattern holding one %d or %0Nd, nullopt for any other pattern
+    std::optional<std::string> numbered_path(std::string_view pattern, int number) {
+        const auto percent = pattern.find('%');
+        if (percent == std::string_view::npos) {
+            return std::nullopt;
+        }
+
+        auto pos = percent + 1;
+        auto width = 0;
+        if (pos < pattern.size() && pattern[pos] == '0') {
+            const auto [end, ec] = std::from_chars(pattern.data() + pos + 1, pattern.data() + pattern.size(), width);
+            if (ec != std::errc{}) {
+                return std::nullopt;
+            }
+            pos = std::size_t(end - pattern.data());
+        }
+
+        if (pos >= pattern.size() || pattern[pos] != 'd' || pattern.find('%', pos) != std::string_view::npos) {
+            return std::nullopt;
+        }
+        return fmt::format("{}{:0{}}{}", pattern.substr(0, percent), number, width, pattern.substr(pos + 1));
+    }
+
+    // Frames of an animation, numbered images decoded only while converted, or every frame of a GIF decoded at once
+    struct frame_source {
+        std::vector<std::string> paths;
+        std::vector<image::shared_pixels> kept; // Numbered images decoded by an earlier pass and kept for the next
+        std::unique_ptr<stbi_uc[], void(*)(void*)> gif{nullptr, [](void*){}};
+        std::size_t count{};
+        int width{};
+        int height{};
+
+        // Calls func with the pixels of frame index, false if it can't be read or differs in size from the first frame
+        // A numbered image is kept for the next call on index while keptBytes stays within keepBytes, and that call releases it
+        bool with_frame(std::size_t index, auto func, std::atomic<std::size_t>* keptBytes = nullptr, std::size_t keepBytes = 0) {
+            const auto frameBytes = std::size_t(width) * std::size_t(height) * png_components;
+            if (gif) {
+                func(gfx2agb::rgba_image{std::as_bytes(std::span{gif.get() + (index * frameBytes), frameBytes}), width, height});
+                return true;
+            }
+
+            auto image = std::exchange(kept[index], {});
+            if (!image) {
+                int frameWidth, frameHeight, components;
+                image = image::load_shared(nullptr, paths[index].c_str(), frameWidth, frameHeight, components);
+                if (!image || frameWidth != width || frameHeight != height) {
+                    return false;
+                }
+            }
+            func(gfx2agb::rgba_image{std::as_bytes(std::span{image.get(), frameBytes}), width, height});
+
+            if (keptBytes && keptBytes->fetch_add(frameBytes) + frameBytes <= keepBytes) {
+                kept[index] = std::move(image);
+            }
+            return true;
+        }
+
+        // Name of frame index in messages
+        std::string name(std::size_t index) const {
+            return gif ? fmt::format("frame {}", index) : paths[index];
+        }
+    };
+
+    // Library options of parsed sequence arguments, as bitmap would set them
+    gfx2agb::bitmap_options to_options(const auto& args) {
+        auto options = gfx2agb::bitmap_options{};
+        options.mode = args.template get<int>("mode");
+        options.width = args.template get<std::optional<std::string>>("width").value_or("");
+        options.height = args.template get<std::optional<std::string>>("height").value_or("");
+        options.format = args.template get<std::string>("format");
+        std::tie(options.inGamma, options.outGamma) = [&]() {
+            const auto gamma = args.template get<std::pair<float, float>>("gamma");
+            if (std::get<1>(gamma) == 0.0f) {
+                return std::make_pair(pc_display_sRGB<float>, std::get<0>(gamma));
+            }
+            return gamma;
+        }();
+        options.bpp = args.template get<std::size_t>("bpp");
+        options.colors = args.template get<int>("colors");
+        options.quantizer = args.template get<std::string>("quantizer");
+        options.refine = args.template get<bool>("refine");
+        options.direction = args.template get<std::string>("direction");
+        options.antiAlias = args.template get<bool>("anti-alias");
+        options.filter = args.template get<std::string>("filter");
+        if (vlog::sink) {
+            options.log = *vlog::sink;
+        }
+        return options;
+    }
+
+    // Threads for_each_frame runs count frames on, as many as there are frames or hardware threads
+    std::size_t frame_threads(std::size_t count) noexcept {
+        return std::max(std::min(parallel::concurrency(), count), std::size_t{1});
+    }
+
+    // Calls func(index) for every frame, across frame_threads(count) threads
+    // Threads left over are split between the frames in flight
+    void for_each_frame(std::size_t count, auto func) {
+        const auto threadCount = frame_threads(count);
+        const auto threadsPerFrame = std::max(parallel::concurrency() / threadCount, std::size_t{1});
+
+        auto nextFrame = std::atomic<std::size_t>{};
+        const auto* sink = vlog::sink;
+        const auto worker = [&]() {
+            parallel::max_threads = threadsPerFrame;
+            vlog::sink = sink;
+            for (auto idx = nextFrame++; idx < count; idx = nextFrame++) {
+                func(idx);
+            }
+        };
+
+        auto threads = std::vector<std::thread>{};
+        for (auto ii = std::size_t{1}; ii < threadCount; ++ii) {
+            threads.emplace_back(worker);
+        }
+
+        const auto outerThreads = parallel::max_threads;
+        worker();
+        parallel::max_threads = outerThreads;
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+}
+
+static std::optional<frame_source> open_frames(const char* path, const std::optional<std::string>& first) noexcept;
+
+int sequence(ctopt::args::const_iterator begin, ctopt::args::const_iterator end) {
+    using namespace options;
+
+    const auto args = get_opts_sequence(std::move(begin), std::move(end));
+    if (!args) {
+        fmt::print(stderr, "{}\n", args.error_str());
+        fmt::print("{}", get_opts_sequence.help_str());
+        return 1;
+    }
+
+    const auto mode = args.get<int>("mode");
+    const auto* outputData = args.get<const char*>("out-data");
+    const auto* outputPaletteData = mode == 4 ? args.get<const char*>("out-palette-data") : nullptr;
+    if (!outputData && !outputPaletteData) {
+        fmt::print(stderr, "No outputs");
+        fmt::print("{}", get_opts_sequence.help_str());
+        return 1;
+    }
+
+    const auto granularityName = args.get<std::string>("granularity");
+    const auto granularity = delta::parse_granularity(granularityName);
+    if (!granularity) {
+        fmt::print(stderr, "Unknown granularity {} (expected word, scanline)", granularityName);
+        return 1;
+    }
+
+    auto settings = to_options(args);
+    if (const auto checked = gfx2agb::check_bitmap(settings); !checked) {
+        fmt::print(stderr, "{}", checked.error);
+        return 1;
+    }
+
+    // Outputs appear at their paths only once every one is written
+    auto outputs = output::plan{};
+    if (outputData && !outputs.add("out-data", outputData)) {
+        return 1;
+    }
+    if (outputPaletteData && !outputs.add("out-palette-data", outputPaletteData)) {
+        return 1;
+    }
+
+    const auto* inPalette = args.get<const char*>("in-palette");
+    const auto paletteFile = inPalette ? util::read_file(inPalette) : std::optional<std::vector<std::byte>>{std::vector<std::byte>{}};
+    if (!paletteFile) {
+        fmt::print(stderr, "Could not read palette {}", inPalette);
+        return 1;
+    }
+    settings.palette = *paletteFile;
+
+    auto frames = open_frames(args.get<const char*>("in-images"), args.get<std::optional<std::string>>("first"));
+    if (!frames) {
+        return 1;
+    }
+    vlog::print("Converting {} frames of {}x{}", [&](){return fmt::make_format_args(frames->count, frames->width, frames->height);});
+
+    const auto sizes = gfx2agb::measure_bitmap(settings, frames->width, frames->height);
+    if (!sizes) {
+        fmt::print(stderr, "{}", sizes.error);
+        return 1;
+    }
+
+    if ((sizes.dataSize + 3) / 4 > delta::max_frame_words) {
+        fmt::print(stderr, "Frames of {} bytes are too large for the 16-bit word offsets of deltas", sizes.dataSize);
+        return 1;
+    }
+
+    const auto rowBytes = sizes.dataSize / std::size_t(std::max(sizes.height, 1));
+    if (*granularity == delta::granularity::scanline && (rowBytes * std::size_t(sizes.height) != sizes.dataSize || rowBytes % 4)) {
+        fmt::print(stderr, "Rows of {}x{} frames aren't whole words, use --granularity=word", sizes.width, sizes.height);
+        return 1;
+    }
+
+    if (frames->count > 0xffff) {
+        fmt::print(stderr, "{} frames don't fit the 16-bit frame count", frames->count);
+        return 1;
+    }
+
+    const auto first_error = [](std::span<const std::string> errors) {
+        const auto found = std::ranges::find_if(errors, [](const auto& error) {
+            return !error.empty();
+        });
+        if (found == errors.end()) {
+            return false;
+        }
+        fmt::print(stderr, "{}", *found);
+        return true;
+    };
+
+    // Numbered images decoded to count colors are kept for converting, within --decode-cache
+    const auto keepBytes = args.get<std::size_t>("decode-cache") * 1024 * 1024;
+    auto keptBytes = std::atomic<std::size_t>{};
+
+    // Mode 4 frames, and modes 3 and 5 with --colors, share a palette reduced from the colors of every frame
+    auto palette = std::vector<std::array<float, 4>>{};
+    if (settings.palette.empty() && (mode == 4 || settings.colors)) {
+        vlog::print("Counting colors of {} frames for a shared palette", [&](){return fmt::make_format_args(frames->count);});
+
+        // One histogram per thread, each counting a run of frames in order
+        auto histograms = std::vector<gfx2agb::color_histogram>(frame_threads(frames->count));
+        auto errors = std::vector<std::string>(frames->count);
+        for_each_frame(histograms.size(), [&](std::size_t run) {
+            const auto runEnd = ((run + 1) * frames->count) / histograms.size();
+            for (auto index = (run * frames->count) / histograms.size(); index < runEnd; ++index) {
+                const auto read = frames->with_frame(index, [&](const gfx2agb::rgba_image& image) {
+                    if (const auto result = gfx2agb::add_histogram(image, settings, histograms[run]); !result) {
+                        errors[index] = result.error;
+                    }
+                }, &keptBytes, keepBytes);
+                if (!read) {
+                    errors[index] = fmt::format("Could not read {}", frames->name(index));
+                }
+            }
+        });
+        if (first_error(errors)) {
+            return 1;
+        }
+
+        // Merges neighbouring runs in pairs, in parallel, so each color keeps its first occurrence in frame order as if merged one frame at a time
+        auto failed = std::atomic<bool>{};
+        while (histograms.size() > 1) {
+            parallel::for_each_band(histograms.size() / 2, 1, [&](std::size_t begin, std::size_t end) {
+                for (auto ii = begin; ii < end; ++ii) {
+                    if (const auto merged = gfx2agb::merge_histograms(histograms[ii * 2], std::move(histograms[(ii * 2) + 1])); !merged) {
+                        fmt::print(stderr, "{}", merged.error);
+                        failed = true;
+                    }
+                }
+            });
+            for (auto ii = std::size_t{1}; ii < (histograms.size() + 1) / 2; ++ii) {
+                histograms[ii] = std::move(histograms[ii * 2]);
+            }
+            histograms.resize((histograms.size() + 1) / 2);
+        }
+        if (failed) {
+            return 1;
+        }
+
+        if (const auto reduced = gfx2agb::reduce_histogram(histograms.front(), settings, palette); !reduced) {
+            fmt::print(stderr, "{}", reduced.error);
+            return 1;
+        }
+        settings.sharedPalette = palette;
+    }
+
+    if (outputData) {
+        vlog::print("Writing {}", [&](){return fmt::make_format_args(outputData);});
+
+        // Header of u16 frames, u16 granularity (0 word, 1 scanline), followed by each frame record
+        const auto header = std::array{
+            std::byte(frames->count & 0xff), std::byte((frames->count >> 8) & 0xff),
+            std::byte(*granularity == delta::granularity::word ? 0 : 1), std::byte{}
+        };
+        if (!outputs.append("out-data", header)) {
+            return 1;
+        }
+    }
+
+    // Frames convert and diff a chunk of one per thread at a time, and each chunk's records are written before the next chunk starts
+    // Only the last frame of a chunk is kept, to diff the next chunk's first frame against
+    const auto chunkSize = frame_threads(frames->count);
+    auto data = std::vector<std::vector<std::byte>>(chunkSize);
+    auto deltas = std::vector<delta::frame_type>(chunkSize);
+    auto errors = std::vector<std::string>(chunkSize);
+    auto previous = std::vector<std::byte>{};
+    auto paletteData = std::vector<std::byte>(outputPaletteData ? sizes.paletteDataSize : 0);
+    auto paletteDataSize = std::size_t{};
+
+    auto recordBytes = std::size_t{};
+    auto copiedBytes = std::size_t{};
+    auto transfers = std::size_t{};
+    auto peakBytes = std::size_t{};
+    for (auto chunk = std::size_t{}; chunk < frames->count; chunk += chunkSize) {
+        const auto count = std::min(chunkSize, frames->count - chunk);
+
+        // Every frame converts on its own once the palette is known
+        for_each_frame(count, [&](std::size_t slot) {
+            const auto index = chunk + slot;
+            errors[slot].clear();
+            data[slot].resize(sizes.dataSize);
+            auto buffers = gfx2agb::bitmap_outputs{};
+            buffers.data = data[slot];
+            if (index == 0) {
+                buffers.paletteData = paletteData;
+            }
+
+            const auto read = frames->with_frame(index, [&](const gfx2agb::rgba_image& image) {
+                const auto result = gfx2agb::convert_bitmap(image, settings, buffers);
+                if (!result) {
+                    errors[slot] = result.error;
+                } else if (index == 0) {
+                    paletteDataSize = result.paletteDataSize;
+                }
+            });
+            if (!read) {
+                errors[slot] = fmt::format("Could not read {}", frames->name(index));
+            }
+        });
+        if (first_error(std::span{errors}.first(count))) {
+            return 1;
+        }
+
+        // Each frame is diffed against the one before it, the first is copied whole
+        for_each_frame(count, [&](std::size_t slot) {
+            const auto before = slot ? std::span<const std::byte>{data[slot - 1]} : std::span<const std::byte>{previous};
+            deltas[slot] = delta::encode(before, data[slot], *granularity, rowBytes);
+        });
+
+        for (auto slot = std::size_t{}; slot < count; ++slot) {
+            if (outputData && !outputs.append("out-data", deltas[slot].record)) {
+                return 1;
+            }
+            if (chunk + slot) {
+                recordBytes += deltas[slot].record.size();
+                copiedBytes += deltas[slot].copied;
+                transfers += deltas[slot].transfers;
+                peakBytes = std::max(peakBytes, deltas[slot].copied);
+            }
+        }
+        std::swap(previous, data[count - 1]);
+    }
+
+    if (outputPaletteData) {
+        vlog::print("Writing {}", [&](){return fmt::make_format_args(outputPaletteData);});
+        if (!outputs.write("out-palette-data", std::span{paletteData}.first(paletteDataSize))) {
+            return 1;
+        }
+    }
+
+    const auto fullBytes = sizes.dataSize * (frames->count - 1);
+    const auto changes = std::max(frames->count, std::size_t{2}) - 1;
+    fmt::print("{} frames: {} bytes of deltas after the first frame for {} bytes of whole frames ({:.1f}%), {:.0f} bytes in {:.1f} transfers copied per frame (at most {})\n",
+        frames->count, recordBytes, fullBytes, fullBytes ? 100.0 * double(recordBytes) / double(fullBytes) : 100.0,
+        double(copiedBytes) / double(changes), double(transfers) / double(changes), peakBytes
+    );
+
+    return outputs.commit() ? 0 : 1;
+}
+
+// Numbered images from first (or the first of default_firsts that exists) up to the first missing number, every frame of a GIF, or a single image
+static std::optional<frame_source> open_frames(const char* path, const std::optional<std::string>& first) noexcept {
+    auto frames = frame_source{};
+    const auto pattern = std::string_view{path};
+
+    if (pattern.find('%') != std::string_view::npos) {
+        auto number = default_firsts.front();
+        if (first) {
+            const auto [end, ec] = std::from_chars(first->data(), first->data() + first->size(), number);
+            if (ec != std::errc{} || end != first->data() + first->size()) {
+                fmt::print(stderr, "{} is not a frame number", *first);
+                return std::nullopt;
+            }
+        }
+
+        if (!numbered_path(pattern, number)) {
+            fmt::print(stderr, "Could not parse image pattern {} (expected one %d or %0Nd)", path);
+            return std::nullopt;
+        }
+
+        const auto exists = [&](int n) {
+            auto ec = std::error_code{};
+            return std::filesystem::exists(*numbered_path(pattern, n), ec);
+        };
+        if (!first) {
+            const auto found = std::find_if(default_firsts.cbegin(), default_firsts.cend(), exists);
+            number = found != default_firsts.cend() ? *found : number;
+        }
+        for (; exists(number); ++number) {
+            frames.paths.push_back(*numbered_path(pattern, number));
+        }
+
+        if (frames.paths.empty()) {
+            fmt::print(stderr, "No image {}", *numbered_path(pattern, number));
+            return std::nullopt;
+        }
+
+        int components;
+        vlog::print("Reading {} numbered images from {}", [&](){return fmt::make_format_args(frames.paths.size(), frames.paths.front());});
+        if (!stbi_info(frames.paths.front().c_str(), &frames.width, &frames.height, &components)) {
+            fmt::print(stderr, "Could not read image {}", frames.paths.front());
+            return std::nullopt;
+        }
+        frames.count = frames.paths.size();
+        frames.kept.resize(frames.count);
+        return frames;
+    }
+
+    const auto file = util::read_file(path);
+    if (!file) {
+        fmt::print(stderr, "Could not read image {}", path);
+        return std::nullopt;
+    }
+
+    if (file->size() >= gif_signature.size() && std::equal(gif_signature.cbegin(), gif_signature.cend(), file->cbegin(), [](char c, std::byte b) {
+        return std::byte(c) == b;
+    })) {
+        vlog::print("Reading GIF {}", [&](){return fmt::make_format_args(path);});
+        int count;
+        frames.gif = image::load_gif(*file, frames.width, frames.height, count);
+        if (!frames.gif) {
+            fmt::print(stderr, "Could not read GIF {}", path);
+            return std::nullopt;
+        }
+        frames.count = std::size_t(count);
+        return frames;
+    }
+
+    // A still image is a sequence of one frame
+    int components;
+    if (!stbi_info(path, &frames.width, &frames.height, &components)) {
+        fmt::print(stderr, "Could not read image {}", path);
+        return std::nullopt;
+    }
+    frames.paths.emplace_back(path);
+    frames.kept.resize(1);
+    frames.count = 1;
+    return frames;
+}
@@ -0,0 +1,317 @@
+#include "serve.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <semaphore>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <ctopt.hpp>
+#include <fmt/format.h>
+
+#include "bitmap.hpp"
+#include "decode_cache.hpp"
+#include "logging.hpp"
+#include "options.hpp"
+#include "parallel.hpp"
+#include "util.hpp"
+
+#if !defined(_WIN32)
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Protocol: a client writes one request per line, the same arguments as `gfx2agb bitmap` (optionally starting with "bitmap")
+// Outputs given as "-" come back through the socket rather than being written to a file
+// Each request is answered with:
+//   status <exit code>\n
+//   error <byte count>\n<bytes>                  (on failure, the messages bitmap would print to stderr)
+//   output <option name> <byte count>\n<bytes>   (once per "-" output, on success)
+//   end\n
+// The request "shutdown" stops the server once running requests finish, closing idle connections
+
+#if defined(_WIN32)
+
+int serve(ctopt::args::const_iterator, ctopt::args::const_iterator) {
+    fmt::print(stderr, "serve needs Unix domain sockets, which this build doesn't support");
+    return 1;
+}
+
+#else
+
+namespace fs = std::filesystem;
+
+namespace {
+
+    // Longest a waiting accept or recv goes before checking for shutdown
+    constexpr auto stop_poll_ms = 200;
+
+    // A client hanging up mid-response must not raise SIGPIPE
+#if defined(MSG_NOSIGNAL)
+    constexpr auto send_flags = MSG_NOSIGNAL;
+#else
+    constexpr auto send_flags = 0;
+#endif
+
+    struct server_type {
+        std::counting_semaphore<> slots;
+        std::size_t threadsPerRequest;
+        const vlog::sink_type* sink; // Verbose messages of requests
+        image::decode_cache& decodeCache;
+        std::atomic<bool> stopping;
+        std::mutex mutex;
+        std::condition_variable idle;
+        std::size_t connections;
+    };
+
+    struct socket_output {
+        std::string name;
+        fs::path path;
+    };
+
+    // Options that name an output file, with their short form
+    constexpr auto output_options = std::array<std::pair<std::string_view, std::string_view>, 5>{{
+        {"out-data", "-o"},
+        {"out-palette-data", "-p"},
+        {"out-png", ""},
+        {"out-palette-png", ""},
+        {"out-palette-gpl", ""}
+    }};
+
+}
+
+static void handle_connection(server_type& server, int fd) noexcept;
+static std::vector<socket_output> redirect_outputs(std::vector<std::string>& arguments, std::string& error);
+static bool send_all(int fd, std::string_view data) noexcept;
+
+int serve(ctopt::args::const_iterator begin, ctopt::args::const_iterator end) {
+    using namespace options;
+
+    const auto args = get_opts_serve(std::move(begin), std::move(end));
+    if (!args) {
+        fmt::print(stderr, "{}\n", args.error_str());
+        fmt::print("{}", get_opts_serve.help_str());
+        return 1;
+    }
+
+    const auto socketPath = args.get<std::string>("socket");
+    auto address = sockaddr_un{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        fmt::print(stderr, "Socket path {} is too long", socketPath);
+        return 1;
+    }
+    std::ranges::copy(socketPath, address.sun_path);
+
+    const auto listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        fmt::print(stderr, "Could not create socket");
+        return 1;
+    }
+
+    ::unlink(socketPath.c_str()); // Left over from a previous server
+    if (::bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || ::listen(listener, SOMAXCONN) != 0) {
+        fmt::print(stderr, "Could not listen on {}", socketPath);
+        ::close(listener);
+        return 1;
+    }
+
+    const auto jobs = [&]() {
+        const auto count = std::size_t(std::max(args.get<int>("jobs"), 0));
+        return count ? count : std::size_t(std::max(std::thread::hardware_concurrency(), 1u));
+    }();
+
+    auto decodeCache = image::decode_cache{args.get<std::size_t>("decode-cache") * 1024 * 1024};
+
+    auto server = server_type{
+        std::counting_semaphore<>{std::ptrdiff_t(jobs)},
+        std::max(parallel::concurrency() / jobs, std::size_t{1}),
+        vlog::sink,
+        decodeCache,
+        false, {}, {}, 0
+    };
+
+    vlog::print("Serving on {} ({} concurrent requests)", [&](){return fmt::make_format_args(socketPath, jobs);});
+
+    while (!server.stopping) {
+        auto pfd = pollfd{listener, POLLIN, 0};
+        if (::poll(&pfd, 1, stop_poll_ms) <= 0) {
+            continue;
+        }
+
+        const auto fd = ::accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            continue;
+        }
+#if defined(SO_NOSIGPIPE)
+        const auto noSigPipe = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+#endif
+
+        {
+            const auto lock = std::scoped_lock{server.mutex};
+            ++server.connections;
+        }
+        std::thread{handle_connection, std::ref(server), fd}.detach();
+    }
+
+    ::close(listener);
+    ::unlink(socketPath.c_str());
+
+    auto lock = std::unique_lock{server.mutex};
+    server.idle.wait(lock, [&]() {
+        return server.connections == 0;
+    });
+
+    vlog::print("Stopped serving on {}", [&](){return fmt::make_format_args(socketPath);});
+    return 0;
+}
+
+static void handle_connection(server_type& server, int fd) noexcept {
+    auto pending = std::string{};
+    auto buffer = std::array<char, 4096>{};
+
+    const auto respond = [&](std::string_view line) {
+        auto arguments = util::split_args(line);
+        if (arguments.empty()) {
+            return true;
+        }
+
+        if (arguments.front() == "shutdown") {
+            server.stopping = true;
+            return send_all(fd, "status 0\nend\n");
+        }
+
+        if (arguments.front() == "bitmap") {
+            arguments.erase(arguments.cbegin());
+        }
+
+        auto status = 1;
+        auto error = std::string{};
+        const auto outputs = redirect_outputs(arguments, error);
+        if (error.empty()) {
+            server.slots.acquire();
+            vlog::errors = &error;
+            try {
+                parallel::max_threads = server.threadsPerRequest;
+                vlog::sink = server.sink;
+                status = bitmap(arguments, {}, &server.decodeCache);
+            } catch (const std::exception& e) {
+                vlog::error("Request threw: {}", e.what());
+            } catch (...) {
+                vlog::error("Request threw an unknown exception");
+            }
+            vlog::errors = nullptr;
+            server.slots.release();
+        }
+
+        auto ok = send_all(fd, fmt::format("status {}\n", status));
+        if (status != 0) {
+            if (error.empty()) {
+                error = "Conversion failed";
+            }
+            ok = ok && send_all(fd, fmt::format("error {}\n", error.size())) && send_all(fd, error);
+        }
+        for (const auto& [name, path] : outputs) {
+            auto ifs = std::ifstream(path, std::ios::binary);
+            const auto data = std::string{std::istreambuf_iterator<char>{ifs}, std::istreambuf_iterator<char>{}};
+            ifs.close();
+
+            auto ec = std::error_code{};
+            fs::remove(path, ec);
+
+            if (status == 0) {
+                ok = ok && send_all(fd, fmt::format("output {} {}\n", name, data.size())) && send_all(fd, data);
+            }
+        }
+        return ok && send_all(fd, "end\n");
+    };
+
+    for (;;) {
+        // An idle client must not keep a stopping server waiting
+        auto pfd = pollfd{fd, POLLIN, 0};
+        const auto ready = ::poll(&pfd, 1, stop_poll_ms);
+        if (server.stopping) {
+            break;
+        } else if (ready <= 0) {
+            continue;
+        }
+
+        const auto count = ::recv(fd, buffer.data(), buffer.size(), 0);
+        if (count <= 0) {
+            break;
+        }
+        pending.append(buffer.data(), std::size_t(count));
+
+        auto ok = true;
+        for (auto newline = pending.find('\n'); ok && newline != std::string::npos; newline = pending.find('\n')) {
+            const auto line = pending.substr(0, newline);
+            pending.erase(0, newline + 1);
+            ok = respond(line);
+        }
+
+        if (!ok || server.stopping) {
+            break;
+        }
+    }
+
+    ::close(fd);
+
+    const auto lock = std::scoped_lock{server.mutex};
+    --server.connections;
+    server.idle.notify_all();
+}
+
+static std::vector<socket_output> redirect_outputs(std::vector<std::string>& arguments, std::string& error) {
+    static auto counter = std::atomic<std::size_t>{};
+
+    auto ec = std::error_code{};
+    const auto directory = fs::temp_directory_path(ec);
+
+    auto result = std::vector<socket_output>{};
+    const auto redirect = [&](std::string_view name) {
+        if (ec) {
+            error = fmt::format("No temporary directory for output {}: {}", name, ec.message());
+            return std::string{"-"};
+        }
+        auto path = directory / fmt::format("gfx2agb-{}-{}-{}", ::getpid(), counter++, name);
+        result.push_back({std::string{name}, path});
+        return path.string();
+    };
+
+    for (auto it = arguments.begin(); it != arguments.end(); ++it) {
+        for (const auto& [name, shortName] : output_options) {
+            const auto longName = fmt::format("--{}", name);
+            if (*it == fmt::format("{}=-", longName)) {
+                *it = fmt::format("{}={}", longName, redirect(name));
+            } else if ((*it == longName || (!shortName.empty() && *it == shortName)) && std::next(it) != arguments.end() && *std::next(it) == "-") {
+                *++it = redirect(name);
+            }
+        }
+    }
+    return result;
+}
+
+static bool send_all(int fd, std::string_view data) noexcept {
+    while (!data.empty()) {
+        const auto sent = ::send(fd, data.data(), data.size(), send_flags);
+        if (sent <= 0) {
+            return false;
+        }
+        data.remove_prefix(std::size_t(sent));
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,291 @@
+#include "tiles.hpp"
+
+#include <optional>
+#include <span>
+#include <string_view>
+
+#include <ctopt.hpp>
+#include <fmt/format.h>
+
+#include "banks.hpp"
+#include "color_format.hpp"
+#include "image_io.hpp"
+#include "logging.hpp"
+#include "options.hpp"
+#include "output.hpp"
+#include "palette.hpp"
+#include "tileset.hpp"
+#include "util.hpp"
+
+namespace {
+
+    template <std::floating_point T>
+    constexpr auto pc_display_sRGB = static_cast<T>(2.2);
+
+    constexpr auto png_components = 4;
+
+    // Screenblocks hold 32x32 map entries
+    constexpr auto screenblock_size = 32;
+
+    constexpr auto max_tiles = std::size_t{1024}; // Tile number bits of a regular map entry
+    constexpr auto max_affine_tiles = std::size_t{256};
+
+}
+
+static std::vector<char> encode_map(const tileset::tileset_type& tileset, int bank, const std::vector<std::size_t>& tileBanks, bool affine, bool screenblocks) noexcept;
+
+int tiles(ctopt::args::const_iterator begin, ctopt::args::const_iterator end) {
+    using namespace options;
+
+    const auto args = get_opts_tiles(std::move(begin), std::move(end));
+    if (!args) {
+        fmt::print(stderr, "{}\n", args.error_str());
+        fmt::print("{}", get_opts_tiles.help_str());
+        return 1;
+    }
+
+    const auto* outputTiles = args.get<const char*>("out-tiles");
+    const auto* outputMap = args.get<const char*>("out-map");
+    const auto* outputPaletteData = args.get<const char*>("out-palette-data");
+    const auto* outputBanks = args.get<const char*>("out-banks");
+    if (!outputTiles && !outputMap && !outputPaletteData && !outputBanks) {
+        fmt::print(stderr, "No outputs");
+        fmt::print("{}", get_opts_tiles.help_str());
+        return 1;
+    }
+
+    // Outputs appear at their paths only once every one is written
+    auto outputs = output::plan{};
+    for (const auto* name : {"out-tiles", "out-map", "out-palette-data", "out-banks"}) {
+        const auto* path = args.get<const char*>(name);
+        if (path && !outputs.add(name, path)) {
+            return 1;
+        }
+    }
+
+    const auto affine = args.get<bool>("affine");
+    const auto bpp = affine ? std::size_t{8} : args.get<std::size_t>("bpp");
+    if (bpp != 4 && bpp != 8) {
+        fmt::print(stderr, "bpp ({}) must be 4 or 8", bpp);
+        return 1;
+    }
+
+    const auto bank = args.get<int>("palette-bank");
+    if (bank < 0 || bank > 15) {
+        fmt::print(stderr, "{} is not a palette bank (expected 0 to 15)", bank);
+        return 1;
+    }
+
+    const auto bankCount = args.get<int>("palette-banks");
+    if (bankCount < 1 || bankCount > banks::max_banks) {
+        fmt::print(stderr, "{} is not a number of palette banks (expected 1 to {})", bankCount, banks::max_banks);
+        return 1;
+    }
+    if (bankCount > 1 && bpp != 4) {
+        fmt::print(stderr, "Palette banks need 4bpp tiles");
+        return 1;
+    }
+    if (bank + bankCount > banks::max_banks) {
+        fmt::print(stderr, "{} palette banks from bank {} run past bank {}", bankCount, bank, banks::max_banks - 1);
+        return 1;
+    }
+
+    // Affine maps are a single square of entries, never split into screenblocks
+    const auto layout = args.get<std::optional<std::string>>("map-layout").value_or(affine ? "linear" : "screenblock");
+    if (layout != "screenblock" && layout != "linear") {
+        fmt::print(stderr, "Unknown map layout {} (expected screenblock, linear)", layout);
+        return 1;
+    }
+    if (affine && layout == "screenblock") {
+        fmt::print(stderr, "Affine maps are linear, --map-layout=screenblock cannot be used with --affine");
+        return 1;
+    }
+
+    auto formatError = std::string{};
+    const auto colorFormat = color_format::parse(args.get<std::string>("format"), formatError);
+    if (colorFormat.empty()) {
+        fmt::print(stderr, "Could not parse color format {}", args.get<std::string>("format"));
+        if (!formatError.empty()) {
+            fmt::print(stderr, ": {}", formatError);
+        }
+        return 1;
+    }
+
+    const auto quantizerName = args.get<std::string>("quantizer");
+    const auto quantizer = palette::parse_quantizer(quantizerName);
+    if (!quantizer) {
+        fmt::print(stderr, "Unknown quantizer {} (expected kmeans, median-cut, octree, wu)", quantizerName);
+        return 1;
+    }
+
+    const auto maxColors = 1 << bpp;
+    const auto colors = args.get<int>("colors") ? args.get<int>("colors") : maxColors;
+    if (colors > maxColors) {
+        fmt::print(stderr, "{} colors don't fit {}bpp tiles", colors, bpp);
+        return 1;
+    }
+
+    const auto [inGamma, outGamma] = [&]() {
+        const auto gamma = args.get<std::pair<float, float>>("gamma");
+        if (std::get<1>(gamma) == 0.0f) {
+            return std::make_pair(pc_display_sRGB<float>, std::get<0>(gamma));
+        }
+        return gamma;
+    }();
+
+    int width, height, components;
+    vlog::print("Reading image {}", [&](){return fmt::make_format_args(args.get<const char*>("in-image"));});
+    auto image = image::load(args.get<const char*>("in-image"), width, height, components);
+    if (!image) {
+        fmt::print(stderr, "Could not read image {}", args.get<std::string>("in-image"));
+        return 1;
+    }
+
+    if (width % tileset::tile_size || height % tileset::tile_size) {
+        fmt::print(stderr, "Image size {}x{} is not a multiple of {}", width, height, tileset::tile_size);
+        return 1;
+    }
+
+    auto imageLinear = image::buffer<float>{};
+    auto scratch = image::buffer<float>{};
+    auto indices = image::buffer<std::uint8_t>{};
+    auto packed = std::vector<stbi_uc>{};
+
+    vlog::print("Converting to linear with gamma {}", [&](){return fmt::make_format_args(inGamma);});
+    image::to_float({image.get(), std::size_t(width) * std::size_t(height) * png_components}, width, height, inGamma, imageLinear);
+    image.reset();
+
+    // With --palette-banks each tile takes the bank of colors that reproduces it best, and palette holds every bank padded to 16 colors
+    auto palette = std::vector<std::array<float, 4>>{};
+    auto tileBanks = std::vector<std::size_t>{};
+    if (bankCount > 1) {
+        auto split = [&]() {
+            const auto* inPalette = args.get<const char*>("in-palette");
+            if (inPalette) {
+                const auto loaded = palette::load(inPalette, colorFormat, inGamma);
+                auto bankPalettes = std::vector<std::vector<std::array<float, 4>>>{};
+                for (auto first = loaded.cbegin(); first != loaded.cend() && bankPalettes.size() < std::size_t(bankCount);) {
+                    const auto last = first + std::min(loaded.cend() - first, std::ptrdiff_t{banks::bank_colors});
+                    bankPalettes.emplace_back(first, last);
+                    first = last;
+                }
+
+                vlog::print("Choosing between {} palette banks for each tile", [&](){return fmt::make_format_args(bankPalettes.size());});
+                return banks::assign(imageLinear, colorFormat, 1.0f / outGamma, std::move(bankPalettes));
+            }
+
+            vlog::print("Splitting tiles between up to {} palette banks of {} colors with {}", [&](){return fmt::make_format_args(bankCount, colors, quantizerName);});
+            return banks::optimize(imageLinear, colorFormat, 1.0f / outGamma, bankCount, colors, *quantizer, args.get<bool>("refine"));
+        }();
+
+        vlog::print("{} palette banks used", [&](){return fmt::make_format_args(split.palettes.size());});
+        for (auto& bankPalette : split.palettes) {
+            bankPalette.resize(banks::bank_colors);
+            palette.insert(palette.cend(), bankPalette.cbegin(), bankPalette.cend());
+        }
+        indices = std::move(split.indices);
+        tileBanks = std::move(split.tileBanks);
+    } else {
+        palette = [&]() {
+            const auto* inPalette = args.get<const char*>("in-palette");
+            auto palette = inPalette ? palette::load(inPalette, colorFormat, inGamma) : std::vector<std::array<float, 4>>{};
+            if (inPalette && palette.size() <= std::size_t(colors)) {
+                return palette;
+            }
+
+            const auto histogram = inPalette ? palette::histogram_type{palette, {}} : palette::extract(colorFormat, imageLinear);
+            if (histogram.colors.size() <= std::size_t(colors)) {
+                vlog::print("Palette already fits in {} colors ({} colors)", [&](){return fmt::make_format_args(colors, histogram.colors.size());});
+                return histogram.colors;
+            }
+
+            vlog::print("Reducing to {} colors with {}", [&](){return fmt::make_format_args(colors, quantizerName);});
+            return palette::quantize(histogram.colors, colors, *quantizer, args.get<bool>("refine"), histogram.counts);
+        }();
+
+        vlog::print("Applying palette ({} colors)", [&](){return fmt::make_format_args(palette.size());});
+        image::palette_lookup{palette, colorFormat, 1.0f / outGamma}.palettize(imageLinear, indices);
+    }
+
+    const auto tiles = tileset::build(indices, !affine && !args.get<bool>("no-flip"));
+    vlog::print("{}x{} tiles, {} unique", [&](){return fmt::make_format_args(tiles.columns, tiles.rows, tiles.tiles.size());});
+
+    const auto tileLimit = affine ? max_affine_tiles : max_tiles;
+    if (outputMap && tiles.tiles.size() > tileLimit) {
+        fmt::print(stderr, "{} unique tiles is more than a map can address ({})", tiles.tiles.size(), tileLimit);
+        return 1;
+    }
+
+    if (outputTiles) {
+        vlog::print("Writing {}", [&](){return fmt::make_format_args(outputTiles);});
+        const auto data = util::repack_data(tileset::pixels(tiles.tiles), bpp);
+        if (!outputs.write("out-tiles", std::as_bytes(std::span{data}))) {
+            return 1;
+        }
+    }
+
+    if (outputMap) {
+        vlog::print("Writing {}", [&](){return fmt::make_format_args(outputMap);});
+        const auto data = encode_map(tiles, bank, tileBanks, affine, layout == "screenblock");
+        if (!outputs.write("out-map", std::as_bytes(std::span{data}))) {
+            return 1;
+        }
+    }
+
+    if (outputBanks) {
+        vlog::print("Writing {}", [&](){return fmt::make_format_args(outputBanks);});
+        auto data = std::vector<std::byte>(tiles.map.size(), std::byte(bank));
+        for (auto ii = std::size_t{}; ii < tileBanks.size(); ++ii) {
+            data[ii] = std::byte(std::size_t(bank) + tileBanks[ii]);
+        }
+        if (!outputs.write("out-banks", data)) {
+            return 1;
+        }
+    }
+
+    if (outputPaletteData) {
+        vlog::print("Writing {}", [&](){return fmt::make_format_args(outputPaletteData);});
+        image::flatten(palette, static_cast<int>(palette.size()), 1, scratch);
+        image::to_data(scratch, 1.0f / outGamma, colorFormat, packed);
+        if (!outputs.write("out-palette-data", std::as_bytes(std::span{packed}))) {
+            return 1;
+        }
+    }
+
+    return outputs.commit() ? 0 : 1;
+}
+
+static std::vector<char> encode_map(const tileset::tileset_type& tileset, int bank, const std::vector<std::size_t>& tileBanks, bool affine, bool screenblocks) noexcept {
+    const auto entry_bytes = affine ? 1 : 2;
+
+    // Screenblock layout pads the map to whole screenblocks, stored one after another
+    const auto columns = screenblocks ? ((tileset.columns + screenblock_size - 1) / screenblock_size) * screenblock_size : tileset.columns;
+    const auto rows = screenblocks ? ((tileset.rows + screenblock_size - 1) / screenblock_size) * screenblock_size : tileset.rows;
+
+    const auto offset_of = [&](int xx, int yy) {
+        if (!screenblocks) {
+            return (std::size_t(yy) * std::size_t(columns)) + std::size_t(xx);
+        }
+        const auto block = (std::size_t(yy / screenblock_size) * std::size_t(columns / screenblock_size)) + std::size_t(xx / screenblock_size);
+        return (block * screenblock_size * screenblock_size) + std::size_t(((yy % screenblock_size) * screenblock_size) + (xx % screenblock_size));
+    };
+
+    auto result = std::vector<char>(std::size_t(columns) * std::size_t(rows) * entry_bytes);
+    for (int yy = 0; yy < tileset.rows; ++yy) {
+        for (int xx = 0; xx < tileset.columns; ++xx) {
+            const auto idx = (std::size_t(yy) * std::size_t(tileset.columns)) + std::size_t(xx);
+            const auto& entry = tileset.map[idx];
+            auto* dst = result.data() + (offset_of(xx, yy) * entry_bytes);
+
+            if (affine) {
+                dst[0] = char(entry.tile);
+                continue;
+            }
+
+            const auto value = std::uint16_t(entry.tile | (std::size_t(entry.hflip) << 10) | (std::size_t(entry.vflip) << 11) | ((std::size_t(bank) + (tileBanks.empty() ? 0 : tileBanks[idx])) << 12));
+            dst[0] = char(value & 0xff);
+            dst[1] = char(value >> 8);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,107 @@
+#include "tileset.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <optional>
+#include <unordered_map>
+
+namespace {
+
+    struct tile_hash {
+        [[nodiscard]]
+        std::size_t operator()(const tileset::tile_type& tile) const noexcept {
+            auto hash = std::uint64_t{0x9e3779b97f4a7c15};
+            for (auto ii = std::size_t{}; ii < tile.size(); ii += sizeof(std::uint64_t)) {
+                auto word = std::uint64_t{};
+                std::memcpy(&word, tile.data() + ii, sizeof(word));
+                hash = (hash ^ word) * 0xff51afd7ed558ccd;
+                hash ^= hash >> 32;
+            }
+            return std::size_t(hash);
+        }
+    };
+
+    [[nodiscard]]
+    tileset::tile_type flip_horizontal(const tileset::tile_type& tile) noexcept {
+        auto result = tile;
+        for (auto row = result.begin(); row != result.end(); row += tileset::tile_size) {
+            std::reverse(row, row + tileset::tile_size);
+        }
+        return result;
+    }
+
+    [[nodiscard]]
+    tileset::tile_type flip_vertical(const tileset::tile_type& tile) noexcept {
+        auto result = tileset::tile_type{};
+        for (int yy = 0; yy < tileset::tile_size; ++yy) {
+            std::copy_n(tile.begin() + (yy * tileset::tile_size), tileset::tile_size, result.begin() + ((tileset::tile_size - 1 - yy) * tileset::tile_size));
+        }
+        return result;
+    }
+
+}
+
+tileset::tileset_type tileset::build(const image::buffer<std::uint8_t>& indices, bool flips) noexcept {
+    auto result = tileset_type{};
+    result.columns = indices.width / tile_size;
+    result.rows = indices.height / tile_size;
+    result.map.reserve(std::size_t(result.columns) * std::size_t(result.rows));
+
+    // Only unique tiles as they were first seen go in the table, a new tile is looked up under each of its flips
+    auto table = std::unordered_map<tile_type, std::size_t, tile_hash>{};
+    table.reserve(result.map.capacity());
+
+    const auto find = [&table](const tile_type& tile) {
+        const auto it = table.find(tile);
+        return it == table.cend() ? std::optional<std::size_t>{} : std::optional<std::size_t>{it->second};
+    };
+
+    auto tile = tile_type{};
+    for (int ty = 0; ty < result.rows; ++ty) {
+        for (int tx = 0; tx < result.columns; ++tx) {
+            for (int yy = 0; yy < tile_size; ++yy) {
+                const auto row = indices.row((ty * tile_size) + yy).subspan(std::size_t(tx) * tile_size, tile_size);
+                std::ranges::copy(row, tile.begin() + (yy * tile_size));
+            }
+
+            if (const auto same = find(tile)) {
+                result.map.push_back({*same, false, false});
+                continue;
+            }
+
+            if (flips) {
+                const auto hflipped = flip_horizontal(tile);
+                if (const auto match = find(hflipped)) {
+                    result.map.push_back({*match, true, false});
+                    continue;
+                }
+
+                const auto vflipped = flip_vertical(tile);
+                if (const auto match = find(vflipped)) {
+                    result.map.push_back({*match, false, true});
+                    continue;
+                }
+
+                if (const auto match = find(flip_vertical(hflipped))) {
+                    result.map.push_back({*match, true, true});
+                    continue;
+                }
+            }
+
+            table.emplace(tile, result.tiles.size());
+            result.map.push_back({result.tiles.size(), false, false});
+            result.tiles.emplace_back(tile);
+        }
+    }
+
+    return result;
+}
+
+std::vector<std::uint8_t> tileset::pixels(const std::vector<tile_type>& tiles) noexcept {
+    auto result = std::vector<std::uint8_t>{};
+    result.reserve(tiles.size() * std::tuple_size_v<tile_type>);
+    for (const auto& tile : tiles) {
+        result.insert(result.end(), tile.cbegin(), tile.cend());
+    }
+    return result;
+}
@@ -0,0 +1,131 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+
+#include <fmt/format.h>
+
+namespace {
+
+    // Small, stable thread IDs for the trace viewer's tracks
+    std::size_t thread_id() noexcept {
+        static auto next = std::atomic<std::size_t>{1};
+        thread_local const auto id = next++;
+        return id;
+    }
+
+    struct stage_type {
+        std::string_view name;
+        std::size_t depth;
+        std::size_t calls;
+        double duration;
+        std::vector<std::pair<std::string_view, std::uint64_t>> counters;
+    };
+
+}
+
+trace::recorder::~recorder() noexcept {
+    if (current == this) {
+        current = m_previous;
+    }
+}
+
+void trace::recorder::install() noexcept {
+    m_thread = thread_id();
+    m_previous = current;
+    current = this;
+}
+
+double trace::recorder::elapsed() const noexcept {
+    return std::chrono::duration<double, std::micro>(clock_type::now() - m_epoch).count();
+}
+
+void trace::recorder::begin(std::string_view name) noexcept {
+    m_open.emplace_back(m_spans.size());
+    m_spans.push_back({std::string{name}, elapsed(), 0.0, m_open.size() - 1, {}});
+}
+
+void trace::recorder::end() noexcept {
+    if (m_open.empty()) {
+        return;
+    }
+
+    auto& span = m_spans[m_open.back()];
+    span.duration = elapsed() - span.start;
+    m_open.pop_back();
+}
+
+void trace::recorder::count(std::string_view counter, std::uint64_t value) noexcept {
+    if (m_open.empty()) {
+        return;
+    }
+
+    auto& counters = m_spans[m_open.back()].counters;
+    const auto it = std::ranges::find(counters, counter, &std::pair<std::string, std::uint64_t>::first);
+    if (it != counters.end()) {
+        it->second += value;
+    } else {
+        counters.emplace_back(counter, value);
+    }
+}
+
+bool trace::recorder::write_json(const char* path) const noexcept {
+    auto json = std::string{"{\"displayTimeUnit\":\"ms\",\"traceEvents\":["};
+    for (const auto& span : m_spans) {
+        if (&span != &m_spans.front()) {
+            json += ',';
+        }
+
+        // Span names and counters are fixed identifiers, so need no escaping
+        fmt::format_to(std::back_inserter(json), "\n{{\"name\":\"{}\",\"cat\":\"gfx2agb\",\"ph\":\"X\",\"ts\":{:.3f},\"dur\":{:.3f},\"pid\":1,\"tid\":{},\"args\":{{",
+            span.name, span.start, span.duration, m_thread
+        );
+        for (const auto& [counter, value] : span.counters) {
+            fmt::format_to(std::back_inserter(json), "{}\"{}\":{}", &counter == &span.counters.front().first ? "" : ",", counter, value);
+        }
+        json += "}}";
+    }
+    json += "\n]}\n";
+
+    auto ofs = std::ofstream(path, std::ios::binary);
+    if (!ofs.is_open()) {
+        return false;
+    }
+    ofs << json;
+    return ofs.good();
+}
+
+void trace::recorder::print_stats(std::FILE* stream) const noexcept {
+    // Spans of the same name are one stage, listed in the order they first ran
+    auto stages = std::vector<stage_type>{};
+    for (const auto& span : m_spans) {
+        auto it = std::ranges::find(stages, std::string_view{span.name}, &stage_type::name);
+        if (it == stages.end()) {
+            it = stages.insert(stages.end(), {span.name, span.depth, 0, 0.0, {}});
+        }
+
+        ++it->calls;
+        it->duration += span.duration;
+        for (const auto& [counter, value] : span.counters) {
+            const auto found = std::ranges::find(it->counters, std::string_view{counter}, &std::pair<std::string_view, std::uint64_t>::first);
+            if (found != it->counters.end()) {
+                found->second += value;
+            } else {
+                it->counters.emplace_back(counter, value);
+            }
+        }
+    }
+
+    const auto total = elapsed();
+    fmt::print(stream, "{:<24} {:>6} {:>11} {:>6}  (thread {})\n", "Stage", "Calls", "Time", "Share", m_thread);
+    for (const auto& stage : stages) {
+        const auto name = std::string(stage.depth * 2, ' ') + std::string{stage.name};
+        fmt::print(stream, "{:<24} {:>6} {:>8.3f} ms {:>5.1f}%", name, stage.calls, stage.duration / 1000.0, total > 0.0 ? 100.0 * stage.duration / total : 0.0);
+        for (const auto& [counter, value] : stage.counters) {
+            fmt::print(stream, "  {}={}", counter, value);
+        }
+        fmt::print(stream, "\n");
+    }
+    fmt::print(stream, "{:<24} {:>6} {:>8.3f} ms\n", "Total", "", total / 1000.0);
+}
@@ -1,9 +1,72 @@
 #include "util.hpp"
 
 #include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
 
 #include <exprtk.hpp>
 
+#if defined(_WIN32)
+#   define WIN32_LEAN_AND_MEAN
+#   define NOMINMAX
+#   include <windows.h>
+#   include <psapi.h>
+#else
+#   include <sys/resource.h>
+#endif
+
+namespace {
+
+    // 8 / Bpp indices to each byte, the first in the lowest bits, the last byte padded with zeros
+    // The indices of a byte are combined with no carried state, so runs of bytes vectorize
+    template <std::size_t Bpp, typename T>
+    void pack_bits(const std::vector<T>& data, std::vector<char>& out) noexcept {
+        static constexpr auto per_byte = 8 / Bpp;
+        static constexpr auto mask = (1U << Bpp) - 1;
+
+        const auto whole = data.size() / per_byte;
+        const auto* src = data.data();
+        auto* dst = reinterpret_cast<std::uint8_t*>(out.data());
+        for (auto ii = std::size_t{}; ii < whole; ++ii) {
+            auto byte = 0U;
+            for (auto jj = std::size_t{}; jj < per_byte; ++jj) {
+                byte |= (unsigned(src[(ii * per_byte) + jj]) & mask) << (jj * Bpp);
+            }
+            dst[ii] = std::uint8_t(byte);
+        }
+
+        if (const auto rest = data.size() - (whole * per_byte)) {
+            auto byte = 0U;
+            for (auto jj = std::size_t{}; jj < rest; ++jj) {
+                byte |= (unsigned(src[(whole * per_byte) + jj]) & mask) << (jj * Bpp);
+            }
+            dst[whole] = std::uint8_t(byte);
+        }
+    }
+
+    // Each index in bytes little-endian bytes, zeros past the width of the index type
+    template <typename T>
+    void pack_bytes(const std::vector<T>& data, std::size_t bytes, std::vector<char>& out) noexcept {
+        if (bytes == sizeof(T) && std::endian::native == std::endian::little) {
+            std::memcpy(out.data(), data.data(), out.size());
+            return;
+        }
+
+        const auto copy = std::min(bytes, sizeof(T));
+        auto* dst = reinterpret_cast<std::uint8_t*>(out.data());
+        for (const auto index : data) {
+            for (auto bb = std::size_t{}; bb < copy; ++bb) {
+                dst[bb] = std::uint8_t(index >> (bb * 8));
+            }
+            dst += bytes;
+        }
+    }
+
+}
+
 std::pair<int, int> util::parse_width_height(int inWidth, int inHeight, const std::string& widthExpr, const std::string& heightExpr) noexcept {
     auto symbol_table = exprtk::symbol_table<double>{};
     symbol_table.add_constant("iw", inWidth);
@@ -24,44 +87,119 @@ std::pair<int, int> util::parse_width_height(int inWidth, int inHeight, const st
     return {outWidth, outHeight};
 }
 
-std::vector<char> util::repack_data(const std::vector<std::size_t>& data, std::size_t bpp) noexcept {
-    const auto mask = (bpp << 1) - 1;
+template <typename T>
+std::vector<char> util::repack_data(const std::vector<T>& data, std::size_t bpp) noexcept {
+    auto result = std::vector<char>(((bpp * data.size()) + 7) / 8);
+
+    switch (bpp) {
+    case 1:
+        pack_bits<1>(data, result);
+        break;
+    case 2:
+        pack_bits<2>(data, result);
+        break;
+    case 4:
+        pack_bits<4>(data, result);
+        break;
+    default:
+        if (bpp % 8 == 0) {
+            pack_bytes(data, bpp / 8, result);
+            break;
+        }
 
-    auto size = bpp * data.size();
-    size = (size + 7) / 8;
+        // Any other size a bit at a time, lowest bits first
+        for (auto ii = std::size_t{}; ii < data.size(); ++ii) {
+            for (auto bit = std::size_t{}; bit < bpp && bit < sizeof(T) * 8; ++bit) {
+                if ((data[ii] >> bit) & 1) {
+                    const auto position = (ii * bpp) + bit;
+                    result[position / 8] = char(result[position / 8] | (1 << (position % 8)));
+                }
+            }
+        }
+        break;
+    }
+    return result;
+}
 
-    auto result = std::vector<char>{};
-    result.reserve(size);
+template std::vector<char> util::repack_data<std::uint8_t>(const std::vector<std::uint8_t>& data, std::size_t bpp) noexcept;
+template std::vector<char> util::repack_data<std::uint16_t>(const std::vector<std::uint16_t>& data, std::size_t bpp) noexcept;
+template std::vector<char> util::repack_data<std::uint32_t>(const std::vector<std::uint32_t>& data, std::size_t bpp) noexcept;
+
+std::vector<std::string> util::split_args(std::string_view line) noexcept {
+    auto result = std::vector<std::string>{};
+
+    auto current = std::string{};
+    auto inToken = false;
+    auto quote = char{};
+
+    for (auto it = line.cbegin(); it != line.cend(); ++it) {
+        const auto c = *it;
+
+        if (quote) {
+            if (c == quote) {
+                quote = {};
+            } else if (c == '\\' && quote == '"' && std::next(it) != line.cend() && (*std::next(it) == '"' || *std::next(it) == '\\')) {
+                current += *++it;
+            } else {
+                current += c;
+            }
+        } else if (c == '"' || c == '\'') {
+            quote = c;
+            inToken = true;
+        } else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            if (inToken) {
+                result.emplace_back(std::move(current));
+                current = {};
+                inToken = false;
+            }
+        } else {
+            current += c;
+            inToken = true;
+        }
+    }
 
-    auto buflen = std::make_signed_t<std::size_t>{};
-    auto buffer = std::size_t{};
+    if (inToken) {
+        result.emplace_back(std::move(current));
+    }
 
-    const auto copy_to_result = [&]() {
-        auto bytes = std::array<char, sizeof(buffer)>{};
+    return result;
+}
 
-        const auto copy = (buflen + 7) / 8;
-        std::memcpy(&bytes, &buffer, copy);
-        buffer >>= buflen;
+std::optional<std::vector<std::byte>> util::read_file(const char* path) noexcept {
+    auto ifs = std::ifstream(path, std::ios::binary | std::ios::ate);
+    if (!ifs.is_open()) {
+        return std::nullopt;
+    }
 
-        int ii = 0;
-        while (buflen >= 8 && ii < copy) {
-            result.emplace_back(bytes[ii++]);
-            buflen -= 8;
-        }
-    };
+    const auto size = ifs.tellg();
+    if (size < 0) {
+        return std::nullopt;
+    }
 
-    for (auto v : data) {
-        const auto d = v & mask;
-        buffer |= d << buflen;
-        buflen += static_cast<decltype(buflen)>(bpp);
+    auto result = std::vector<std::byte>(static_cast<std::size_t>(size));
+    ifs.seekg(0);
+    if (!ifs.read(reinterpret_cast<char*>(result.data()), static_cast<std::streamsize>(result.size()))) {
+        return std::nullopt;
+    }
+    return result;
+}
 
-        if (buflen >= 8) {
-            copy_to_result();
-        }
+std::size_t util::peak_memory() noexcept {
+#if defined(_WIN32)
+    auto counters = PROCESS_MEMORY_COUNTERS{};
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize;
     }
-    if (buflen) {
-        copy_to_result();
+    return 0;
+#else
+    auto usage = rusage{};
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
     }
-
-    return result;
+#   if defined(__APPLE__)
+    return std::size_t(usage.ru_maxrss); // Bytes
+#   else
+    return std::size_t(usage.ru_maxrss) * 1024; // Kilobytes
+#   endif
+#endif
 }